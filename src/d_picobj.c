@@ -118,7 +118,9 @@ create_picobj(int x, int y)
     box->pic->hw_ratio = 0.0;
     box->pic->pixmap = 0;
     box->pic->pix_width = 0;
+    box->pic->pix_w = 0;
     box->pic->pix_height = 0;
+    box->pic->pix_h = 0;
     box->pic->pix_rotation = 0;
     box->pic->pix_flipped = 0;
     box->points = point;
@@ -1423,11 +1423,11 @@ xim_set_spot(int x, int y)
 static Boolean
 is_preedit_running(void)
 {
-	pid_t	pid;
 	sprintf(preedit_filename, "%s/%s%06d",
 					TMPDIR, "xfig-preedit", getpid());
-	pid = waitpid(-1, NULL, WNOHANG);
-	if (0 < preedit_pid && pid == preedit_pid)
+	/* only reap xfig-preedit, other children are waited for elsewhere */
+	if (0 < preedit_pid &&
+			waitpid(preedit_pid, NULL, WNOHANG) == preedit_pid)
 		preedit_pid = -1;
 	return (0 < preedit_pid && access(preedit_filename, R_OK) == 0);
 }
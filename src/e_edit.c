@@ -342,6 +342,9 @@ static int	min_compound_depth;
 static Boolean	changed, reread_file;
 static Boolean  file_changed=False;
 static Boolean	actions_added=False;
+/* counts the edit popups closed, see grab_done() */
+static int	edit_generation = 0;
+static int	grab_generation;
 
 static void	edit_cancel(Widget w, XButtonEvent *ev, String *params,
 							Cardinal *num_params);
@@ -1754,6 +1757,8 @@ make_window_line(F_line *l)
 									False);
 		break;
 	case T_PICTURE:
+		/* the panel shows the size of the image */
+		read_deferred_picobj(new_l->pic);
 		/* so colors of old won't be included in new */
 		old_l->type = T_BOX;
 		generic_window("POLYLINE", "Picture Object", &picobj_ic,
@@ -5113,6 +5118,7 @@ Quit(void)
 	/* turn off the point positioning indicator now */
 	update_indpanel(0);
 	popup_up = False;
+	++edit_generation;
 	XtDestroyWidget(popup);
 	fill_style_exists = False;
 	if (pen_color_popup) {
@@ -5800,6 +5806,19 @@ push_apply_button(void)
 }
 
 
+/*
+ * Called when the screenshot is written. Put the file into the picture
+ * panel, unless the popup that asked for the screenshot was closed.
+ */
+static void
+grab_done(char *file, Boolean written)
+{
+	if (written && popup_up && grab_generation == edit_generation) {
+		panel_set_value(pic_name_panel, file);
+		push_apply_button();
+	}
+}
+
 static void
 grab_button(Widget panel_local, XtPointer closure, XtPointer call_data)
 {
@@ -5831,12 +5850,10 @@ grab_button(Widget panel_local, XtPointer closure, XtPointer call_data)
 
 	sprintf(tmpfile,"%s_%ld.png",tmpname,tim);
 
-	/* capture the screen area into our tmpfile */
-
-	if (captureImage(popup, tmpfile) == True) {
-		panel_set_value(pic_name_panel, tmpfile);
-		push_apply_button();
-	}
+	/* capture the screen area into our tmpfile, written in the
+	   background; grab_done() puts it into the panel */
+	grab_generation = edit_generation;
+	(void)captureImage(popup, tmpfile, grab_done);
 }
 
 /*
@@ -5901,7 +5918,7 @@ image_edit_button(Widget panel_local, XtPointer closure, XtPointer call_data)
 		   the name has changed  */
 		stat(s, &new_stat );
 		if (original_stat.st_mtime != new_stat.st_mtime ) {
-			new_l->pic->pic_cache->bitmap = NULL;
+			free_bitmap(new_l->pic->pic_cache);
 			push_apply_button();
 		}
 
@@ -19,6 +19,8 @@
 #include "f_load.h"
 
 #include <errno.h>
+#include <limits.h>
+#include <locale.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,10 +33,12 @@
 
 #include "e_compound.h"
 #include "f_read.h"
+#include "f_save.h"
 #include "f_util.h"
 #include "u_bound.h"
 #include "u_create.h"
 #include "u_draw.h"
+#include "u_free.h"
 #include "u_list.h"
 #include "u_redraw.h"
 #include "u_undo.h"
@@ -48,11 +52,13 @@
 #include "w_rulers.h"
 #include "w_setup.h"
 #include "w_util.h"
+#include "xfig_math.h"
 
 /* LOCAL declarations */
 
 static void	read_fail_message(char *file, int err);
 static void	update_settings (fig_settings *settings);
+static int	reload_list(int type, void **old, void **new);
 
 
 /* load Fig file.
@@ -146,6 +152,394 @@ load_file(char *file, int xoff, int yoff)
     return 1;
 }
 
+/*
+ * The object types of the top-level lists, for reload_file().
+ * The lists are accessed through their first member, the next pointer is
+ * accessed through obj_next().
+ */
+enum { R_ARC, R_COMPOUND, R_ELLIPSE, R_LINE, R_SPLINE, R_TEXT, R_NTYPES };
+
+/* an object of the old figure, and its representation in a fig file */
+struct old_obj {
+	unsigned	hash;
+	Boolean		used;
+	size_t		len;
+	char		*text;
+	void		*obj;
+};
+
+/* the bounding box of the objects that changed, in Fig units */
+static int	rxmin, rymin, rxmax, rymax;
+static Boolean	rnew_pics;
+
+static void **
+obj_next(int type, void *o)
+{
+	switch (type) {
+	case R_ARC:
+		return (void **)&((F_arc *)o)->next;
+	case R_COMPOUND:
+		return (void **)&((F_compound *)o)->next;
+	case R_ELLIPSE:
+		return (void **)&((F_ellipse *)o)->next;
+	case R_LINE:
+		return (void **)&((F_line *)o)->next;
+	case R_SPLINE:
+		return (void **)&((F_spline *)o)->next;
+	default: /* R_TEXT */
+		return (void **)&((F_text *)o)->next;
+	}
+}
+
+/* return the object o as written into a fig file */
+static char *
+obj_text(int type, void *o, size_t *len)
+{
+	char	*buf = NULL;
+	FILE	*fp;
+
+	if (!(fp = open_memstream(&buf, len)))
+		return NULL;
+	switch (type) {
+	case R_ARC:
+		write_arc(fp, o);
+		break;
+	case R_COMPOUND:
+		write_compound(fp, o);
+		break;
+	case R_ELLIPSE:
+		write_ellipse(fp, o);
+		break;
+	case R_LINE:
+		write_line(fp, o);
+		break;
+	case R_SPLINE:
+		write_spline(fp, o);
+		break;
+	case R_TEXT:
+		write_text(fp, o);
+		break;
+	}
+	if (fclose(fp)) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+/* add the bounding box of o to the changed region, and free o */
+static void
+obj_drop(int type, void *o, Boolean free_obj)
+{
+	int	xmin, ymin, xmax, ymax;
+
+	*obj_next(type, o) = NULL;
+	switch (type) {
+	case R_ARC:
+		arc_bound(o, &xmin, &ymin, &xmax, &ymax);
+		if (free_obj)
+			free_arc((F_arc **)&o);
+		break;
+	case R_COMPOUND:
+		compound_bound(o, &xmin, &ymin, &xmax, &ymax);
+		if (free_obj)
+			free_compound((F_compound **)&o);
+		break;
+	case R_ELLIPSE:
+		ellipse_bound(o, &xmin, &ymin, &xmax, &ymax);
+		if (free_obj)
+			free_ellipse((F_ellipse **)&o);
+		break;
+	case R_LINE:
+		line_bound(o, &xmin, &ymin, &xmax, &ymax);
+		if (free_obj)
+			free_line((F_line **)&o);
+		break;
+	case R_SPLINE:
+		spline_bound(o, &xmin, &ymin, &xmax, &ymax);
+		if (free_obj)
+			free_spline((F_spline **)&o);
+		break;
+	default: /* R_TEXT */
+		text_bound(o, &xmin, &ymin, &xmax, &ymax);
+		if (free_obj)
+			free_text((F_text **)&o);
+		break;
+	}
+	rxmin = min2(rxmin, xmin);
+	rymin = min2(rymin, ymin);
+	rxmax = max2(rxmax, xmax);
+	rymax = max2(rymax, ymax);
+}
+
+static unsigned
+text_hash(const char *s, size_t len)
+{
+	unsigned	h = 2166136261u;	/* FNV-1a */
+
+	while (len-- > 0)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+static int
+old_obj_cmp(const void *a, const void *b)
+{
+	unsigned	p = ((const struct old_obj *)a)->hash;
+	unsigned	q = ((const struct old_obj *)b)->hash;
+
+	return p < q ? -1 : p > q;
+}
+
+/*
+ * Merge the list *new, read from the file, into the list *old of the current
+ * figure: Each object in *new that is identical to an object in *old is
+ * replaced by the object in *old, which keeps its pixmaps and fonts. The
+ * objects in *old that are not used any more are freed. On return, *old is the
+ * merged list and *new is NULL. Return the number of changed objects, or -1 on
+ * error, in which case the lists are left alone.
+ */
+static int
+reload_list(int type, void **old, void **new)
+{
+	int		changed = 0;
+	size_t		i, n = 0;
+	size_t		len;
+	char		*text;
+	void		*o, *next;
+	void		**tail;
+	struct old_obj	key, *found, *table;
+
+	for (o = *old; o; o = *obj_next(type, o))
+		++n;
+	if (n > 0 && !(table = malloc(n * sizeof *table)))
+		return -1;
+	if (n == 0)
+		table = NULL;
+	for (i = 0, o = *old; o; o = *obj_next(type, o), ++i) {
+		if (!(table[i].text = obj_text(type, o, &table[i].len))) {
+			while (i-- > 0)
+				free(table[i].text);
+			free(table);
+			return -1;
+		}
+		table[i].hash = text_hash(table[i].text, table[i].len);
+		table[i].used = False;
+		table[i].obj = o;
+	}
+	if (n > 1)
+		qsort(table, n, sizeof *table, old_obj_cmp);
+
+	tail = old;
+	for (o = *new; o; o = next) {
+		next = *obj_next(type, o);
+		found = NULL;
+		if (n > 0 && (text = obj_text(type, o, &len))) {
+			key.hash = text_hash(text, len);
+			found = bsearch(&key, table, n, sizeof *table,
+					old_obj_cmp);
+			/* go to the first entry with this hash */
+			while (found && found > table &&
+					found[-1].hash == key.hash)
+				--found;
+			for (; found && found < table + n &&
+					found->hash == key.hash; ++found)
+				if (!found->used && found->len == len &&
+						!memcmp(found->text, text, len))
+					break;
+			if (found && (found == table + n ||
+						found->hash != key.hash))
+				found = NULL;
+			free(text);
+		}
+		if (found) {
+			/* keep the old object, drop the new one */
+			found->used = True;
+			*obj_next(type, o) = NULL;
+			switch (type) {
+			case R_ARC:
+				free_arc((F_arc **)&o);
+				break;
+			case R_COMPOUND:
+				free_compound((F_compound **)&o);
+				break;
+			case R_ELLIPSE:
+				free_ellipse((F_ellipse **)&o);
+				break;
+			case R_LINE:
+				free_line((F_line **)&o);
+				break;
+			case R_SPLINE:
+				free_spline((F_spline **)&o);
+				break;
+			case R_TEXT:
+				free_text((F_text **)&o);
+				break;
+			}
+			o = found->obj;
+		} else {
+			++changed;
+			obj_drop(type, o, False);
+			if (type == R_COMPOUND || (type == R_LINE &&
+					((F_line *)o)->type == T_PICTURE))
+				rnew_pics = True;
+		}
+		*tail = o;
+		tail = obj_next(type, o);
+	}
+	*tail = NULL;
+	*new = NULL;
+
+	for (i = 0; i < n; ++i) {
+		if (!table[i].used) {
+			++changed;
+			obj_drop(type, table[i].obj, True);
+		}
+		free(table[i].text);
+	}
+	free(table);
+	return changed;
+}
+
+/*
+ * Re-read file, the file of the current figure, for the autorefresh mode.
+ * Objects that did not change are kept, together with their picture pixmaps
+ * and fonts, and only the region of the changed objects is redrawn. If the
+ * header of the file changed, e.g., the units or the color definitions, the
+ * whole canvas is redrawn. Return 0 on success.
+ */
+int
+reload_file(char *file)
+{
+	int		s;
+	int		t;
+	int		changed = 0;
+	char		*old_header, *new_header;
+	size_t		old_len, new_len;
+	FILE		*fp;
+	F_compound	c;
+	fig_settings	settings;
+	void		**old_lists[R_NTYPES] = {
+				(void **)&objects.arcs,
+				(void **)&objects.compounds,
+				(void **)&objects.ellipses,
+				(void **)&objects.lines,
+				(void **)&objects.splines,
+				(void **)&objects.texts };
+	void		**new_lists[R_NTYPES] = {
+				(void **)&c.arcs, (void **)&c.compounds,
+				(void **)&c.ellipses, (void **)&c.lines,
+				(void **)&c.splines, (void **)&c.texts };
+
+	/* the top-level lists are not accessible while editing a compound */
+	if (objects.parent != NULL)
+		return load_file(file, 0, 0);
+
+	c.parent = NULL;
+	c.GABPtr = NULL;
+	c.arcs = NULL;
+	c.compounds = NULL;
+	c.ellipses = NULL;
+	c.lines = NULL;
+	c.splines = NULL;
+	c.texts = NULL;
+	c.comments = NULL;
+	c.next = NULL;
+
+	setlocale(LC_NUMERIC, "C");
+	old_header = NULL;
+	if ((fp = open_memstream(&old_header, &old_len))) {
+		write_fig_header(fp);
+		if (fclose(fp)) {
+			free(old_header);
+			old_header = NULL;
+		}
+	}
+	setlocale(LC_NUMERIC, "");
+
+	pic_obj_read = False;
+	s = read_figc(file, &c, DONT_MERGE, DONT_REMAP_IMAGES, 0, 0, &settings);
+	if (s != 0) {
+		free(old_header);
+		/* a file that is re-created might briefly be missing or empty */
+		if (s != ENOENT && s != EMPTY_FILE)
+			read_fail_message(file, s);
+		return s;
+	}
+
+	clean_up();
+	set_temp_cursor(wait_cursor);
+	rxmin = rymin = INT_MAX;
+	rxmax = rymax = INT_MIN;
+	rnew_pics = False;
+	setlocale(LC_NUMERIC, "C");
+	for (t = 0; t < R_NTYPES && changed >= 0; ++t) {
+		if ((s = reload_list(t, old_lists[t], new_lists[t])) < 0)
+			changed = -1;
+		else
+			changed += s;
+	}
+	setlocale(LC_NUMERIC, "");
+	if (changed < 0) {
+		/* out of memory, take the slow road */
+		free_arc(&c.arcs);
+		free_compound(&c.compounds);
+		free_ellipse(&c.ellipses);
+		free_line(&c.lines);
+		free_spline(&c.splines);
+		free_text(&c.texts);
+		free(c.comments);
+		free(old_header);
+		reset_cursor();
+		return load_file(file, 0, 0);
+	}
+
+	free(objects.comments);
+	objects.comments = c.comments;
+
+	/* recount the objects at each depth */
+	reset_depths();
+	clearallcounts();
+	defer_update_layers = 1;
+	add_compound_depth(&objects);
+	defer_update_layers = 0;
+	update_layers();
+
+	update_settings(&settings);
+	if (rnew_pics && pic_obj_read) {
+		remap_imagecolors();
+		redraw_images(&objects);
+	}
+
+	new_header = NULL;
+	setlocale(LC_NUMERIC, "C");
+	if ((fp = open_memstream(&new_header, &new_len))) {
+		write_fig_header(fp);
+		if (fclose(fp)) {
+			free(new_header);
+			new_header = NULL;
+		}
+	}
+	setlocale(LC_NUMERIC, "");
+
+	if (!old_header || !new_header || old_len != new_len ||
+			memcmp(old_header, new_header, new_len))
+		redisplay_canvas();
+	else if (changed > 0)
+		redisplay_zoomed_region(rxmin, rymin, rxmax, rymax);
+	free(old_header);
+	free(new_header);
+
+	if (changed > 0)
+		put_msg("Current figure \"%s\" (%d objects, %d changed)",
+				file, num_object, changed);
+	/* the objects of the previous figure are gone */
+	set_action(F_NULL);
+	reset_cursor();
+	reset_modifiedflag();
+	return 0;
+}
+
 static void
 update_settings(fig_settings *settings)
 {
@@ -44,6 +44,7 @@ static	int  contest(register int b, register int g, register int r);
 static	void alterneigh(int rad, int i, register int b, register int g, register int r);
 static	void altersingle(register int alpha, register int i, register int b, register int g, register int r);
 static	int  inxsearch(register int b, register int g, register int r);
+static	int  inxlookup(int b, int g, int r);
 
 #define MAXNETSIZE	256
 
@@ -62,6 +63,18 @@ static int	netsize;
 
 int	samplefac = DEFSMPFAC;	/* sampling factor */
 
+		/* The results of inxsearch() are cached in a table indexed by
+		 * the upper 6 bits of each color component. An entry is
+		 * computed for the center of its cell, when first needed.
+		 */
+#define INXBITS		6
+#define INXSHIFT	(8-INXBITS)
+#define INXKEY(b,g,r)	(((r)>>INXSHIFT)<<(2*INXBITS) | \
+			 ((g)>>INXSHIFT)<<INXBITS | (b)>>INXSHIFT)
+#define INXCENTER(c)	((c)>>INXSHIFT<<INXSHIFT | 1<<(INXSHIFT-1))
+
+static short	inxcache[1<<(3*INXBITS)];	/* -1, if not yet known */
+
 		/* Samples array starts off holding spacing between adjacent
 		 * samples, and ends up holding actual BGR sample values.
 		 */
@@ -183,14 +196,14 @@ neu_clrtab(int ncolors)		/* make new color table using ncolors */
 int
 neu_map_pixel(register BYTE *col)		/* get pixel for color */
 {
-	return(inxsearch(col[N_BLU],col[N_GRN],col[N_RED]));
+	return(inxlookup(col[N_BLU],col[N_GRN],col[N_RED]));
 }
 
 
 void neu_map_colrs(register BYTE *bs, register COLR (*cs), register int n)	/* convert a scanline to color index values */
 {
 	while (n-- > 0) {
-		*bs++ = inxsearch(cs[0][N_BLU],cs[0][N_GRN],cs[0][N_RED]);
+		*bs++ = inxlookup(cs[0][N_BLU],cs[0][N_GRN],cs[0][N_RED]);
 		cs++;
 	}
 }
@@ -359,6 +372,18 @@ inxbuild(void)
 	}
 	netindex[previouscol] = (startpos+maxnetpos)>>1;
 	for (j=previouscol+1; j<256; j++) netindex[j] = maxnetpos; /* really 256 */
+				/* forget the results for the previous network */
+	memset(inxcache, 0xff, sizeof inxcache);
+}
+
+static int
+inxlookup(int b, int g, int r)	/* inxsearch(), but cached */
+{
+	short	*c = inxcache + INXKEY(b,g,r);
+
+	if (*c < 0)
+		*c = inxsearch(INXCENTER(b),INXCENTER(g),INXCENTER(r));
+	return(*c);
 }
 
 static int
@@ -25,6 +25,9 @@
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
+#if defined(HAVE_MEMFD_CREATE) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		/* memfd_create() */
+#endif
 #include "f_picobj.h"
 
 #include <errno.h>
@@ -33,8 +36,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>		/* time_t */
+#include <sys/wait.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BZLIB
+#include <bzlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
 #include <X11/Intrinsic.h>     /* includes X11/Xlib.h, which includes X11/X.h */
 
 #include "resources.h"		/* TMPDIR */
@@ -42,12 +57,20 @@
 #include "mode.h"
 #include "f_readpcx.h"		/* read_pcx() */
 #include "f_util.h"		/* file_timestamp() */
+#include "u_cache.h"
 #include "u_create.h"		/* create_picture_entry() */
+#include "u_free.h"		/* free_picture_entry() */
+#include "u_bound.h"		/* line_bound(), overlapping() */
+#include "u_print.h"		/* close_export_pipes() */
+#include "u_redraw.h"		/* redisplay_zoomed_region() */
 #include "u_spawn.h"
 #include "w_file.h"		/* check_cancel() */
+#include "w_layers.h"		/* active_layer() */
 #include "w_msgpanel.h"
-#include "w_setup.h"		/* PIX_PER_INCH, PIX_PER_CM */
+#include "w_setup.h"		/* PIX_PER_INCH, CANVAS_WD */
 #include "w_util.h"		/* app_flush() */
+#include "w_zoom.h"		/* zoomscale, zoomxoff, zoomyoff */
+#include "xfig_math.h"		/* min2(), max2() */
 
 extern	int	read_gif(F_pic *pic, struct xfig_stream *restrict pic_stream);
 extern	int	read_eps(F_pic *pic, struct xfig_stream *restrict pic_stream);
@@ -104,6 +127,7 @@ init_stream(struct xfig_stream *restrict xf_stream)
 	xf_stream->name = xf_stream->name_buf;
 	xf_stream->name_on_disk = xf_stream->name_on_disk_buf;
 	xf_stream->uncompress = NULL;
+	xf_stream->piped = False;
 	xf_stream->content = xf_stream->content_buf;
 	*xf_stream->content = '\0';
 }
@@ -287,8 +311,8 @@ get_picture_status(F_pic *pic, struct _pics *pics, bool force,
 		fprintf(stderr, "Found stored picture %s, count=%d\n", file,
 				pics->refcount);
 
-	/* there is a cached bitmap */
-	if (pics->bitmap != NULL) {
+	/* there is a cached bitmap, or the file is read when drawn */
+	if (pics->bitmap != NULL || pics->deferred) {
 		*existing = true;
 		*reread = false;
 		put_msg("Reading Picture object file...found cached picture");
@@ -301,27 +325,365 @@ get_picture_status(F_pic *pic, struct _pics *pics, bool force,
 	return 0;
 }
 
+
 /*
- * Check through the pictures repository to see if "file" is already there.
- * If so, set the pic->pic_cache pointer to that repository entry and set
- * "existing" to True.
- * If not, read the file via the relevant reader and add to the repository
- * and set "existing" to False.
- * If "force" is true, read the file unconditionally.
- * The string "file" must have been allocated by the caller and not be freed
- * after a call to read_picobj().
+ * The disk cache of decoded pictures.
+ * An entry consists of the header below, followed by the bitmap at offset
+ * PIC_CACHE_OFFSET. On a hit, the entry is mapped into memory, and the bitmap
+ * of the picture points into the mapping. The key is derived from the file
+ * on disk, its size and modification time, and from the properties of the
+ * visual that determine the format of the bitmap.
+ * Eps and pdf files are not kept here, the bitmaps rendered by ghostscript
+ * are cached in u_ghostscript.c.
+ */
+#define	PIC_CACHE		"pictures"
+#define	PIC_CACHE_MAGIC		"XFIGPIC1"
+
+struct pic_cache_head {
+	char		magic[8];
+	int		subtype;
+	int		numcols;
+	int		transp;
+	int		bit_x, bit_y;
+	int		size_x, size_y;
+	int		reduction;
+	float		hw_ratio;
+	size_t		len;
+	struct Cmap	cmap[MAX_COLORMAP_SIZE];
+};
+
+/* the offset of the bitmap, suitably aligned for access by 32-bit words */
+#define	PIC_CACHE_OFFSET \
+		((sizeof(struct pic_cache_head) + 15) & ~(size_t)15)
+
+/*
+ * Return the length of the bitmap of the picture pics.
+ */
+static size_t
+bitmap_len(struct _pics *pics)
+{
+	size_t	w = (size_t)pics->bit_size.x;
+	size_t	h = (size_t)pics->bit_size.y;
+
+	if (pics->numcols == 0)		/* monochrome, one bit per pixel */
+		return (w + 7) / 8 * h;
+	else if (pics->numcols < 0)	/* TrueColor, no colormap */
+		return w * h * image_bpp;
+	else
+		return w * h;
+}
+
+/*
+ * The entries of the pictures repository are also kept in two hash tables,
+ * indexed by the name of the file, and by its content. An entry of a file
+ * with the same content as the file of another entry, e.g., a copy or a link,
+ * shares the bitmap of that entry and holds a reference to it.
+ */
+#define	PIC_TABLE_SIZE	256		/* a power of two */
+#define	PIC_INDEX(h)	((size_t)((h) & (PIC_TABLE_SIZE - 1)))
+
+static struct _pics	*name_table[PIC_TABLE_SIZE];
+static struct _pics	*content_table[PIC_TABLE_SIZE];
+
+static size_t
+name_index(const char *restrict abs_path)
+{
+	return PIC_INDEX(cache_hash(CACHE_HASH_INIT, abs_path,
+				strlen(abs_path)));
+}
+
+/*
+ * Remove pics from the content hash table.
+ */
+static void
+unhash_content(struct _pics *pics)
+{
+	struct _pics	**p;
+
+	if (!pics->content)
+		return;
+	for (p = &content_table[PIC_INDEX(pics->content)]; *p;
+			p = &(*p)->content_next) {
+		if (*p == pics) {
+			*p = pics->content_next;
+			break;
+		}
+	}
+	pics->content = 0;
+	pics->content_next = NULL;
+}
+
+/*
+ * Remove pics from the hash tables. Called by free_picture_entry().
  */
 void
-read_picobj(F_pic *pic, char *file, int color, Boolean force, Boolean *existing)
+unhash_picture(struct _pics *pics)
 {
-	FILE		*fp;
-	int		i;
-	char		*abs_path = ABSOLUTE_PATH(file);
-	char		buf[16];
-	bool		reread;
-	struct _pics	*pics, *lastpic;
-	struct xfig_stream	pic_stream;
+	struct _pics	**p;
+
+	unhash_content(pics);
+	if (pics->file == NULL)
+		return;
+	for (p = &name_table[name_index(ABSOLUTE_PATH(pics->file))]; *p;
+			p = &(*p)->name_next) {
+		if (*p == pics) {
+			*p = pics->name_next;
+			break;
+		}
+	}
+	pics->name_next = NULL;
+}
+
+/*
+ * Copy the picture information, including the pointer to the bitmap, from
+ * the entry "from" to the entry "to".
+ */
+static void
+copy_picture(struct _pics *to, const struct _pics *from)
+{
+	to->bitmap = from->bitmap;
+	to->mapped = 0;
+	to->subtype = from->subtype;
+	to->numcols = from->numcols;
+	to->cmap_mapped = from->cmap_mapped;
+	to->transp = from->transp;
+	to->size_x = from->size_x;
+	to->size_y = from->size_y;
+	to->bit_size = from->bit_size;
+	to->reduction = from->reduction;
+	memcpy(to->cmap, from->cmap, sizeof to->cmap);
+}
+
+/*
+ * Let all entries that share the bitmap of pics take the picture
+ * information from pics, e.g., after pics was read again.
+ */
+static void
+update_sharers(struct _pics *pics)
+{
+	struct _pics	*e;
+
+	if (!pics->content)
+		return;
+	for (e = content_table[PIC_INDEX(pics->content)]; e;
+			e = e->content_next)
+		if (e->same == pics)
+			copy_picture(e, pics);
+}
+
+/*
+ * Give the bitmap of pics to the entries that share it. One of them becomes
+ * the owner of the bitmap, the others now share the bitmap of the new owner.
+ * Return true, if the bitmap was given away.
+ */
+static bool
+hand_over_bitmap(struct _pics *pics)
+{
+	struct _pics	*e;
+	struct _pics	*heir = NULL;
+
+	if (!pics->content)
+		return false;
+	for (e = content_table[PIC_INDEX(pics->content)]; e;
+			e = e->content_next) {
+		if (e->same != pics)
+			continue;
+		if (heir == NULL) {
+			heir = e;
+			heir->same = NULL;
+			heir->mapped = pics->mapped;
+		} else {
+			e->same = heir;
+			++heir->refcount;
+		}
+		--pics->refcount;
+	}
+	return heir != NULL;
+}
+
+/*
+ * Free the bitmap of pics, or unmap it, if mapped from the disk cache.
+ * If the bitmap is shared, release the reference to the owner, or let one of
+ * the sharers take it over.
+ */
+void
+free_bitmap(struct _pics *pics)
+{
+	struct _pics	*owner;
+
+	if ((owner = pics->same)) {
+		pics->same = NULL;
+		free_picture_entry(owner);
+	} else if (pics->bitmap && !hand_over_bitmap(pics)) {
+		if (pics->mapped)
+			munmap(pics->bitmap - PIC_CACHE_OFFSET, pics->mapped);
+		else
+			free(pics->bitmap);
+	}
+	pics->bitmap = NULL;
+	pics->mapped = 0;
+	pics->cmap_mapped = 0;
+}
+
+/*
+ * Compute the key of the picture file name in the disk cache, and return its
+ * modification time in *mtime. Return 0 on success, -1 on failure.
+ */
+static int
+picture_key(const char *restrict name, uint64_t *key, time_t *mtime)
+{
+	int		par[5];
+	char		found_buf[256];
+	char		*found = found_buf;
+	char		**uncompress;
+	uint64_t	h;
+	struct stat	st;
+
+	if (appres.picture_cache_size <= 0 ||
+			file_on_disk(name, &found, sizeof found_buf,
+				&uncompress))
+		return -1;
+	if (stat(found, &st)) {
+		if (found != found_buf)
+			free(found);
+		return -1;
+	}
+	h = cache_hash(CACHE_HASH_INIT, found, strlen(found));
+	if (found != found_buf)
+		free(found);
+
+	h = cache_hash(h, &st.st_dev, sizeof st.st_dev);
+	h = cache_hash(h, &st.st_ino, sizeof st.st_ino);
+	h = cache_hash(h, &st.st_size, sizeof st.st_size);
+	h = cache_hash(h, &st.st_mtime, sizeof st.st_mtime);
+	par[0] = tool_cells <= 2 || appres.monochrome;
+	par[1] = tool_vclass;
+	par[2] = image_bpp;
+	par[3] = appres.INCHES;
+	par[4] = (int)PIC_CACHE_OFFSET;
+	*key = cache_hash(h, par, sizeof par);
+	*mtime = st.st_mtime;
+	return 0;
+}
+
+/*
+ * Return a key that identifies the content of the file name, or 0 if the
+ * file is not found, and store its modification time in *mtime. A file is
+ * identified by its device and inode number, size and modification time, or,
+ * with the resource deduppictures, by its content.
+ */
+static uint64_t
+content_key(const char *restrict name, time_t *mtime)
+{
+	char		found_buf[256];
+	char		*found = found_buf;
+	char		**uncompress;
+	uint64_t	h = 0;
+	struct stat	st;
+
+	if (file_on_disk(name, &found, sizeof found_buf, &uncompress)) {
+		if (found != found_buf)
+			free(found);
+		return 0;
+	}
+	if (!stat(found, &st)) {
+		*mtime = st.st_mtime;
+		if (!appres.dedup_pictures || cache_hash_file(found, &h)) {
+			h = cache_hash(CACHE_HASH_INIT, &st.st_dev,
+					sizeof st.st_dev);
+			h = cache_hash(h, &st.st_ino, sizeof st.st_ino);
+			h = cache_hash(h, &st.st_size, sizeof st.st_size);
+			h = cache_hash(h, &st.st_mtime, sizeof st.st_mtime);
+		}
+	}
+	if (found != found_buf)
+		free(found);
+	return h;
+}
+
+/*
+ * Map the picture key from the disk cache into pic.
+ * Return true on success, false if the picture is not in the cache.
+ */
+static bool
+load_cached_picture(F_pic *pic, uint64_t key)
+{
+	size_t			len;
+	unsigned char		*map;
+	struct pic_cache_head	*head;
+	struct _pics		*pics = pic->pic_cache;
+
+	if (!(map = cache_map(PIC_CACHE, key, &len)))
+		return false;
+	head = (struct pic_cache_head *)map;
+	if (len < PIC_CACHE_OFFSET ||
+			memcmp(head->magic, PIC_CACHE_MAGIC, sizeof head->magic)
+			|| head->len != len - PIC_CACHE_OFFSET ||
+			head->bit_x <= 0 || head->bit_y <= 0 ||
+			head->reduction < 1 ||
+			head->numcols > MAX_COLORMAP_SIZE) {
+		munmap(map, len);
+		return false;
+	}
+
+	pics->subtype = head->subtype;
+	pics->numcols = head->numcols;
+	pics->bit_size.x = head->bit_x;
+	pics->bit_size.y = head->bit_y;
+	if (head->len != bitmap_len(pics)) {
+		munmap(map, len);
+		return false;
+	}
+	pics->transp = head->transp;
+	pics->size_x = head->size_x;
+	pics->size_y = head->size_y;
+	pics->reduction = head->reduction;
+	memcpy(pics->cmap, head->cmap, sizeof pics->cmap);
+	pics->bitmap = map + PIC_CACHE_OFFSET;
+	pics->mapped = len;
+	pic->hw_ratio = head->hw_ratio;
+	pic->pixmap = None;
+	return true;
+}
+
+static void
+store_cached_picture(F_pic *pic, uint64_t key)
+{
+	struct _pics	*pics = pic->pic_cache;
+	union {
+		struct pic_cache_head	head;
+		char			buf[PIC_CACHE_OFFSET];
+	} u;
+
+	if (pics->bitmap == NULL || pics->bit_size.x <= 0 ||
+			pics->bit_size.y <= 0 || pics->subtype == T_PIC_EPS ||
+			pics->subtype == T_PIC_PDF)
+		return;
+
+	/* zero the padding, too */
+	memset(&u, 0, sizeof u);
+	memcpy(u.head.magic, PIC_CACHE_MAGIC, sizeof u.head.magic);
+	u.head.subtype = pics->subtype;
+	u.head.numcols = pics->numcols;
+	u.head.transp = pics->transp;
+	u.head.bit_x = pics->bit_size.x;
+	u.head.bit_y = pics->bit_size.y;
+	u.head.size_x = pics->size_x;
+	u.head.size_y = pics->size_y;
+	u.head.reduction = pics->reduction;
+	u.head.hw_ratio = pic->hw_ratio;
+	u.head.len = bitmap_len(pics);
+	memcpy(u.head.cmap, pics->cmap, sizeof u.head.cmap);
+	(void)cache_write(PIC_CACHE, key, &u, sizeof u, pics->bitmap,
+			u.head.len);
+}
 
+/*
+ * Initialize the members of pic that depend on the picture file.
+ */
+static void
+init_picobj(F_pic *pic, int color)
+{
 	pic->color = color;
 	/* don't touch the flipped flag - caller has already set it */
 	pic->pixmap = (Pixmap)0;
@@ -329,47 +691,50 @@ read_picobj(F_pic *pic, char *file, int color, Boolean force, Boolean *existing)
 	pic->pix_rotation = 0;
 	pic->pix_width = 0;
 	pic->pix_height = 0;
+	pic->pix_w = 0;
+	pic->pix_h = 0;
 	pic->pix_flipped = 0;
+}
 
-	/* check if user pressed cancel button */
-	if (check_cancel())
-		return;
+/*
+ * Look for "file" in the pictures repository, or add a new entry for it, and
+ * put the entry into pic. If the file must be read, set "reread" to true.
+ * If the entry already holds the picture, set "existing" to true.
+ * Return the entry, or NULL if the file is not found.
+ */
+static struct _pics *
+attach_picture(F_pic *pic, char *file, bool force, bool *reread,
+		bool *existing)
+{
+	char		*abs_path = ABSOLUTE_PATH(file);
+	size_t		i = name_index(abs_path);
+	struct _pics	*pics;
 
-	put_msg("Reading Picture object file...");
-	app_flush();
+	*reread = true;
+	*existing = false;
 
 	/* look in the repository for this filename */
-	lastpic = pictures;
-	for (pics = pictures; pics; pics = pics->next) {
+	for (pics = name_table[i]; pics; pics = pics->name_next) {
 		if (!strcmp(ABSOLUTE_PATH(pics->file), abs_path)) {
 			/* check, whether picture exists, or must be re-read */
-			if (get_picture_status(pic, pics, force, &reread,
-						(bool *)existing) ==FileInvalid)
-				return;
-			if (!reread && *existing) {
-				/* must set the h/w ratio here */
-				pic->hw_ratio =(float)pic->pic_cache->bit_size.y
-					/ pic->pic_cache->bit_size.x;
-				free(file);
-				return;
-			}
+			if (get_picture_status(pic, pics, force, reread,
+						existing) == FileInvalid)
+				return NULL;
+			if (!*reread)
+				return pics;
 			break;
 		}
-		/* keep pointer to last entry */
-		lastpic = pics;
 	}
 
 	if (pics == NULL) {
 		/* didn't find it in the repository, add it */
 		pics = create_picture_entry();
-		if (lastpic) {
-			/* add to list */
-			lastpic->next = pics;
-			pics->prev = lastpic;
-		} else {
-			/* first one */
-			pictures = pics;
-		}
+		pics->next = pictures;
+		if (pictures)
+			pictures->prev = pics;
+		pictures = pics;
+		pics->name_next = name_table[i];
+		name_table[i] = pics;
 		pics->file = file;
 		pics->refcount = 1;
 		pics->bitmap = NULL;
@@ -385,20 +750,21 @@ read_picobj(F_pic *pic, char *file, int color, Boolean force, Boolean *existing)
 	/* put it in the pic */
 	pic->pic_cache = pics;
 	pic->pixmap = (Pixmap)0;
+	/* a stale bitmap, if the picture is re-read */
+	free_bitmap(pics);
+	pics->deferred = 0;
+	return pics;
+}
 
-	if (appres.DEBUG)
-		fprintf(stderr, "Reading file %s\n", file);
-
-	init_stream(&pic_stream);
-
-	/* open the file and read a few bytes of the header to see what it is */
-	if ((fp = open_stream(abs_path, &pic_stream)) == NULL) {
-		file_msg("Could not open picture file %s", abs_path);
-		free_stream(&pic_stream);
-		return;
-	}
-	/* get the modified time and save it */
-	pics->time_stamp = file_timestamp(pic_stream.name_on_disk);
+/*
+ * Read the first bytes of the stream fp and return the index of the matching
+ * entry in headers[], or -1 if the format is not known.
+ */
+static int
+picture_format(FILE *fp)
+{
+	int	i;
+	char	buf[16];
 
 	/* read some bytes from the file */
 	for (i = 0; i < (int)sizeof buf; ++i) {
@@ -411,10 +777,73 @@ read_picobj(F_pic *pic, char *file, int color, Boolean force, Boolean *existing)
 	/* now find which header it is */
 	for (i = 0; i < (int)(sizeof headers / sizeof(headers[0])); ++i)
 		if (!memcmp(buf, headers[i].bytes, strlen(headers[i].bytes)))
-			break;
+			return i;
+	return -1;
+}
+
+/*
+ * Read the file of the picture entry pic->pic_cache, or take the picture
+ * from the disk cache.
+ */
+static void
+read_picture(F_pic *pic)
+{
+	FILE		*fp;
+	int		i;
+	char		*abs_path = ABSOLUTE_PATH(pic->pic_cache->file);
+	bool		use_cache;
+	uint64_t	key;
+	struct _pics	*pics = pic->pic_cache;
+	struct _pics	*owner, **chain;
+	struct xfig_stream	pic_stream;
+
+	pics->deferred = 0;
+
+	/* share the bitmap of a file with the same content */
+	unhash_content(pics);
+	if ((pics->content = content_key(abs_path, &pics->time_stamp))) {
+		chain = &content_table[PIC_INDEX(pics->content)];
+		for (owner = *chain; owner; owner = owner->content_next)
+			if (owner->content == pics->content && owner->bitmap)
+				break;
+		pics->content_next = *chain;
+		*chain = pics;
+		if (owner) {
+			if (owner->same)
+				owner = owner->same;
+			pics->same = owner;
+			++owner->refcount;
+			copy_picture(pics, owner);
+			pic->hw_ratio = (float)pics->bit_size.y /
+							pics->bit_size.x;
+			put_msg("Reading Picture object file...Done");
+			return;
+		}
+	}
+
+	/* look in the disk cache */
+	use_cache = !picture_key(abs_path, &key, &pics->time_stamp);
+	if (use_cache && load_cached_picture(pic, key)) {
+		put_msg("Reading Picture object file...Done");
+		return;
+	}
+
+	if (appres.DEBUG)
+		fprintf(stderr, "Reading file %s\n", pics->file);
+
+	init_stream(&pic_stream);
+
+	/* open the file and read a few bytes of the header to see what it is */
+	if ((fp = open_stream(abs_path, &pic_stream)) == NULL) {
+		file_msg("Could not open picture file %s", abs_path);
+		free_stream(&pic_stream);
+		return;
+	}
+	/* get the modified time and save it */
+	pics->time_stamp = file_timestamp(pic_stream.name_on_disk);
 
-	/* not found */
-	if (i == (int)(sizeof headers / sizeof(headers[0]))) {
+	/* find the format of the file */
+	if ((i = picture_format(fp)) == -1) {
 		file_msg("%s: Unknown image format", abs_path);
 		put_msg("Reading Picture object file...Failed");
 		app_flush();
@@ -425,70 +854,941 @@ read_picobj(F_pic *pic, char *file, int color, Boolean force, Boolean *existing)
 
 	/* readfunc() expect an open file stream, positioned not at the
 	   start of the stream. The stream remains open after returning. */
+	pics->reduction = 1;
 	if (headers[i].readfunc(pic, &pic_stream) != PicSuccess) {
 		file_msg("Errors occurred when reading %s file %s",
 						headers[i].type, abs_path);
 	} else {
 		put_msg("Reading Picture object file...Done");
+		if (use_cache)
+			store_cached_picture(pic, key);
 	}
 
 	close_stream(&pic_stream);
 	free_stream(&pic_stream);
-
-	if (pics->refcount > 1)
-		free(file);
 }
 
 /*
- * Return a file stream, either to a pipe or to a regular file.
- * If xf_stream->uncompress == NULL it is a regular file, otherwise a pipe.
+ * Check through the pictures repository to see if "file" is already there.
+ * If so, set the pic->pic_cache pointer to that repository entry and set
+ * "existing" to True.
+ * If not, read the file via the relevant reader and add to the repository
+ * and set "existing" to False.
+ * If "force" is true, read the file unconditionally.
+ * The string "file" must have been allocated by the caller and not be freed
+ * after a call to read_picobj().
  */
-FILE *
-open_stream(char *restrict name, struct xfig_stream *restrict xf_stream)
+void
+read_picobj(F_pic *pic, char *file, int color, Boolean force, Boolean *existing)
 {
-	size_t	len;
-
-	if (xf_stream->name != name) {
-		/* strcpy (xf_stream->name, name) */
-		len = strlen(name);
-		if (len >= sizeof xf_stream->name_buf) {
-			if (!(xf_stream->name = new_string(len)))
-				return NULL;
-		}
-		memcpy(xf_stream->name, name, len + 1);
-	}
-
-	if (file_on_disk(name, &xf_stream->name_on_disk,
-				sizeof xf_stream->name_on_disk_buf,
-				&xf_stream->uncompress)) {
-		free_stream(xf_stream);
-		return NULL;
-	}
+	bool		reread;
+	bool		exists;
+	struct _pics	*pics;
 
-	if (xf_stream->uncompress) {
-		/* a compressed file */
+	init_picobj(pic, color);
+	*existing = False;
 
-		int	fd;
-		char	*args[4];
+	/* check if user pressed cancel button */
+	if (check_cancel())
+		return;
 
-		args[0] = xf_stream->uncompress[0];
-		args[1] = xf_stream->uncompress[1];
-		args[2] = xf_stream->name_on_disk;
-		args[3] = NULL;
+	put_msg("Reading Picture object file...");
+	app_flush();
 
-		if ((fd = spawn_popen(args, "r")) == -1) {
-			xf_stream->fp = NULL;
-			return NULL;
-		}
-		if (!(xf_stream->fp = fdopen(fd, "r")))
-			file_msg("Cannot read uncompressed content of %s: %s",
-					xf_stream->name_on_disk,
-					strerror(errno));
+	if (!(pics = attach_picture(pic, file, force, &reread, &exists)))
+		return;
 
+	if (reread || pics->deferred) {
+		read_picture(pic);
 	} else {
-		/* uncompressed file */
+		*existing = True;
+		/* must set the h/w ratio here */
+		pic->hw_ratio = (float)pics->bit_size.y / pics->bit_size.x;
+	}
 
-		if (!(xf_stream->fp = fopen(xf_stream->name_on_disk, "rb")))
+	if (pics->refcount > 1)
+		free(file);
+}
+
+/*
+ * Store the size in pixels of the image in the file fp in size, if it is
+ * given in the first few bytes of the file. Otherwise, leave size alone.
+ * Png, gif and jpeg files are recognized.
+ */
+static void
+image_dimensions(FILE *fp, F_pos *size)
+{
+	int		c;
+	size_t		len;
+	unsigned char	buf[24];
+
+	len = fread(buf, 1, sizeof buf, fp);
+	if (len == sizeof buf && !memcmp(buf, "\211PNG\r\n\032\n", 8) &&
+			!memcmp(buf + 12, "IHDR", 4)) {
+		size->x = buf[16] << 24 | buf[17] << 16 | buf[18] << 8 | buf[19];
+		size->y = buf[20] << 24 | buf[21] << 16 | buf[22] << 8 | buf[23];
+	} else if (len >= 10 && !memcmp(buf, "GIF8", 4)) {
+		size->x = buf[7] << 8 | buf[6];
+		size->y = buf[9] << 8 | buf[8];
+	} else if (len >= 2 && buf[0] == 0xff && buf[1] == 0xd8) {
+		/* walk through the markers up to the start of frame */
+		if (fseek(fp, 2L, SEEK_SET))
+			return;
+		while (getc(fp) == 0xff) {
+			/* skip fill bytes */
+			while ((c = getc(fp)) == 0xff)
+				;
+			if (c == EOF || fread(buf, 1, 2, fp) != 2)
+				return;
+			len = (size_t)(buf[0] << 8 | buf[1]);
+			/* SOF0 to SOF15, except DHT, JPG and DAC */
+			if (c >= 0xc0 && c <= 0xcf && c != 0xc4 && c != 0xc8 &&
+					c != 0xcc) {
+				if (len >= 7 && fread(buf, 1, 5, fp) == 5) {
+					size->y = buf[1] << 8 | buf[2];
+					size->x = buf[3] << 8 | buf[4];
+				}
+				return;
+			}
+			if (len < 2 || fseek(fp, (long)len - 2L, SEEK_CUR))
+				return;
+		}
+	}
+}
+
+/*
+ * Put the picture "file" into pic, like read_picobj(), but do not read the
+ * file before the picture is drawn, see draw_line(). Now, only look for the
+ * size of the image in the header of the file. On a colormapped or monochrome
+ * display, the colors of all pictures are allocated together after loading a
+ * figure, hence read the file immediately.
+ */
+void
+defer_picobj(F_pic *pic, char *file, int color)
+{
+	char		found_buf[256];
+	char		*found = found_buf;
+	char		**uncompress;
+	bool		reread;
+	bool		existing;
+	FILE		*fp;
+	struct _pics	*pics;
+
+	if (tool_vclass != TrueColor || tool_cells <= 2 || appres.monochrome) {
+		Boolean	dum;
+		read_picobj(pic, file, color, False, &dum);
+		return;
+	}
+
+	init_picobj(pic, color);
+	if (!(pics = attach_picture(pic, file, false, &reread, &existing)))
+		return;
+
+	if (reread) {
+		if (file_on_disk(ABSOLUTE_PATH(file), &found, sizeof found_buf,
+					&uncompress)) {
+			/* let read_picture() report the error */
+			read_picture(pic);
+		} else {
+			pics->deferred = PIC_DEFERRED;
+			pics->time_stamp = file_timestamp(found);
+			/* a compressed file is only uncompressed when read */
+			if (uncompress == NULL && (fp = fopen(found, "rb"))) {
+				image_dimensions(fp, &pics->bit_size);
+				fclose(fp);
+			}
+		}
+		if (found != found_buf)
+			free(found);
+	}
+	if (pics->bit_size.x > 0 && pics->bit_size.y > 0)
+		pic->hw_ratio = (float)pics->bit_size.y / pics->bit_size.x;
+
+	if (pics->refcount > 1)
+		free(file);
+}
+
+/*
+ * Read the file of pic, if it was deferred by defer_picobj(), or take the
+ * picture read by prefetch_picobj() from the disk cache.
+ */
+void
+read_deferred_picobj(F_pic *pic)
+{
+	struct _pics	*pics = pic->pic_cache;
+
+	if (pics == NULL)
+		return;
+
+	if (pics->deferred) {
+		/* the colors of all pictures are allocated after loading */
+		bool	remap = pics->deferred != PIC_LOADING;
+
+		read_picture(pic);
+		/* allocate the colors of the picture */
+		if (remap && pics->bitmap != NULL && pics->numcols > 0)
+			remap_imagecolors();
+	}
+	if (pic->hw_ratio == 0.0 && pics->bit_size.x > 0)
+		pic->hw_ratio = (float)pics->bit_size.y / pics->bit_size.x;
+}
+
+/* the work procedure reading visible deferred pictures, or 0 */
+static XtWorkProcId	deferred_work = 0;
+
+/*
+ * Set the height/width ratio of the pictures in obj that show pics, if not
+ * known yet, e.g., because the header of the file gave no size.
+ */
+static void
+set_hw_ratio(F_compound *obj, struct _pics *pics, float hw_ratio)
+{
+	F_line		*l;
+	F_compound	*c;
+
+	for (c = obj->compounds; c != NULL; c = c->next)
+		set_hw_ratio(c, pics, hw_ratio);
+	for (l = obj->lines; l != NULL; l = l->next)
+		if (l->type == T_PICTURE && l->pic->pic_cache == pics &&
+				l->pic->hw_ratio == 0.0)
+			l->pic->hw_ratio = hw_ratio;
+}
+
+/* called by XtAppAddWorkProc, read one of the visible deferred pictures */
+static Boolean
+read_visible(XtPointer client_data)
+{
+	F_pic		pic;
+	struct _pics	*pics;
+
+	(void)client_data;
+
+	for (pics = pictures; pics; pics = pics->next)
+		if (pics->deferred == PIC_VISIBLE)
+			break;
+	if (pics == NULL) {
+		deferred_work = 0;
+		return True;	/* remove the work procedure */
+	}
+
+	memset(&pic, 0, sizeof pic);
+	pic.pic_cache = pics;
+	read_deferred_picobj(&pic);
+	/* pic is a stand-in, pass the ratio on to the picture objects */
+	if (pic.hw_ratio != 0.0)
+		set_hw_ratio(&objects, pics, pic.hw_ratio);
+	redisplay_zoomed_region(pics->area_min.x, pics->area_min.y,
+			pics->area_max.x, pics->area_max.y);
+	return False;	/* call again */
+}
+
+/*
+ * Called by draw_line(), if a deferred picture is drawn within the region
+ * xmin, ymin, xmax, ymax (Fig units). Read the file when xfig is idle, and
+ * redraw the region.
+ */
+void
+queue_picobj(struct _pics *pics, int xmin, int ymin, int xmax, int ymax)
+{
+	if (pics->deferred == PIC_VISIBLE) {
+		pics->area_min.x = min2(pics->area_min.x, xmin);
+		pics->area_min.y = min2(pics->area_min.y, ymin);
+		pics->area_max.x = max2(pics->area_max.x, xmax);
+		pics->area_max.y = max2(pics->area_max.y, ymax);
+	} else {
+		pics->deferred = PIC_VISIBLE;
+		pics->area_min.x = xmin;
+		pics->area_min.y = ymin;
+		pics->area_max.x = xmax;
+		pics->area_max.y = ymax;
+	}
+	if (!deferred_work)
+		deferred_work = XtAppAddWorkProc(tool_app, read_visible, NULL);
+}
+
+/*
+ * With the resource picturememory, the bitmaps of the pictures may occupy
+ * at most that many megabytes. If more memory is used, the bitmaps of the
+ * least recently drawn pictures, which are not visible on the canvas, are
+ * freed, together with their pixmaps. These pictures are then treated like
+ * deferred pictures, and read again, typically from the disk cache, when
+ * they are drawn.
+ */
+static unsigned long	draw_count = 0;	/* incremented each time a picture
+					   is drawn */
+static unsigned long	last_trim = 0;	/* draw_count, when the bitmaps were
+					   last trimmed */
+static XtWorkProcId	trim_work = 0;
+
+/*
+ * Set the last_drawn time of all pictures on the canvas, and free the
+ * pixmaps of the pictures whose bitmap was freed.
+ */
+static void
+visit_pictures(F_compound *obj, bool free_evicted)
+{
+	int		xmin, ymin, xmax, ymax;
+	F_line		*l;
+	F_compound	*c;
+	struct _pics	*pics;
+
+	for (c = obj->compounds; c != NULL; c = c->next)
+		visit_pictures(c, free_evicted);
+	for (l = obj->lines; l != NULL; l = l->next) {
+		if (l->type != T_PICTURE || (pics = l->pic->pic_cache) == NULL)
+			continue;
+		if (free_evicted) {
+			if (pics->bitmap != NULL || l->pic->pixmap == (Pixmap)0)
+				continue;
+			XFreePixmap(tool_d, l->pic->pixmap);
+			l->pic->pixmap = (Pixmap)0;
+			if (l->pic->mask != (Pixmap)0)
+				XFreePixmap(tool_d, l->pic->mask);
+			l->pic->mask = (Pixmap)0;
+			continue;
+		}
+		if (!active_layer(l->depth))
+			continue;
+		line_bound(l, &xmin, &ymin, &xmax, &ymax);
+		if (overlapping(xmin, ymin, xmax, ymax, zoomxoff, zoomyoff,
+				zoomxoff + (int)(CANVAS_WD / zoomscale),
+				zoomyoff + (int)(CANVAS_HT / zoomscale)))
+			use_picobj(pics);
+	}
+}
+
+/*
+ * Free the bitmap of pics, and of all entries sharing it. The file is read
+ * again when the picture is drawn.
+ */
+static void
+evict_picture(struct _pics *pics)
+{
+	struct _pics	*e;
+
+	if (appres.DEBUG)
+		fprintf(stderr, "Free bitmap of picture %s\n", pics->file);
+
+	/* the last sharer must not free the entry */
+	++pics->refcount;
+	if (pics->content) {
+		for (e = content_table[PIC_INDEX(pics->content)]; e;
+				e = e->content_next) {
+			if (e->same == pics) {
+				free_bitmap(e);
+				e->deferred = PIC_DEFERRED;
+			}
+		}
+	}
+	free_bitmap(pics);
+	pics->deferred = PIC_DEFERRED;
+	free_picture_entry(pics);
+}
+
+/* called by XtAppAddWorkProc, free bitmaps until within the budget */
+static Boolean
+trim_pictures(XtPointer client_data)
+{
+	size_t		budget = (size_t)appres.picture_memory << 20;
+	size_t		used = 0;
+	bool		evicted = false;
+	struct _pics	*pics, *lru;
+
+	(void)client_data;
+	trim_work = 0;
+
+	for (pics = pictures; pics; pics = pics->next)
+		if (pics->bitmap != NULL && pics->same == NULL)
+			used += bitmap_len(pics);
+
+	if (used > budget) {
+		visit_pictures(&objects, false);
+		while (used > budget) {
+			lru = NULL;
+			for (pics = pictures; pics; pics = pics->next) {
+				if (pics->bitmap == NULL || pics->same ||
+						pics->deferred ||
+						pics->last_drawn > last_trim ||
+						pics->file == NULL ||
+						pics->file[0] == '\0')
+					continue;
+				if (lru == NULL ||
+					    pics->last_drawn < lru->last_drawn)
+					lru = pics;
+			}
+			if (lru == NULL)
+				break;
+			used -= bitmap_len(lru);
+			evict_picture(lru);
+			evicted = true;
+		}
+		if (evicted)
+			visit_pictures(&objects, true);
+	}
+	last_trim = draw_count;
+
+	if (appres.DEBUG)
+		fprintf(stderr, "Picture bitmaps use %zu kB of %d MB\n",
+				used >> 10, appres.picture_memory);
+	return True;	/* remove the work procedure */
+}
+
+/*
+ * Called by draw_pic_pixmap(), before the picture pics is drawn. Record the
+ * time of use, and, if a memory budget is given, check it when xfig is idle.
+ */
+void
+use_picobj(struct _pics *pics)
+{
+	pics->last_drawn = ++draw_count;
+	if (pics->same)
+		pics->same->last_drawn = draw_count;
+	if (appres.picture_memory > 0 && !trim_work)
+		trim_work = XtAppAddWorkProc(tool_app, trim_pictures, NULL);
+}
+
+/*
+ * Pictures are read in parallel by child processes, which store the bitmaps
+ * in the disk cache. The parent continues to read the figure, and finally
+ * takes the pictures from the disk cache. See prefetch_picobj().
+ */
+#define	MAX_READERS	32
+
+static pid_t	readers[MAX_READERS];	/* the running child processes */
+static int	num_readers = 0;
+static int	max_readers = 0;
+
+/*
+ * Read the picture file of pics into the disk cache. Called in a child
+ * process forked by prefetch_picobj(). Pictures that are not kept in the disk
+ * cache, or that need the X server to be read, are left to the parent.
+ * Return 0 on success, 1 on failure.
+ */
+static int
+read_to_cache(struct _pics *pics)
+{
+	int		i;
+	int		ret = 1;
+	char		*abs_path = ABSOLUTE_PATH(pics->file);
+	time_t		mtime;
+	uint64_t	key;
+	F_pic		pic;
+	struct xfig_stream	pic_stream;
+
+	if (picture_key(abs_path, &key, &mtime))
+		return 1;
+
+	init_stream(&pic_stream);
+	if (open_stream(abs_path, &pic_stream) == NULL) {
+		free_stream(&pic_stream);
+		return 1;
+	}
+
+	i = picture_format(pic_stream.fp);
+	if (i != -1 && headers[i].readfunc != read_eps &&
+			headers[i].readfunc != read_pdf
+#ifdef USE_XPM
+			&& headers[i].readfunc != read_xpm
+#endif
+			) {
+		memset(&pic, 0, sizeof pic);
+		pic.pic_cache = pics;
+		pics->reduction = 1;
+		if (headers[i].readfunc(&pic, &pic_stream) == PicSuccess) {
+			store_cached_picture(&pic, key);
+			ret = 0;
+		}
+	}
+
+	close_stream(&pic_stream);
+	free_stream(&pic_stream);
+	return ret;
+}
+
+/*
+ * Wait until one of the child processes reading pictures finished, or until
+ * all finished, if "all" is true. Return false, if the user pressed the cancel
+ * button. Then, the child processes are terminated.
+ */
+static bool
+wait_readers(bool all)
+{
+	int	i;
+	int	status;
+	int	left = -1;
+	pid_t	pid;
+
+	while (num_readers > 0) {
+		for (i = 0; i < num_readers; ) {
+			pid = waitpid(readers[i], &status, WNOHANG);
+			if (pid == 0 || (pid == -1 && errno == EINTR)) {
+				++i;
+				continue;
+			}
+			/* finished, or not a child any more */
+			readers[i] = readers[--num_readers];
+			if (!all)
+				return true;
+		}
+		if (num_readers == 0)
+			break;
+
+		if (check_cancel()) {
+			for (i = 0; i < num_readers; ++i)
+				kill(readers[i], SIGTERM);
+			for (i = 0; i < num_readers; ++i)
+				while (waitpid(readers[i], &status, 0) == -1 &&
+						errno == EINTR)
+					;
+			num_readers = 0;
+			return false;
+		}
+		if (all && left != num_readers) {
+			left = num_readers;
+			put_msg("Reading Picture object files...%d left", left);
+			app_flush();
+		}
+		usleep(10000);
+	}
+	return true;
+}
+
+/*
+ * Put the picture "file" into pic, like read_picobj(), but read the file in a
+ * child process in parallel to reading the rest of the figure. Afterwards,
+ * call wait_prefetched_picobjs() and read_deferred_picobj(), to put the
+ * picture into pic. If the disk cache is disabled, or on a single processor,
+ * read the file immediately.
+ */
+void
+prefetch_picobj(F_pic *pic, char *file, int color)
+{
+	bool		reread;
+	bool		existing;
+	long		ncpu;
+	pid_t		pid;
+	Boolean		dum;
+	struct _pics	*pics;
+
+	if (max_readers == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		max_readers = ncpu > MAX_READERS ? MAX_READERS :
+			(ncpu > 1 ? (int)ncpu : 1);
+	}
+	if (max_readers == 1 || appres.picture_cache_size <= 0) {
+		read_picobj(pic, file, color, False, &dum);
+		return;
+	}
+
+	init_picobj(pic, color);
+
+	/* check if user pressed cancel button */
+	if (check_cancel())
+		return;
+
+	if (!(pics = attach_picture(pic, file, false, &reread, &existing)))
+		return;
+
+	if (reread) {
+		if (num_readers == max_readers && !wait_readers(false)) {
+			if (pics->refcount > 1)
+				free(file);
+			return;
+		}
+		pid = fork();
+		if (pid == 0) {
+			/* the child, must not talk to the X server */
+			update_figs = True;	/* any message goes to stderr */
+			close_export_pipes();
+			/* the parent reports errors, when it reads the file */
+			(void)freopen("/dev/null", "w", stderr);
+			_exit(read_to_cache(pics));
+		}
+		if (pid == -1) {
+			read_picture(pic);
+		} else {
+			readers[num_readers++] = pid;
+			pics->deferred = PIC_LOADING;
+		}
+	}
+
+	if (pics->refcount > 1)
+		free(file);
+}
+
+/*
+ * Wait for the child processes started by prefetch_picobj() to finish.
+ * Return False, if the user pressed the cancel button.
+ */
+Boolean
+wait_prefetched_picobjs(void)
+{
+	bool	ret;
+
+	if (num_readers == 0)
+		return True;
+	ret = wait_readers(true);
+	put_msg("Reading Picture object files...Done");
+	return ret ? True : False;
+}
+
+/*
+ * A picture, e.g., a large jpeg or tiff image, may have been decoded at a
+ * reduced size. If the picture pic is to be displayed with width x height
+ * pixels, larger than the bitmap, read the picture again at a higher
+ * resolution. If the picture can not be read, the old bitmap is kept.
+ * The whole file is decoded again, and the bitmap covers the whole picture,
+ * not only the visible part. Hence, with the picturememory resource, do not
+ * refine a bitmap beyond that budget.
+ */
+void
+refine_picobj(F_pic *pic, int width, int height)
+{
+#if defined HAVE_JPEG || defined HAVE_TIFF
+	struct _pics		*pics = pic->pic_cache;
+	unsigned char		*bitmap;
+	size_t			mapped;
+	F_pic			owner;
+	struct xfig_stream	pic_stream;
+	int	(*readfunc)(F_pic *, struct xfig_stream *restrict) = NULL;
+
+	/* read the picture that owns a shared bitmap */
+	if (pics && pics->same)
+		pics = pics->same;
+
+	if (pics == NULL || pics->bitmap == NULL || pics->reduction <= 1 ||
+			(width <= pics->bit_size.x &&
+			 height <= pics->bit_size.y))
+		return;
+
+#ifdef HAVE_JPEG
+	if (pics->subtype == T_PIC_JPEG)
+		readfunc = read_jpg;
+#endif
+#ifdef HAVE_TIFF
+	if (pics->subtype == T_PIC_TIF)
+		readfunc = read_tif;
+#endif
+	if (readfunc == NULL)
+		return;
+
+	/* do not try again for a smaller, or the same size */
+	if (width <= pics->view_size.x && height <= pics->view_size.y)
+		return;
+	/* the refined bitmap has at least width x height pixels */
+	if (appres.picture_memory > 0 && (size_t)width * height * sizeof(int)
+			> (size_t)appres.picture_memory << 20)
+		return;
+	if (width > pics->view_size.x)
+		pics->view_size.x = width;
+	if (height > pics->view_size.y)
+		pics->view_size.y = height;
+
+	init_stream(&pic_stream);
+	if (open_stream(ABSOLUTE_PATH(pics->file), &pic_stream) == NULL) {
+		free_stream(&pic_stream);
+		return;
+	}
+
+	put_msg("Reading Picture object file...");
+	app_flush();
+
+	bitmap = pics->bitmap;
+	mapped = pics->mapped;
+	pics->bitmap = NULL;
+	pics->mapped = 0;
+	memset(&owner, 0, sizeof owner);
+	owner.pic_cache = pics;
+	if (readfunc(&owner, &pic_stream) == PicSuccess) {
+		/* free the previous bitmap */
+		if (mapped)
+			munmap(bitmap - PIC_CACHE_OFFSET, mapped);
+		else
+			free(bitmap);
+		pics->cmap_mapped = 0;
+		update_sharers(pics);
+		put_msg("Reading Picture object file...Done");
+	} else {
+		pics->bitmap = bitmap;
+		pics->mapped = mapped;
+		put_msg("Reading Picture object file...Failed");
+	}
+
+	close_stream(&pic_stream);
+	free_stream(&pic_stream);
+#else
+	(void)pic;
+	(void)width;
+	(void)height;
+#endif /* HAVE_JPEG || HAVE_TIFF */
+}
+
+/*
+ * Return a file descriptor to an anonymous file, open for reading and writing.
+ * The file is removed when the last descriptor referring to it is closed.
+ */
+static int
+anonymous_fd(void)
+{
+	int	fd;
+	FILE	*fp;
+
+#ifdef HAVE_MEMFD_CREATE
+	if ((fd = memfd_create("xfig", MFD_CLOEXEC)) != -1)
+		return fd;
+#endif
+	if (!(fp = tmpfile()))
+		return -1;
+	fd = dup(fileno(fp));
+	fclose(fp);
+	return fd;
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_BZLIB) || defined(HAVE_LZMA)
+static int
+write_fd(int fd, const char *buf, size_t len)
+{
+	ssize_t	n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+#endif
+
+#define	UNCOMPRESS_BUFSIZ	65536
+
+#ifdef HAVE_ZLIB
+static int
+gunzip_to_fd(FILE *in, int fd)
+{
+	int	n;
+	int	ret = 0;
+	int	err;
+	char	buf[UNCOMPRESS_BUFSIZ];
+	gzFile	gz;
+
+	if (!(gz = gzdopen(dup(fileno(in)), "rb")))
+		return -1;
+	gzbuffer(gz, UNCOMPRESS_BUFSIZ);
+	while ((n = gzread(gz, buf, sizeof buf)) > 0)
+		if (write_fd(fd, buf, (size_t)n)) {
+			ret = -1;
+			break;
+		}
+	if (n < 0) {
+		file_msg("Error: %s", gzerror(gz, &err));
+		ret = -1;
+	}
+	gzclose(gz);
+	return ret;
+}
+#endif
+
+#ifdef HAVE_BZLIB
+static int
+bunzip2_to_fd(FILE *in, int fd)
+{
+	int	n;
+	int	err;
+	int	nunused = 0;
+	char	buf[UNCOMPRESS_BUFSIZ];
+	char	unused[BZ_MAX_UNUSED];
+	void	*p;
+	BZFILE	*bz;
+
+	/* a .bz2 file may consist of several concatenated streams */
+	do {
+		bz = BZ2_bzReadOpen(&err, in, 0, 0, unused, nunused);
+		if (err != BZ_OK) {
+			BZ2_bzReadClose(&err, bz);
+			return -1;
+		}
+		do {
+			n = BZ2_bzRead(&err, bz, buf, sizeof buf);
+			if ((err == BZ_OK || err == BZ_STREAM_END) &&
+					write_fd(fd, buf, (size_t)n))
+				err = BZ_IO_ERROR;
+		} while (err == BZ_OK);
+		if (err != BZ_STREAM_END) {
+			file_msg("Error: %s", BZ2_bzerror(bz, &err));
+			BZ2_bzReadClose(&err, bz);
+			return -1;
+		}
+		BZ2_bzReadGetUnused(&err, bz, &p, &nunused);
+		memcpy(unused, p, (size_t)nunused);
+		BZ2_bzReadClose(&err, bz);
+	} while (nunused > 0 || ((n = getc(in)) != EOF && ungetc(n, in) != EOF));
+
+	return 0;
+}
+#endif
+
+#ifdef HAVE_LZMA
+static int
+unxz_to_fd(FILE *in, int fd)
+{
+	int		ret = 0;
+	uint8_t		inbuf[UNCOMPRESS_BUFSIZ];
+	uint8_t		outbuf[UNCOMPRESS_BUFSIZ];
+	lzma_action	action = LZMA_RUN;
+	lzma_ret	err;
+	lzma_stream	strm = LZMA_STREAM_INIT;
+
+	if (lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED) !=LZMA_OK)
+		return -1;
+	strm.next_out = outbuf;
+	strm.avail_out = sizeof outbuf;
+	do {
+		if (strm.avail_in == 0 && action == LZMA_RUN) {
+			strm.next_in = inbuf;
+			strm.avail_in = fread(inbuf, 1, sizeof inbuf, in);
+			if (feof(in) || ferror(in))
+				action = LZMA_FINISH;
+		}
+		err = lzma_code(&strm, action);
+		if (strm.avail_out == 0 || err == LZMA_STREAM_END) {
+			if (write_fd(fd, (char *)outbuf,
+					sizeof outbuf - strm.avail_out)) {
+				ret = -1;
+				break;
+			}
+			strm.next_out = outbuf;
+			strm.avail_out = sizeof outbuf;
+		}
+	} while (err == LZMA_OK);
+	if (ret == 0 && err != LZMA_STREAM_END) {
+		file_msg("Error: corrupt xz data");
+		ret = -1;
+	}
+	lzma_end(&strm);
+	return ret;
+}
+#endif
+
+/*
+ * Uncompress the file name into the file descriptor fd, using one of the
+ * compression libraries. The compression format is determined by the magic
+ * number at the start of the file.
+ * Return 0 on success, -1 on error, and 1, if the format can not be
+ * uncompressed in-process. In the latter case, nothing is written to fd.
+ */
+static int
+uncompress_to_fd(const char *restrict name, int fd)
+{
+	int			ret = 1;
+	unsigned char		magic[6];
+	FILE			*in;
+
+	if (!(in = fopen(name, "rb")))
+		return 1;
+	if (fread(magic, 1, sizeof magic, in) != sizeof magic) {
+		fclose(in);
+		return 1;
+	}
+	rewind(in);
+
+	if (magic[0] == 0x1f && magic[1] == 0x8b) {
+#ifdef HAVE_ZLIB
+		/* gzdopen() reads via the file descriptor */
+		lseek(fileno(in), 0, SEEK_SET);
+		ret = gunzip_to_fd(in, fd);
+#endif
+	} else if (!memcmp(magic, "BZh", 3)) {
+#ifdef HAVE_BZLIB
+		ret = bunzip2_to_fd(in, fd);
+#endif
+	} else if (!memcmp(magic, "\3757zXZ", 6)) {
+#ifdef HAVE_LZMA
+		ret = unxz_to_fd(in, fd);
+#endif
+	}
+	/* otherwise, e.g., .Z or .zip, or no library */
+
+	if (ret == -1)
+		file_msg("Cannot uncompress %s.", name);
+	fclose(in);
+	return ret;
+}
+
+/*
+ * Return a file stream, either to a pipe or to a regular file.
+ * A compressed file is uncompressed in-process into an anonymous file, if
+ * possible. Otherwise, xf_stream->piped is set and the stream is a pipe.
+ */
+FILE *
+open_stream(char *restrict name, struct xfig_stream *restrict xf_stream)
+{
+	size_t	len;
+
+	if (xf_stream->name != name) {
+		/* strcpy (xf_stream->name, name) */
+		len = strlen(name);
+		if (len >= sizeof xf_stream->name_buf) {
+			if (!(xf_stream->name = new_string(len)))
+				return NULL;
+		}
+		memcpy(xf_stream->name, name, len + 1);
+	}
+
+	if (file_on_disk(name, &xf_stream->name_on_disk,
+				sizeof xf_stream->name_on_disk_buf,
+				&xf_stream->uncompress)) {
+		free_stream(xf_stream);
+		return NULL;
+	}
+
+	xf_stream->piped = False;
+	if (xf_stream->uncompress) {
+		/* a compressed file */
+
+		int	fd;
+		int	ret;
+		char	*args[4];
+
+		/* Try to uncompress into an anonymous, memory-backed file.
+		   The stream then behaves like a regular file, e.g., can be
+		   rewound or passed on to a helper program via its file
+		   descriptor. */
+		if ((fd = anonymous_fd()) != -1) {
+			ret = uncompress_to_fd(xf_stream->name_on_disk, fd);
+			if (ret == 0 && lseek(fd, 0, SEEK_SET) == 0 &&
+					(xf_stream->fp = fdopen(fd, "rb")))
+				return xf_stream->fp;
+			close(fd);
+			if (ret == -1) {
+				xf_stream->fp = NULL;
+				return NULL;
+			}
+		}
+
+		/* no library available, call the external program */
+		xf_stream->piped = True;
+		args[0] = xf_stream->uncompress[0];
+		args[1] = xf_stream->uncompress[1];
+		args[2] = xf_stream->name_on_disk;
+		args[3] = NULL;
+
+		if ((fd = spawn_popen(args, "r")) == -1) {
+			xf_stream->fp = NULL;
+			return NULL;
+		}
+		if (!(xf_stream->fp = fdopen(fd, "r")))
+			file_msg("Cannot read uncompressed content of %s: %s",
+					xf_stream->name_on_disk,
+					strerror(errno));
+
+	} else {
+		/* uncompressed file */
+
+		if (!(xf_stream->fp = fopen(xf_stream->name_on_disk, "rb")))
 			file_msg("Unable to open %s: %s",
 					xf_stream->name_on_disk,
 					strerror(errno));
@@ -506,7 +1806,7 @@ close_stream(struct xfig_stream *restrict xf_stream)
 	if (xf_stream->fp == NULL)
 		return -1;
 
-	if (!xf_stream->uncompress) {
+	if (!xf_stream->piped) {
 		/* a regular file */
 		return fclose(xf_stream->fp);
 	} else {
@@ -521,7 +1821,7 @@ rewind_stream(struct xfig_stream *restrict xf_stream)
 	if (xf_stream->fp == NULL)
 		return NULL;
 
-	if (!xf_stream->uncompress) {
+	if (!xf_stream->piped) {
 		/* a regular file */
 		/* The file might be read with the raw system calls via its file
 		   descriptor, or with fread. Positioning of the stream and the
@@ -590,13 +1890,15 @@ uncompressed_content(struct xfig_stream *restrict xf_stream)
 		return ret;
 	}
 
-	args[0] = xf_stream->uncompress[0];
-	args[1] = xf_stream->uncompress[1];
-	args[2] = xf_stream->name_on_disk;
-	args[3] = NULL;
+	if ((ret = uncompress_to_fd(xf_stream->name_on_disk, fd)) == 1) {
+		args[0] = xf_stream->uncompress[0];
+		args[1] = xf_stream->uncompress[1];
+		args[2] = xf_stream->name_on_disk;
+		args[3] = NULL;
 
-	/* spawn_usefd() gives sufficient error information */
-	ret = spawn_usefd(args, -1, fd);
+		/* spawn_usefd() gives sufficient error information */
+		ret = spawn_usefd(args, -1, fd);
+	}
 	if (close(fd))
 		file_msg("Error closing temporary file %s: %s",
 				xf_stream->content, strerror(errno));
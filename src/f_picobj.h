@@ -30,8 +30,9 @@
 
 /*
  * The xfig_stream struct either refers to a file, or to a pipe obtained by
- * uncompressing a compressed file. In addition, the uncompressed content
- * may be provided.
+ * uncompressing a compressed file. A compressed file is preferably
+ * uncompressed in-process into an anonymous regular file. In addition, the
+ * uncompressed content may be provided.
  */
 struct xfig_stream {
 	FILE	*fp;		/* NULL, if not open */
@@ -41,14 +42,23 @@ struct xfig_stream {
 				   uncompressed content of name */
 	char	**uncompress;	/* e.g., {"gunzip", "-c"}, or NULL
 				   NULL if uncompression is unnecessary */
+	Boolean	piped;		/* fp is a pipe from the uncompress command */
 	char	name_buf[128];
 	char	name_on_disk_buf[128];
 	char	content_buf[128];
-	/* regular file, if uncompress == NULL */
+	/* regular file, if piped == False */
 };
 
 extern void	read_picobj(F_pic *pic, char *file, int color, Boolean force,
 				Boolean *existing);
+extern void	refine_picobj(F_pic *pic, int width, int height);
+extern void	defer_picobj(F_pic *pic, char *file, int color);
+extern void	read_deferred_picobj(F_pic *pic);
+extern void	queue_picobj(struct _pics *pics, int xmin, int ymin, int xmax,
+				int ymax);
+extern void	use_picobj(struct _pics *pics);
+extern void	prefetch_picobj(F_pic *pic, char *file, int color);
+extern Boolean	wait_prefetched_picobjs(void);
 extern void	image_size(int *size_x, int *size_y, int pixels_x, int pixels_y,
 				char unit, float res_x, float res_y);
 
@@ -65,5 +75,7 @@ extern int	close_stream(struct xfig_stream *restrict xf_stream);
 extern FILE	*rewind_stream(struct xfig_stream *restrict xf_stream);
 extern int	uncompressed_content(struct xfig_stream *restrict xf_stream);
 extern void	free_stream(struct xfig_stream *restrict xf_stream);
+extern void	free_bitmap(struct _pics *pics);
+extern void	unhash_picture(struct _pics *pics);
 
 #endif
@@ -23,6 +23,7 @@
 
 #include <ctype.h>		/* isdigit() */
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,6 +31,9 @@
 #include <strings.h>
 #endif
 #include <locale.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <X11/Xft/Xft.h>
 
 #include "resources.h"
@@ -85,7 +89,12 @@ static int		save_comment(void);
 static char		*attach_comments(void);
 static void		count_lines_correctly(FILE *fp);
 static int		read_return(int status);
+static int		read_figb(FILE *fp, F_compound *obj, Boolean merge,
+				int xoff, int yoff, fig_settings *settings);
+static int		read_point(FILE *fp, int *x, int *y);
+static int		read_sfactor(FILE *fp, double *s);
 static Boolean		contains_picture(F_compound *compound);
+static void		read_prefetched(F_compound *compound);
 static XftColor		save_colors[MAX_USR_COLS];
 
 #define FILL_CONVERT(f)					\
@@ -111,6 +120,15 @@ static int	proto;			/* file protocol*10 */
 static float	fproto, xfigproto;	/* floating values for protocol of
 					   figure file and current protocol */
 
+/* the point and shape factor sections of a binary figure, see read_figb() */
+static struct {
+	Boolean			active;
+	const unsigned char	*points;	/* little-endian int32 x, y */
+	size_t			npoints;
+	const unsigned char	*sfactors;	/* little-endian IEEE double */
+	size_t			nsfactors;
+} figb = { False, NULL, 0, NULL, 0 };
+
 /* initialize the user color counter - then read figure file.
    Called from load_file(), merge_file(), preview_figure(), load_lib_obj(),
    and paste(), but NOT from read_figure() (import Fig as picture) */
@@ -182,6 +200,22 @@ contains_picture(F_compound *compound)
 	return False;
 }
 
+/* put the pictures read by prefetch_picobj() into the picture objects */
+static void
+read_prefetched(F_compound *compound)
+{
+	F_line		*l;
+	F_compound	*c;
+
+	for (c = compound->compounds; c != NULL; c = c->next)
+		read_prefetched(c);
+	for (l = compound->lines; l != NULL; l = l->next)
+		/* pictures deferred until drawn remain so */
+		if (l->type == T_PICTURE && l->pic->pic_cache &&
+				l->pic->pic_cache->deferred != PIC_DEFERRED)
+			read_deferred_picobj(l->pic);
+}
+
 /**********************************************************
 Read_fig returns :
 
@@ -217,6 +251,7 @@ read_fig(char *file_name, F_compound *obj, Boolean merge, int xoff, int yoff,
 	FILE			*fp;
 	struct xfig_stream	fig_stream;
 	int			status;
+	int			c;
 
 	file_msg(NULL, file_name);
 	init_stream(&fig_stream);
@@ -227,7 +262,16 @@ read_fig(char *file_name, F_compound *obj, Boolean merge, int xoff, int yoff,
 		put_msg("Reading objects from \"%s\" ...", file_name);
 	/* set the numeric locale to C so we get decimal points for numbers */
 	setlocale(LC_NUMERIC, "C");
-	status = readfp_fig(fp, obj, merge, xoff, yoff, settings);
+	/* a binary figure starts with a non-ascii byte */
+	c = getc(fp);
+	ungetc(c, fp);
+	if (c == (unsigned char)FIGB_MAGIC[0])
+		status = read_figb(fp, obj, merge, xoff, yoff, settings);
+	else
+		status = readfp_fig(fp, obj, merge, xoff, yoff, settings);
+	/* put the pictures read in parallel into the objects */
+	if (!update_figs && wait_prefetched_picobjs() && status == 0)
+		read_prefetched(obj);
 	/* reset to original locale */
 	setlocale(LC_NUMERIC, "");
 	(void)close_stream(&fig_stream);
@@ -936,7 +980,6 @@ read_lineobject(FILE *fp)
 	int		type, style, radius_flag;
 	float	thickness, wd, ht;
 	int		ox, oy;
-	Boolean	dum;
 
 	if ((l = create_line()) == NULL){
 		numcom=0;
@@ -1058,8 +1101,12 @@ read_lineobject(FILE *fp)
 
 		if (!update_figs) {
 			/* only read in the image if update_figs is False */
-			read_picobj(l->pic, internal_path(s1), l->pen_color,
-					False, &dum);
+			if (appres.defer_pictures)
+				defer_picobj(l->pic, internal_path(s1),
+						l->pen_color);
+			else
+				prefetch_picobj(l->pic, internal_path(s1),
+						l->pen_color);
 		} else {
 			/* otherwise just make a pseudo entry with
 			   the filename */
@@ -1085,7 +1132,7 @@ read_lineobject(FILE *fp)
 
 	/* read first point */
 	line_no++;
-	if (fscanf(fp, "%d%d", &p->x, &p->y) != 2) {
+	if (!read_point(fp, &p->x, &p->y)) {
 		file_msg(Err_incomp, "line", save_line);
 		free_linestorage(l);
 		numcom=0;
@@ -1100,7 +1147,7 @@ read_lineobject(FILE *fp)
 	cnpts = 1;		/* keep track of actual number of points read */
 	for (--npts; npts > 0; npts--) {
 		count_lines_correctly(fp);
-		if (fscanf(fp, "%d%d", &x, &y) != 2) {
+		if (!read_point(fp, &x, &y)) {
 			file_msg(Err_incomp, "line", save_line);
 			free_linestorage(l);
 			numcom=0;
@@ -1156,8 +1203,9 @@ read_lineobject(FILE *fp)
 		}
 	}
 	l->comments = attach_comments();	/* attach any comments */
-	/* skip to the next line */
-	skip_line(fp);
+	/* skip to the next line, the points of a binary figure are elsewhere */
+	if (!figb.active)
+		skip_line(fp);
 	return l;
 }
 
@@ -1246,7 +1294,7 @@ read_splineobject(FILE *fp)
 
 	/* read first point */
 	line_no++;
-	if ((n = fscanf(fp, "%d%d", &x, &y)) != 2) {
+	if (!read_point(fp, &x, &y)) {
 		file_msg(Err_incomp, "spline", save_line);
 		free_splinestorage(s);
 		numcom=0;
@@ -1268,7 +1316,7 @@ read_splineobject(FILE *fp)
 	numpts = 1;
 	for (--npts; npts > 0; npts--) {
 		count_lines_correctly(fp);
-		if (fscanf(fp, "%d%d", &x, &y) != 2) {
+		if (!read_point(fp, &x, &y)) {
 			file_msg(Err_incomp, "spline", save_line);
 			p->next = NULL;
 			free_splinestorage(s);
@@ -1322,7 +1370,7 @@ read_splineobject(FILE *fp)
 	/* Read sfactors - the s parameter for splines */
 
 	count_lines_correctly(fp);
-	if ((n = fscanf(fp, "%lf", &s_param)) != 1) {
+	if (!read_sfactor(fp, &s_param)) {
 		file_msg(Err_incomp, "spline", save_line);
 		free_splinestorage(s);
 		numcom=0;
@@ -1337,7 +1385,7 @@ read_splineobject(FILE *fp)
 	cp->s = s_param;
 	while (--c) {
 		count_lines_correctly(fp);
-		if (fscanf(fp, "%lf", &s_param) != 1) {
+		if (!read_sfactor(fp, &s_param)) {
 			file_msg(Err_incomp, "spline", save_line);
 			cp->next = NULL;
 			free_splinestorage(s);
@@ -1371,7 +1419,8 @@ read_splineobject(FILE *fp)
 	s->comments = attach_comments();	/* attach any comments */
 
 	/* skip to the end of the line */
-	skip_line(fp);
+	if (!figb.active)
+		skip_line(fp);
 	return s;
 }
 
@@ -2050,6 +2099,8 @@ static void
 count_lines_correctly(FILE *fp)
 {
 	int cc;
+	if (figb.active)
+		return;
 	do{
 		cc=getc(fp);
 		if (cc=='\n') {
@@ -2074,3 +2125,145 @@ convert_arrow(int *type, float *wd, float *ht)
 		*ht /= ZOOM_FACTOR;
 	}
 }
+
+/*
+ * Binary figures, see doc/FORMAT3.2B. The TEXT section is read by
+ * readfp_fig(), only the point coordinates and the shape factors of the
+ * polylines and splines are taken from the PNTS and SFAC sections.
+ */
+
+static uint32_t
+get_le32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+		(uint32_t)p[3] << 24;
+}
+
+static uint64_t
+get_le64(const unsigned char *p)
+{
+	return (uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+static int
+read_point(FILE *fp, int *x, int *y)
+{
+	if (!figb.active)
+		return fscanf(fp, "%d%d", x, y) == 2;
+	if (figb.npoints == 0)
+		return 0;
+	*x = (int32_t)get_le32(figb.points);
+	*y = (int32_t)get_le32(figb.points + 4);
+	figb.points += 8;
+	--figb.npoints;
+	return 1;
+}
+
+static int
+read_sfactor(FILE *fp, double *s)
+{
+	uint64_t	u;
+
+	if (!figb.active)
+		return fscanf(fp, "%lf", s) == 1;
+	if (figb.nsfactors == 0)
+		return 0;
+	u = get_le64(figb.sfactors);
+	memcpy(s, &u, sizeof *s);
+	figb.sfactors += 8;
+	--figb.nsfactors;
+	return 1;
+}
+
+static int
+read_figb(FILE *fp, F_compound *obj, Boolean merge, int xoff, int yoff,
+		fig_settings *settings)
+{
+	int		status;
+	size_t		len, size, n;
+	size_t		pos;
+	uint64_t	seclen;
+	unsigned char	*data = NULL;
+	unsigned char	*mapped = NULL;
+	const unsigned char	*text = NULL;
+	size_t		text_len = 0;
+	struct stat	st;
+	FILE		*tp;
+
+	/* map a plain file, read a compressed one */
+	if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) &&
+			ftell(fp) == 0 && st.st_size > FIGB_HEADER_SIZE &&
+			(mapped = mmap(NULL, (size_t)st.st_size, PROT_READ,
+				MAP_PRIVATE, fileno(fp), 0)) != MAP_FAILED) {
+		data = mapped;
+		len = (size_t)st.st_size;
+	} else {
+		mapped = NULL;
+		len = 0;
+		size = 0;
+		do {
+			if (len == size) {
+				unsigned char	*d;
+				size = size ? 2 * size : 65536;
+				if (!(d = realloc(data, size))) {
+					free(data);
+					return ENOMEM;
+				}
+				data = d;
+			}
+			n = fread(data + len, 1, size - len, fp);
+			len += n;
+		} while (n > 0);
+	}
+
+	status = 0;
+	if (len < FIGB_HEADER_SIZE || memcmp(data, FIGB_MAGIC, 8) ||
+			get_le32(data + 8) != FIGB_VERSION) {
+		file_msg("Not a binary Fig file, or an unknown version.");
+		status = BAD_FORMAT;
+	}
+	memset(&figb, 0, sizeof figb);
+
+	/* the sections, each 8-byte aligned */
+	for (pos = FIGB_HEADER_SIZE; status == 0 && pos + 16 <= len;
+			pos += 16 + ((seclen + 7) & ~(uint64_t)7)) {
+		seclen = get_le64(data + pos + 8);
+		if (seclen > len - pos - 16) {
+			file_msg("Truncated binary Fig file.");
+			status = BAD_FORMAT;
+			break;
+		}
+		if (!memcmp(data + pos, "TEXT", 4)) {
+			text = data + pos + 16;
+			text_len = (size_t)seclen;
+		} else if (!memcmp(data + pos, "PNTS", 4)) {
+			figb.points = data + pos + 16;
+			figb.npoints = (size_t)seclen / 8;
+		} else if (!memcmp(data + pos, "SFAC", 4)) {
+			figb.sfactors = data + pos + 16;
+			figb.nsfactors = (size_t)seclen / 8;
+		}	/* ignore unknown sections */
+	}
+	if (status == 0 && !text) {
+		file_msg("No figure in binary Fig file.");
+		status = BAD_FORMAT;
+	}
+
+	if (status == 0) {
+		if ((tp = fmemopen((void *)text, text_len, "r"))) {
+			figb.active = True;
+			status = readfp_fig(tp, obj, merge, xoff, yoff,
+					settings);
+			fclose(tp);
+		} else {
+			status = errno;
+		}
+	}
+
+	memset(&figb, 0, sizeof figb);
+	if (mapped)
+		munmap(mapped, len);
+	else
+		free(data);
+	return status;
+}
@@ -29,6 +29,12 @@
 #define MERGE			True
 #define DONT_MERGE		False
 
+/* binary figure files, see doc/FORMAT3.2B */
+#define FIGB_SUFFIX		".figb"
+#define FIGB_MAGIC		"\211FIGB\r\n\032\n"
+#define FIGB_VERSION		1
+#define FIGB_HEADER_SIZE	16	/* magic, version, flags */
+
 #define REMAP_IMAGES		True
 #define DONT_REMAP_IMAGES	False
 
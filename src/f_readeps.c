@@ -28,6 +28,7 @@
 #include <ctype.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,6 +38,7 @@
 #include "resources.h"
 #include "object.h"
 #include "f_picobj.h"
+#include "u_cache.h"
 #include "u_colors.h"
 #include "w_msgpanel.h"
 #include "w_setup.h"
@@ -44,14 +46,29 @@
 #include "xfig_math.h"
 
 /* u_ghostscript.c */
-extern int	gs_mediabox(char *file, int *llx, int *lly, int *urx, int *ury);
-extern int	gs_bitmap(char *file, F_pic *pic, int llx, int lly,
-						int urx, int ury);
+extern int	gs_mediabox(char *file, const uint64_t *file_hash, int *llx,
+				int *lly, int *urx, int *ury);
+extern int	gs_bitmap(char *file, const uint64_t *file_hash, F_pic *pic,
+				int llx, int lly, int urx, int ury);
 
 static void	lower(char *buf);
 static int	hex(char c);
 
 
+/*
+ * Hash the contents of the file name into *hash, the key of the results of
+ * ghostscript in the disk cache. Return hash, or NULL if the cache is
+ * disabled or the file cannot be read.
+ */
+static uint64_t *
+content_hash(const char *name, uint64_t *hash)
+{
+	if (appres.picture_cache_size <= 0 || cache_hash_file(name, hash))
+		return NULL;
+	return hash;
+}
+
+
 /*
  * Scan a pdf-file for a /MediaBox specification.
  * Return 0 on success, -1 on failure.
@@ -120,13 +137,17 @@ correct_boundingbox(int *llx, int *lly, int *urx, int *ury, const char *box) {
 int
 read_pdf(F_pic *pic, struct xfig_stream *restrict pic_stream)
 {
-	char	locale[64] = "C";
-	char	*savelocale;
+	char		locale[64] = "C";
+	char		*savelocale;
 	/* prime with an invalid bounding box */
-	int	llx = 0, lly = 0, urx = 0, ury = 0;
+	int		llx = 0, lly = 0, urx = 0, ury = 0;
+	uint64_t	hash;
+	uint64_t	*file_hash;
 
 	if (uncompressed_content(pic_stream))
 		return FileInvalid;
+	/* read a large file once, for the keys of both ghostscript calls */
+	file_hash = content_hash(pic_stream->content, &hash);
 
 	/*
 	 * Find the /MediaBox. First, do a simple text-scan for "/MediaBox",
@@ -142,7 +163,8 @@ read_pdf(F_pic *pic, struct xfig_stream *restrict pic_stream)
 	if (strcmp(locale, "C") && strcmp(locale, "POSIX"))
 		setlocale(LC_NUMERIC, "C");
 	if (scan_mediabox(pic_stream->content, &llx, &lly, &urx, &ury))
-		gs_mediabox(pic_stream->content, &llx, &lly, &urx, &ury);
+		gs_mediabox(pic_stream->content, file_hash, &llx, &lly, &urx,
+				&ury);
 	if (strcmp(locale, "C") && strcmp(locale, "POSIX"))
 		setlocale(LC_NUMERIC, locale);
 
@@ -162,7 +184,7 @@ read_pdf(F_pic *pic, struct xfig_stream *restrict pic_stream)
 	pic->pic_cache->numcols = 0;
 
 	/* create the bitmap */
-	if (gs_bitmap(pic_stream->content, pic, llx, lly, urx, ury))
+	if (gs_bitmap(pic_stream->content, file_hash, pic, llx, lly, urx, ury))
 		return FileInvalid;
 	else
 		return PicSuccess;
@@ -258,9 +280,13 @@ read_eps(F_pic *pic, struct xfig_stream *restrict pic_stream)
 	}
 
 	/* use ghostscript, if a preview bitmap does not exist */
-	if (!bitmapz && !uncompressed_content(pic_stream) && !gs_bitmap(
-				pic_stream->content, pic, llx, lly, urx, ury)) {
-		return PicSuccess;
+	if (!bitmapz && !uncompressed_content(pic_stream)) {
+		uint64_t	hash;
+
+		if (!gs_bitmap(pic_stream->content, content_hash(
+					pic_stream->content, &hash), pic, llx,
+					lly, urx, ury))
+			return PicSuccess;
 	}
 
 	if (!bitmapz) {
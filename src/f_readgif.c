@@ -47,16 +47,25 @@
 #include "object.h"
 #include "f_picobj.h"		/* init_stream() */
 #include "f_readpcx.h"
+#include "f_util.h"		/* map_to_mono() */
 #include "u_colors.h"
 #include "u_spawn.h"
 #include "w_msgpanel.h"
+#include "w_setup.h"		/* PIX_PER_INCH, PIX_PER_CM */
 
 
 static Boolean	ReadColorMap(FILE *fd, unsigned int number, struct Cmap *cmap);
 static Boolean	DoGIFextension(FILE *fd, int label);
 static int	GetDataBlock(FILE *fd, unsigned char *buf);
+static Boolean	ReadImage(FILE *fd, unsigned char *bitmap, unsigned int width,
+			unsigned int height, unsigned int ncolors,
+			Boolean interlace);
+static int	read_gif_pipe(F_pic *pic, struct xfig_stream *restrict
+			pic_stream, struct Cmap *colormap);
 
 #define LOCALCOLORMAP		0x80
+#define INTERLACE		0x40
+#define MAX_LZW_BITS		12
 #define	ReadOK(file,buffer,len)	\
 	    (fread((void *)buffer, (size_t)len, (size_t)1, (FILE *)file) != 0)
 #define BitSet(byte, bit)	(((byte) & (bit)) == (bit))
@@ -88,63 +97,22 @@ struct {
 int
 read_gif(F_pic *pic, struct xfig_stream *restrict pic_stream)
 {
-	char		buf[BUFSIZ];
-	const char	*one[5];
-	const char	*two[3];
+	/* make scale factor smaller for metric */
+	const double scale =
+		(appres.INCHES ? (double)PIX_PER_INCH : 2.54*PIX_PER_CM)
+		/ DISPLAY_PIX_PER_INCH;
+	unsigned char	buf[16];
 	struct Cmap	localColorMap[MAX_COLORMAP_SIZE];
-	int		i, mid, stat;
-	int		useGlobalColormap;
-	unsigned int	bitPixel, red, green, blue;
+	struct Cmap	*colormap;
+	unsigned int	bitPixel, width, height;
+	unsigned int	i;
 	unsigned char	c;
 	char		version[4];
-	/* the contents of this stream is copied to pic_stream, and closed
-	   outside of this function; therefore, static */
-	static struct xfig_stream	pcx;
 
 	if (!rewind_stream(pic_stream))
 		return FileInvalid;
 
-	/*
-	 * Set up the command to convert gif to pcx.
-	 */
-
-	if (spawn_exists("giftopnm", "-version") &&
-			spawn_exists("ppmtopcx", "-version")) {
-		/* command: giftopnm -quiet | ppmtopcx -quiet */
-		one[0] = "giftopnm";
-		two[0] = "ppmtopcx";
-		one[1] = two[1] = "-quiet";
-		one[2] = two[2] = NULL;
-
-	} else if (spawn_exists("convert", "-version")) {
-		/* command: convert - pcx:- */
-		one[0] = "convert";
-		one[1] = "-";
-		one[2] = "pcx:-";
-		one[3] = NULL;
-		two[0] = NULL;
-
-	} else if (spawn_exists("gm", "-version")) {
-		/* command: gm convert - pcx:- */
-		one[0] = "gm";
-		one[1] = "convert";
-		one[2] = "-";
-		one[3] = "pcx:-";
-		one[4] = NULL;
-		two[0] = NULL;
-
-	} else {
-		file_msg("Cannot read gif files.");
-		file_msg("To read gif files, install either the netpbm, or the "
-				"imagemagick, or the graphicsmagick package.");
-		return FileInvalid;
-	}
-
-	/*
-	 * Read transparency information.
-	 */
-
-	/* first read header to look for any transparent color extension */
+	/* first read header */
 	if (!ReadOK(pic_stream->fp, buf, 6)) {
 		return FileInvalid;
 	}
@@ -165,6 +133,9 @@ read_gif(F_pic *pic, struct xfig_stream *restrict pic_stream)
 		return FileInvalid;	/* failed to read screen descriptor */
 	}
 
+	/* do not keep anything, e.g., the colormap, of the previous file */
+	memset(&GifScreen, 0, sizeof GifScreen);
+
 	GifScreen.Width           = LM_to_uint(buf[0],buf[1]);
 	GifScreen.Height          = LM_to_uint(buf[2],buf[3]);
 	GifScreen.BitPixel        = 2<<(buf[4]&0x07);
@@ -177,6 +148,12 @@ read_gif(F_pic *pic, struct xfig_stream *restrict pic_stream)
 					GifScreen.ColorMap)) {
 			return FileInvalid;  /* error reading global colormap */
 		}
+	} else {
+		/* without any colormap, the decoder chooses one; use grays */
+		for (i = 0; i < GifScreen.BitPixel; ++i)
+			GifScreen.ColorMap[i].red = GifScreen.ColorMap[i].green
+				= GifScreen.ColorMap[i].blue =
+				i * 255 / (GifScreen.BitPixel - 1);
 	}
 
 	if (GifScreen.AspectRatio != 0 && GifScreen.AspectRatio != 49) {
@@ -214,23 +191,235 @@ read_gif(F_pic *pic, struct xfig_stream *restrict pic_stream)
 			return FileInvalid;
 		}
 
-		useGlobalColormap = !BitSet(buf[8], LOCALCOLORMAP);
-
-		bitPixel = 1<<((buf[8]&0x07)+1);
-
-		if (!useGlobalColormap) {
+		if (BitSet(buf[8], LOCALCOLORMAP)) {
+			bitPixel = 1<<((buf[8]&0x07)+1);
+			colormap = localColorMap;
 			if (!ReadColorMap(pic_stream->fp, bitPixel,
 						localColorMap)) {
 				file_msg("error reading local GIF colormap" );
 				return PicSuccess;
 			}
+		} else {
+			bitPixel = GifScreen.BitPixel;
+			colormap = GifScreen.ColorMap;
 		}
 		break;			/* image starts here, header is done */
 	}
 
+	width = LM_to_uint(buf[4],buf[5]);
+	height = LM_to_uint(buf[6],buf[7]);
+	if (width == 0 || height == 0)
+		return FileInvalid;
+
 	/* save transparent indicator */
 	pic->pic_cache->transp = Gif89.transparent;
+	if (pic->pic_cache->transp >= (int)bitPixel)
+		pic->pic_cache->transp = TRANSP_NONE;
+
+	/*
+	 * Decode the image. Only the first image of an animated gif is read.
+	 */
+	if (!(pic->pic_cache->bitmap = calloc((size_t)width * height, 1))) {
+		file_msg("Cannot allocate space for GIF image");
+		return FileInvalid;
+	}
+	if (!ReadImage(pic_stream->fp, pic->pic_cache->bitmap, width, height,
+				bitPixel, BitSet(buf[8], INTERLACE))) {
+		free(pic->pic_cache->bitmap);
+		pic->pic_cache->bitmap = NULL;
+		/* corrupt, or not understood - try the external programs */
+		if (appres.gif_pipe)
+			return read_gif_pipe(pic, pic_stream, colormap);
+		file_msg("Cannot decode gif file %s, see the -gifpipe option.",
+				pic_stream->name);
+		return FileInvalid;
+	}
+
+	memcpy(pic->pic_cache->cmap, colormap, bitPixel * sizeof(struct Cmap));
+	pic->pic_cache->numcols = bitPixel;
+	pic->pic_cache->subtype = T_PIC_GIF;
+	pic->pixmap = None;
+	pic->hw_ratio = (float)height / width;
+	pic->pic_cache->bit_size.x = width;
+	pic->pic_cache->bit_size.y = height;
+	pic->pic_cache->size_x = width * scale;
+	pic->pic_cache->size_y = height * scale;
+	/* if monochrome display map bitmap */
+	if (tool_cells <= 2 || appres.monochrome)
+		map_to_mono(pic);
+
+	return PicSuccess;
+}
+
+/*
+ * Decode the LZW-compressed raster data at the current position of fd into
+ * bitmap, one byte per pixel. Indices beyond the colormap are set to zero.
+ * A truncated image is accepted, the missing pixels are zero.
+ * Return False if the data stream is corrupt.
+ */
+static Boolean
+ReadImage(FILE *fd, unsigned char *bitmap, unsigned int width,
+		unsigned int height, unsigned int ncolors, Boolean interlace)
+{
+	static const unsigned int	start[] = {0, 4, 2, 1};
+	static const unsigned int	step[] = {8, 8, 4, 2};
+	unsigned short	prefix[1 << MAX_LZW_BITS];
+	unsigned char	suffix[1 << MAX_LZW_BITS];
+	unsigned char	stack[(1 << MAX_LZW_BITS) + 1];
+	unsigned char	block[256];
+	unsigned char	*sp;
+	unsigned char	*bp = block;
+	unsigned char	initCodeSize, firstchar = 0;
+	unsigned long	datum = 0;
+	unsigned int	x = 0, y = 0, pass = 0;
+	int		bits = 0, count = 0;
+	int		code, incode, oldcode = -1;
+	int		codeSize, clearCode, endCode, nextCode, maxCode;
+
+	if (!ReadOK(fd, &initCodeSize, 1) || initCodeSize < 1 ||
+			initCodeSize >= MAX_LZW_BITS)
+		return False;
+
+	clearCode = 1 << initCodeSize;
+	endCode = clearCode + 1;
+	codeSize = initCodeSize + 1;
+	nextCode = clearCode + 2;
+	maxCode = 1 << codeSize;
+	for (code = 0; code < clearCode; ++code)
+		suffix[code] = (unsigned char)code;
+
+	while (y < height) {
+		while (bits < codeSize) {
+			if (count == 0) {
+				if ((count = GetDataBlock(fd, block)) <= 0)
+					/* truncated image */
+					return True;
+				bp = block;
+			}
+			datum |= (unsigned long)*bp++ << bits;
+			bits += 8;
+			--count;
+		}
+		code = (int)(datum & (unsigned long)(maxCode - 1));
+		datum >>= codeSize;
+		bits -= codeSize;
+
+		if (code == clearCode) {
+			codeSize = initCodeSize + 1;
+			nextCode = clearCode + 2;
+			maxCode = 1 << codeSize;
+			oldcode = -1;
+			continue;
+		}
+		if (code == endCode)
+			break;
+
+		sp = stack;
+		incode = code;
+		if (oldcode == -1) {
+			if (code >= clearCode)
+				return False;
+			firstchar = (unsigned char)code;
+		} else {
+			if (code >= nextCode) {
+				if (code > nextCode)
+					return False;
+				*sp++ = firstchar;
+				code = oldcode;
+			}
+			while (code >= clearCode) {
+				*sp++ = suffix[code];
+				code = prefix[code];
+			}
+			firstchar = (unsigned char)code;
+			if (nextCode < (1 << MAX_LZW_BITS)) {
+				prefix[nextCode] = (unsigned short)oldcode;
+				suffix[nextCode] = firstchar;
+				if (++nextCode == maxCode &&
+						codeSize < MAX_LZW_BITS) {
+					++codeSize;
+					maxCode <<= 1;
+				}
+			}
+		}
+		*sp++ = (unsigned char)code;
+		oldcode = incode;
+
+		/* output the string, it is on the stack in reverse order */
+		while (sp > stack && y < height) {
+			--sp;
+			bitmap[(size_t)y * width + x] =
+				*sp < ncolors ? *sp : 0;
+			if (++x == width) {
+				x = 0;
+				if (interlace) {
+					y += step[pass];
+					while (y >= height && pass < 3)
+						y = start[++pass];
+				} else {
+					++y;
+				}
+			}
+		}
+	}
+
+	/* skip the rest of the raster data */
+	while (GetDataBlock(fd, block) > 0)
+		;
+	return True;
+}
+
+/*
+ * Convert the gif file with external programs to pcx, and read the result.
+ * Use this if the built-in decoder fails.
+ */
+static int
+read_gif_pipe(F_pic *pic, struct xfig_stream *restrict pic_stream,
+		struct Cmap *colormap)
+{
+	const char	*one[5];
+	const char	*two[3];
+	int		i, mid, stat;
+	unsigned int	red, green, blue;
+	/* the contents of this stream is copied to pic_stream, and closed
+	   outside of this function; therefore, static */
+	static struct xfig_stream	pcx;
+
+	/*
+	 * Set up the command to convert gif to pcx.
+	 */
+
+	if (spawn_exists("giftopnm", "-version") &&
+			spawn_exists("ppmtopcx", "-version")) {
+		/* command: giftopnm -quiet | ppmtopcx -quiet */
+		one[0] = "giftopnm";
+		two[0] = "ppmtopcx";
+		one[1] = two[1] = "-quiet";
+		one[2] = two[2] = NULL;
+
+	} else if (spawn_exists("convert", "-version")) {
+		/* command: convert - pcx:- */
+		one[0] = "convert";
+		one[1] = "-";
+		one[2] = "pcx:-";
+		one[3] = NULL;
+		two[0] = NULL;
+
+	} else if (spawn_exists("gm", "-version")) {
+		/* command: gm convert - pcx:- */
+		one[0] = "gm";
+		one[1] = "convert";
+		one[2] = "-";
+		one[3] = "pcx:-";
+		one[4] = NULL;
+		two[0] = NULL;
 
+	} else {
+		file_msg("Cannot read gif file %s.", pic_stream->name);
+		file_msg("To read corrupt gif files, install either the netpbm,"
+			" or the imagemagick, or the graphicsmagick package.");
+		return FileInvalid;
+	}
 
 	/*
 	 * Call the conversion program, or pipeline.
@@ -284,15 +473,9 @@ read_gif(F_pic *pic, struct xfig_stream *restrict pic_stream)
 	/* now match original transparent colortable index with possibly new
 	   colortable from ppmtopcx */
 	if (pic->pic_cache->transp != TRANSP_NONE) {
-		if (useGlobalColormap) {
-			red = GifScreen.ColorMap[pic->pic_cache->transp].red;
-			green = GifScreen.ColorMap[pic->pic_cache->transp].green;
-			blue = GifScreen.ColorMap[pic->pic_cache->transp].blue;
-		} else {
-			red = localColorMap[pic->pic_cache->transp].red;
-			green = localColorMap[pic->pic_cache->transp].green;
-			blue = localColorMap[pic->pic_cache->transp].blue;
-		}
+		red = colormap[pic->pic_cache->transp].red;
+		green = colormap[pic->pic_cache->transp].green;
+		blue = colormap[pic->pic_cache->transp].blue;
 		for (i = 0; i < pic->pic_cache->numcols; ++i) {
 			if (pic->pic_cache->cmap[i].red == red &&
 					pic->pic_cache->cmap[i].green == green &&
@@ -75,6 +75,7 @@
 #include "f_util.h"
 #include "u_colors.h"
 #include "w_msgpanel.h"
+#include "w_setup.h"		/* CANVAS_WD, CANVAS_HT */
 
 
 static void	error_exit(j_common_ptr cinfo);
@@ -108,6 +109,7 @@ static int
 read_JPEG_file(FILE *file, F_pic *pic)
 {
 	int				i;
+	unsigned			want_w, want_h;
 	size_t				bitmap_row;	/* row size of bitmap */
 	static jmp_buf			setjmp_buffer;
 	struct jpeg_decompress_struct	cinfo;
@@ -157,7 +159,27 @@ read_JPEG_file(FILE *file, F_pic *pic)
 #else
 		cinfo.out_color_space = JCS_RGB;
 #endif
-		bitmap_row = 4 * cinfo.image_width;
+		/*
+		 * Decode a large image at a reduced size, by 1/2, 1/4 or 1/8,
+		 * as long as the bitmap covers the size it is displayed at.
+		 * Before the picture is drawn, its size on the screen is not
+		 * known, assume the size of the canvas. If the picture is
+		 * later displayed larger, it is decoded again, see
+		 * refine_picobj().
+		 */
+		want_w = pic->pic_cache->view_size.x > 0 ?
+			(unsigned)pic->pic_cache->view_size.x :
+			(unsigned)CANVAS_WD;
+		want_h = pic->pic_cache->view_size.y > 0 ?
+			(unsigned)pic->pic_cache->view_size.y :
+			(unsigned)CANVAS_HT;
+		while (cinfo.scale_denom < 8 &&
+				cinfo.image_width / (2 * cinfo.scale_denom)
+								>= want_w &&
+				cinfo.image_height / (2 * cinfo.scale_denom)
+								>= want_h)
+			cinfo.scale_denom *= 2;
+		bitmap_row = 4;		/* bytes per pixel */
 	} else {
 		/* colormapped color space */
 		cinfo.quantize_colors = TRUE;
@@ -167,13 +189,17 @@ read_JPEG_file(FILE *file, F_pic *pic)
 		 *			making an extra pass over the image.)
 		 * cinfo.desired_number_of_colors = 256;
 		 */
-		bitmap_row = cinfo.image_width;
+		bitmap_row = 1;
 	}
 
+	/* compute output_width and output_height */
+	jpeg_calc_output_dimensions(&cinfo);
+	bitmap_row *= cinfo.output_width;
+
 
 	/* Now fill in the pic parameters */
 
-	pic->pic_cache->bitmap = malloc(bitmap_row * cinfo.image_height);
+	pic->pic_cache->bitmap = malloc(bitmap_row * cinfo.output_height);
 	if (pic->pic_cache->bitmap == NULL) {
 		file_msg("Can't alloc memory for JPEG image");
 		jpeg_destroy_decompress(&cinfo);
@@ -300,11 +326,13 @@ read_JPEG_file(FILE *file, F_pic *pic)
 	/* fill the pic struct */
 	pic->pixmap = None;
 	pic->pic_cache->subtype = T_PIC_JPEG;
-	pic->pic_cache->bit_size.x = (int)cinfo.image_width;
-	pic->pic_cache->bit_size.y = (int)cinfo.image_height;
+	pic->pic_cache->bit_size.x = (int)cinfo.output_width;
+	pic->pic_cache->bit_size.y = (int)cinfo.output_height;
+	pic->pic_cache->reduction = (int)cinfo.scale_denom;
 	pic->hw_ratio = (float)cinfo.image_height / cinfo.image_width;
+	/* the size of the picture is given by the full image */
 	image_size(&pic->pic_cache->size_x, &pic->pic_cache->size_y,
-			pic->pic_cache->bit_size.x, pic->pic_cache->bit_size.y,
+			(int)cinfo.image_width, (int)cinfo.image_height,
 			cinfo.density_unit == 1u ? 'i' :
 					(cinfo.density_unit == 2u ? 'c': 'u'),
 			(float)cinfo.X_density, (float)cinfo.Y_density);
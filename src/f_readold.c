@@ -527,6 +527,9 @@ read_1_3_textobject(FILE *fp)
 		t->font, line_no);
 	t->font = DEFAULT;
     }
+    /* without a display, e.g., in batch mode, keep length and ascent */
+    if (!tool_d)
+	return t;
     t->xftfont = getfont(psfont_text(t), t->font, t->size * display_zoomscale,
 			t->angle);
 
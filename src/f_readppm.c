@@ -62,232 +62,179 @@ skip_comments_whitespace(FILE *file)
 #define THREE_BYTEPERPIXEL	(tool_vclass != TrueColor || image_bpp != 4 \
 					|| appres.monochrome)
 
-static int
-read_8bitppm(FILE *file, unsigned char *restrict dst, unsigned int width,
-						unsigned int height)
+/*
+ * Return a table that scales the samples 0--len-1 to the range 0--255, such
+ * that maxval becomes 255. Samples larger than maxval become 255, too.
+ */
+static unsigned char *
+scale_table(unsigned maxval, size_t len)
 {
-	int		c[3];
-	unsigned int	w;
-
-	if (THREE_BYTEPERPIXEL) {
-		while (height-- > 0u) {
-			w = width;
-			while (w-- > 0u) {
-				if ((c[0] = fgetc(file)) == EOF ||
-						(c[1] = fgetc(file)) == EOF ||
-						(c[2] = fgetc(file)) == EOF)
-					return FileInvalid;
-				/* map_to_palette expects BGR triples */
-				*(dst++) = (unsigned char)c[2];
-				*(dst++) = (unsigned char)c[1];
-				*(dst++) = (unsigned char)c[0];
-			}
-		}
-		return PicSuccess;
-	}
+	size_t		i;
+	unsigned char	*table;
+	const uint32_t	rnd = maxval / 2;
 
-	while (height-- > 0u) {
-		w = width;
-		while (w-- > 0u) {
-			if ((c[0] = fgetc(file)) == EOF ||
-					(c[1] = fgetc(file)) == EOF ||
-					(c[2] = fgetc(file)) == EOF)
-				return FileInvalid;
-			*(CARD32 *)dst = ((CARD32)c[0] << 16) +
-					((CARD32)c[1] << 8) + (CARD32)c[2];
-			dst += sizeof(CARD32);
-		}
-	}
-	return PicSuccess;
+	if ((table = malloc(len)) == NULL)
+		return NULL;
+	for (i = 0; i < len; ++i)
+		table[i] = i > maxval ? 255u :
+				(unsigned char)((i * 255u + rnd) / maxval);
+	return table;
 }
 
-static void
-scale_to_255(unsigned char *restrict byte, unsigned maxval, unsigned rowbytes,
-		unsigned height)
+/*
+ * Store a row of rgb triples into dst, either as BGR triples, or as 32-bit
+ * pixels. Return the position after the row.
+ */
+static unsigned char *
+store_row(unsigned char *restrict dst, const unsigned char *restrict rgb,
+		unsigned int width)
 {
-	unsigned int	w;
-	const unsigned	rnd = maxval / 2;
-
-	/* This scales also the unused alpha channel for TrueColor visuals. One
-	   would have to check endian-ness, to avoid the unecessary scaling */
-	while (height-- > 0u) {
-		w = rowbytes;
-		while (w-- > 0u) {
-			*byte = (*byte * 255u + rnd) / maxval;
-			++byte;
+	if (THREE_BYTEPERPIXEL) {
+		/* map_to_palette expects BGR triples */
+		for (; width > 0u; --width, rgb += 3) {
+			*(dst++) = rgb[2];
+			*(dst++) = rgb[1];
+			*(dst++) = rgb[0];
 		}
+		return dst;
 	}
+
+	for (; width > 0u; --width, rgb += 3, dst += sizeof(CARD32))
+		*(CARD32 *)dst = ((CARD32)rgb[0] << 16) +
+				((CARD32)rgb[1] << 8) + (CARD32)rgb[2];
+	return dst;
 }
 
 /*
- * Read the next six bytes from file, which correspond to a rgb triplet with two
- * bytes for each channel, and return the values scaled into the range 0--255.
+ * Read a raw ppm file with one or, if maxval > 255, two bytes per sample.
+ * Each row is read at once, and scaled to the range 0--255 by a table.
  */
 static int
-read6bytes(FILE *file, unsigned maxval, unsigned *r, unsigned *g, unsigned *b)
-{
-	int		c[6];
-	const uint32_t	rnd = maxval / 2;
-
-	if ((c[0] = fgetc(file)) == EOF || (c[1] = fgetc(file)) == EOF ||
-		   (c[2] = fgetc(file)) == EOF || (c[3] = fgetc(file)) == EOF ||
-		   (c[4] = fgetc(file)) == EOF || (c[5] = fgetc(file)) == EOF)
-		return FileInvalid;
-
-	/* scale to the range 0 - 255 */
-	/* two-byte ppm files have the most significant byte first */
-	*r = ((((uint32_t)c[0] << 8) + c[1]) * 255u + rnd) / maxval;
-	*g = ((((uint32_t)c[2] << 8) + c[3]) * 255u + rnd) / maxval;
-	*b = ((((uint32_t)c[4] << 8) + c[5]) * 255u + rnd) / maxval;
-
-	if (*r > 255u)
-		*r = 255u;
-	if (*g > 255u)
-		*g = 255u;
-	if (*b > 255u)
-		*b = 255u;
-
-	return 0;
-}
-
-static int
-read_16bitppm(FILE *file, unsigned char *restrict dst, unsigned int maxval,
+read_rawppm(FILE *file, unsigned char *restrict dst, unsigned int maxval,
 		unsigned int width, unsigned int height)
 {
-	unsigned int	w;
-	unsigned int	r, g, b;
+	size_t		i;
+	size_t		samples = 3u * (size_t)width;
+	size_t		rowlen = maxval > 255u ? 2u * samples : samples;
+	unsigned char	*row;
+	unsigned char	*table = NULL;
 
-	if (THREE_BYTEPERPIXEL) {
-		while (height-- > 0u) {
-			w = width;
-			while (w-- > 0u) {
-				if (read6bytes(file, maxval, &r, &g, &b))
-					return FileInvalid;
-
-				/* map_to_palette expects BGR triples */
-				*(dst++) = (unsigned char)b;
-				*(dst++) = (unsigned char)g;
-				*(dst++) = (unsigned char)r;
-			}
-		}
-		return PicSuccess;
+	if ((row = malloc(rowlen)) == NULL)
+		return FileInvalid;
+	if (maxval != 255u && (table = scale_table(maxval,
+					maxval > 255u ? 65536u : 256u)) == NULL) {
+		free(row);
+		return FileInvalid;
 	}
 
 	while (height-- > 0u) {
-		w = width;
-		while (w-- > 0u) {
-			if (read6bytes(file, maxval, &r, &g, &b))
-				return FileInvalid;
-			*(CARD32 *)dst = ((CARD32)r << 16) + ((CARD32)g << 8) +
-						(CARD32)b;
-			dst += sizeof(CARD32);
+		if (fread(row, 1, rowlen, file) != rowlen) {
+			free(table);
+			free(row);
+			return FileInvalid;
+		}
+		if (rowlen != samples) {
+			/* two-byte ppm files have the most significant
+			   byte first */
+			for (i = 0; i < samples; ++i)
+				row[i] = table[row[2*i] << 8 | row[2*i + 1]];
+		} else if (table) {
+			for (i = 0; i < samples; ++i)
+				row[i] = table[row[i]];
 		}
+		dst = store_row(dst, row, width);
 	}
+
+	free(table);
+	free(row);
 	return PicSuccess;
 }
 
+/* a buffer to read the decimal numbers of an ascii ppm file */
+struct scanner {
+	FILE		*file;
+	size_t		pos;
+	size_t		len;
+	unsigned char	buf[BUFSIZ];
+};
+
 static int
-read_asciippm(FILE *file, unsigned char *restrict dst, unsigned int width,
-						unsigned int height)
+next_char(struct scanner *s)
 {
-	int		c[3];
-	unsigned int	w;
-
-	if (THREE_BYTEPERPIXEL) {
-		while (height-- > 0u) {
-			w = width;
-			while (w-- > 0u) {
-				if (fscanf(file, " %u %u %u", c, c+1, c+2) != 3)
-					return FileInvalid;
-
-				if (c[0] > 255) c[0] = 255;
-				if (c[1] > 255) c[1] = 255;
-				if (c[2] > 255) c[2] = 255;
-
-				/* map_to_palette expects BGR triples */
-				*(dst++) = (unsigned char)c[2];
-				*(dst++) = (unsigned char)c[1];
-				*(dst++) = (unsigned char)c[0];
-			}
-		}
-		return PicSuccess;
+	if (s->pos == s->len) {
+		s->pos = 0;
+		if ((s->len = fread(s->buf, 1, sizeof s->buf, s->file)) == 0)
+			return EOF;
 	}
+	return s->buf[s->pos++];
+}
 
-	/* four bytes per pixel */
-	while (height-- > 0u) {
-		w = width;
-		while (w-- > 0u) {
-			if (fscanf(file, " %u %u %u", c, c + 1, c + 2) != 3)
-				return FileInvalid;
-
-			if (c[0] > 255) c[0] = 255;
-			if (c[1] > 255) c[1] = 255;
-			if (c[2] > 255) c[2] = 255;
-
-			*(CARD32 *)dst = ((CARD32)c[0] << 16) +
-					((CARD32)c[1] << 8) + (CARD32)c[2];
-			dst += sizeof(CARD32);
-		}
-	}
-	return PicSuccess;
+/*
+ * Read the next decimal number, preceded by whitespace. Numbers larger than
+ * 65535 are returned as 65535. Return -1, if there is no number.
+ */
+static int
+read_sample(struct scanner *s)
+{
+	int	c;
+	int	value;
+
+	while ((c = next_char(s)) == ' ' || c == '\n' || c == '\r' ||
+			c == '\t' || c == '\f' || c == '\v')
+		;
+	if (c < '0' || c > '9')
+		return -1;
+	value = c - '0';
+	while ((c = next_char(s)) >= '0' && c <= '9')
+		if ((value = 10 * value + c - '0') > 65535)
+			value = 65535;
+	return value;
 }
 
 /*
  * Read a ppm file encoded with ascii decimal numbers, and scale to
- * the range 0--255. The function above, read_asciippm(), does not scale.
+ * the range 0--255.
  */
 static int
-read_ascii_max_ppm(FILE *file, unsigned char *restrict dst, unsigned int maxval,
+read_asciippm(FILE *file, unsigned char *restrict dst, unsigned int maxval,
 			unsigned int width, unsigned int height)
 {
-	int		c[3];
-	unsigned int	w;
-	const uint32_t	rnd = maxval / 2;
-
-	if (THREE_BYTEPERPIXEL) {
-		while (height-- > 0u) {
-			w = width;
-			while (w-- > 0u) {
-				if (fscanf(file, " %u %u %u", c, c+1, c+2) != 3)
-					return FileInvalid;
-
-				/* scale to the range 0--255 */
-				c[0] = ((uint32_t)c[0] * 255u + rnd) / maxval;
-				c[1] = ((uint32_t)c[1] * 255u + rnd) / maxval;
-				c[2] = ((uint32_t)c[2] * 255u + rnd) / maxval;
-				if (c[0] > 255) c[0] = 255;
-				if (c[1] > 255) c[1] = 255;
-				if (c[2] > 255) c[2] = 255;
-
-				/* map_to_palette expects BGR triples */
-				*(dst++) = (unsigned char)c[2];
-				*(dst++) = (unsigned char)c[1];
-				*(dst++) = (unsigned char)c[0];
-			}
-		}
-		return PicSuccess;
+	int		v;
+	size_t		i;
+	size_t		samples = 3u * (size_t)width;
+	unsigned char	*row;
+	unsigned char	*table;
+	struct scanner	*s;
+
+	if ((s = malloc(sizeof *s)) == NULL)
+		return FileInvalid;
+	s->file = file;
+	s->pos = s->len = 0;
+	row = malloc(samples);
+	table = scale_table(maxval, 65536u);
+	if (row == NULL || table == NULL) {
+		free(table);
+		free(row);
+		free(s);
+		return FileInvalid;
 	}
 
-	/* four bytes per pixel */
 	while (height-- > 0u) {
-		w = width;
-		while (w-- > 0u) {
-			if (fscanf(file, " %u %u %u", c, c + 1, c + 2) != 3)
+		for (i = 0; i < samples; ++i) {
+			if ((v = read_sample(s)) < 0) {
+				free(table);
+				free(row);
+				free(s);
 				return FileInvalid;
-
-			/* scale to the range 0--255 */
-			c[0] = ((uint32_t)c[0] * 255u + rnd) / maxval;
-			c[1] = ((uint32_t)c[1] * 255u + rnd) / maxval;
-			c[2] = ((uint32_t)c[2] * 255u + rnd) / maxval;
-			if (c[0] > 255) c[0] = 255;
-			if (c[1] > 255) c[1] = 255;
-			if (c[2] > 255) c[2] = 255;
-
-			*(CARD32 *)dst = ((CARD32)c[0] << 16) +
-					((CARD32)c[1] << 8) + (CARD32)c[2];
-			dst += sizeof(CARD32);
+			}
+			row[i] = table[v];
 		}
+		dst = store_row(dst, row, width);
 	}
+
+	free(table);
+	free(row);
+	free(s);
 	return PicSuccess;
 }
 
@@ -351,28 +298,14 @@ read_ppm(F_pic *pic, struct xfig_stream *restrict pic_stream)
 		if (appres.DEBUG)
 			fprintf(stderr, "Reading raw PPM file, %u x %u, max. "
 					"value %u.\n", width, height, maxval);
-		if (maxval < 256u) {
-			stat = read_8bitppm(pic_stream->fp,
-					pic->pic_cache->bitmap, width, height);
-			if (maxval != 255u)
-				scale_to_255(pic->pic_cache->bitmap, maxval,
-						rowbytes, height);
-		} else {
-			stat = read_16bitppm(pic_stream->fp,
-					pic->pic_cache->bitmap, maxval,
-					width, height);
-		}
+		stat = read_rawppm(pic_stream->fp, pic->pic_cache->bitmap,
+					maxval, width, height);
 	} else { /* magic == '3' */
 		if (appres.DEBUG)
 			fprintf(stderr, "Reading ascii PPM file, %u x %u, max. "
 					"value %u.\n", width, height, maxval);
-		if (maxval == 255u)
-			stat = read_asciippm(pic_stream->fp,
-					pic->pic_cache->bitmap, width, height);
-		else
-			stat = read_ascii_max_ppm(pic_stream->fp,
-					pic->pic_cache->bitmap, maxval,
-					width, height);
+		stat = read_asciippm(pic_stream->fp, pic->pic_cache->bitmap,
+					maxval, width, height);
 	}
 
 	if (stat != PicSuccess) {
@@ -33,6 +33,7 @@
 #include "f_picobj.h"		/* image_size() */
 #include "f_util.h"		/* map_to_palette(), map_to_mono() */
 #include "w_msgpanel.h"
+#include "w_setup.h"		/* CANVAS_WD, CANVAS_HT */
 
 
 static void
@@ -44,6 +45,76 @@ error_handler(const char *module, const char *fmt, va_list ap)
 	file_msg("%s: %s", module, buffer);
 }
 
+/*
+ * Read every reduction-th pixel of every reduction-th row of the w x h image
+ * in tif into bitmap, as ARGB words. Tiled images are read tile by tile,
+ * other images strip by strip. Tiles or strips that do not contain any of
+ * the rows or columns are skipped. Return 0 on failure.
+ */
+static int
+read_reduced(TIFF *tif, uint32_t w, uint32_t h, uint32_t reduction,
+		uint32_t *bitmap)
+{
+	uint32_t	tw, th;		/* size of a tile, or of a strip */
+	uint32_t	row, col;	/* the upper left corner of a tile */
+	uint32_t	rows, x, y, p;
+	uint32_t	ow = (w + reduction - 1) / reduction;
+	uint32_t	*raster;
+	int		tiled = TIFFIsTiled(tif);
+
+	if (tiled) {
+		if (TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tw) != 1 ||
+				TIFFGetField(tif, TIFFTAG_TILELENGTH, &th) != 1)
+			return 0;
+	} else {
+		tw = w;
+		if (TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &th) != 1)
+			return 0;
+		if (th > h)
+			th = h;
+	}
+	if (tw == 0 || th == 0)
+		return 0;
+	if ((raster = malloc((size_t)tw * th * sizeof *raster)) == NULL) {
+		file_msg("Out of memory");
+		return 0;
+	}
+
+	for (row = 0; row < h; row += th) {
+		/* the first row to read at or below row */
+		y = (row + reduction - 1) / reduction * reduction;
+		if (y >= row + th || y >= h)
+			continue;
+		rows = tiled ? th : (h - row < th ? h - row : th);
+		for (col = 0; col < w; col += tw) {
+			x = (col + reduction - 1) / reduction * reduction;
+			if (x >= col + tw || x >= w)
+				continue;
+			if (!(tiled ? TIFFReadRGBATile(tif, col, row, raster) :
+					TIFFReadRGBAStrip(tif, row, raster))) {
+				free(raster);
+				return 0;
+			}
+			/* the origin of the raster is at the lower left */
+			for (y = (row + reduction - 1) / reduction * reduction;
+					y < row + rows && y < h; y += reduction)
+				for (x = (col + reduction - 1) / reduction *
+						reduction;
+						x < col + tw && x < w;
+						x += reduction) {
+					p = raster[(rows - 1 - (y - row)) * tw +
+								x - col];
+					bitmap[y / reduction * ow + x / reduction] =
+						TIFFGetA(p) << 24 |
+						TIFFGetR(p) << 16 |
+						TIFFGetG(p) << 8 | TIFFGetB(p);
+				}
+		}
+	}
+	free(raster);
+	return 1;
+}
+
 /* return codes:  PicSuccess (1) : success
 		  FileInvalid (-2) : invalid file
 */
@@ -53,6 +124,8 @@ read_tif(F_pic *pic, struct xfig_stream *restrict pic_stream)
 	int		stat = FileInvalid;
 	uint16_t	unit;
 	uint32_t	w, h;
+	uint32_t	reduction = 1;
+	uint32_t	want_w, want_h;
 	float		res_x, res_y;
 	TIFF		*tif;
 
@@ -81,8 +154,27 @@ read_tif(F_pic *pic, struct xfig_stream *restrict pic_stream)
 		return stat;
 	}
 
+	/*
+	 * As a large jpeg image, see read_jpg(), read a large image at a
+	 * reduced size, by a power of two, as long as the bitmap covers the
+	 * size it is displayed at.
+	 */
+	if (tool_vclass == TrueColor && image_bpp == 4 && !appres.monochrome) {
+		want_w = pic->pic_cache->view_size.x > 0 ?
+			(uint32_t)pic->pic_cache->view_size.x :
+			(uint32_t)CANVAS_WD;
+		want_h = pic->pic_cache->view_size.y > 0 ?
+			(uint32_t)pic->pic_cache->view_size.y :
+			(uint32_t)CANVAS_HT;
+		while (w / (2 * reduction) >= want_w &&
+				h / (2 * reduction) >= want_h)
+			reduction *= 2;
+	}
+
 	/* allocate memory for image data */
-	if ((pic->pic_cache->bitmap = malloc(w * h * sizeof w)) == NULL) {
+	if ((pic->pic_cache->bitmap = malloc((size_t)((w + reduction - 1) /
+				reduction) * ((h + reduction - 1) / reduction) *
+				sizeof w)) == NULL) {
 		file_msg("Out of memory");
 		TIFFClose(tif);
 		return stat;
@@ -104,7 +196,7 @@ read_tif(F_pic *pic, struct xfig_stream *restrict pic_stream)
 	pic->pic_cache->bit_size.y = (int)h;	/* map_to_palette() below */
 	pic->hw_ratio = (float)h / w;
 	image_size(&pic->pic_cache->size_x, &pic->pic_cache->size_y,
-			pic->pic_cache->bit_size.x, pic->pic_cache->bit_size.y,
+			(int)w, (int)h,
 			unit == 2u ? 'i': (unit == 3u ? 'c': 'u'), res_x,res_y);
 
 	if (appres.DEBUG)
@@ -114,6 +206,25 @@ read_tif(F_pic *pic, struct xfig_stream *restrict pic_stream)
 				unit == 2u ? " pixel per inch" :
 					(unit == 3u ? " pixel per cm" : "" ));
 
+	if (reduction > 1) {
+		stat = read_reduced(tif, w, h, reduction,
+					(uint32_t *)pic->pic_cache->bitmap);
+		TIFFClose(tif);
+		if (stat == 0) {
+			free(pic->pic_cache->bitmap);
+			pic->pic_cache->bitmap = NULL;
+			return FileInvalid;
+		}
+		pic->pic_cache->bit_size.x = (int)((w + reduction - 1) /
+								reduction);
+		pic->pic_cache->bit_size.y = (int)((h + reduction - 1) /
+								reduction);
+		pic->pic_cache->reduction = (int)reduction;
+		/* indicate, that this is a TrueColor pixmap */
+		pic->pic_cache->numcols = -1;
+		return PicSuccess;
+	}
+
 	/* read the image */
 	stat = TIFFReadRGBAImageOriented(tif, w, h,
 					(uint32_t *)pic->pic_cache->bitmap,
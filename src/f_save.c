@@ -22,10 +22,16 @@
 #include "f_save.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <locale.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <X11/Intrinsic.h>     /* includes X11/Xlib.h, which includes X11/X.h */
 
 #include "resources.h"
@@ -40,18 +46,46 @@
 #include "u_bound.h"
 #include "u_colors.h"
 #include "u_convert.h"
+#include "u_journal.h"
+#include "u_print.h"
 #include "w_export.h"
+#include "w_file.h"		/* renamefile() */
 #include "w_msgpanel.h"
 #include "w_setup.h"
 
 static int	write_tmpfile = 0;
 static char	save_cur_dir[PATH_MAX];
 
+/* state of a save running in the background, see write_file_async() */
+static struct async_save {
+	pid_t		pid;
+	int		fd;
+	XtInputId	id;
+	Boolean		update_recent;
+	char		*file_name;
+} async_save = { -1, -1, 0, False, NULL };
+
+/* while writing a binary figure, the points and shape factors go here */
+static FILE	*figb_points = NULL;
+static FILE	*figb_sfactors = NULL;
+
+/* sent by the child process through the pipe async_save.fd */
+struct async_status {
+	int	err;
+	int	num_object;
+};
+
 static void	write_arrows(FILE *fp, F_arrow *f, F_arrow *b);
 static void	write_comments (FILE *fp, char *com);
 static void	write_colordefs (FILE *fp);
 static int	write_objects(FILE *fp);
-static int	write_objects_close(FILE *fp);
+static int	write_objects_figb(FILE *fp);
+static int	write_figure(FILE *fp, char *file_name);
+static int	write_objects_close(FILE *fp, char *file_name);
+static int	write_tmpfile_rename(char *file_name, mode_t mode,
+			Boolean backup);
+static void	async_save_done(XtPointer client_data, int *fd, XtInputId *id);
+static void	finish_async_save(void);
 
 
 void
@@ -82,6 +116,15 @@ write_fd(int fd)
 		file_msg("Cannot create stream: %s", strerror(errno));
 		return -1;
 	}
+	return write_stream(fp);
+}
+
+/*
+ * Write the figure to fp, for fig2dev. The stream is flushed, but not closed.
+ */
+int
+write_stream(FILE *fp)
+{
 	num_object = 0;
 	/* write_objects() inserts picture paths relative to cur_file_dir */
 	return write_objects(fp);
@@ -101,7 +144,7 @@ int write_file(char *file_name, Boolean update_recent)
 		return (-1);
 	}
 	num_object = 0;
-	if (write_objects_close(fp)) {
+	if (write_objects_close(fp, file_name)) {
 		file_msg("Error writing file %s, %s",
 				file_name, strerror(errno));
 		beep();
@@ -118,6 +161,279 @@ int write_file(char *file_name, Boolean update_recent)
 	return (0);
 }
 
+/*
+ * Save the figure in the foreground. If backup is True, an existing file_name
+ * is first renamed to file_name.bak, and the new file gets the permissions,
+ * owner and group of the renamed one.
+ */
+int
+write_file_bak(char *file_name, Boolean update_recent, Boolean backup)
+{
+	int		ret;
+	Boolean		exists;
+	struct stat	st;
+
+	exists = backup && stat(file_name, &st) == 0;
+	if (backup)
+		(void)renamefile(file_name);
+	if ((ret = write_file(file_name, update_recent)) == 0 && exists) {
+		/* only the owner or root may change the owner and group */
+		if (chown(file_name, st.st_uid, st.st_gid))
+			(void)chown(file_name, (uid_t)-1, st.st_gid);
+		(void)chmod(file_name, st.st_mode & (S_IRWXU|S_IRWXG|S_IRWXO));
+	}
+	return ret;
+}
+
+/*
+ * Save the figure in the background. A child process is forked, which
+ * inherits a copy-on-write snapshot of the figure. The child writes the
+ * figure to a temporary file in the directory of file_name and atomically
+ * renames it to file_name. If backup is True, the file that is replaced is
+ * kept as file_name.bak. Editing continues meanwhile. When the child
+ * finishes, async_save_done() reports the result in the message panel.
+ * If the process cannot be forked, save in the foreground.
+ * Return 0 if the save was started, -1 otherwise.
+ */
+int
+write_file_async(char *file_name, Boolean update_recent, Boolean backup)
+{
+	int	pd[2];
+	mode_t	mask;
+
+	if (!ok_to_write(file_name, "SAVE"))
+		return (-1);
+
+	/* the saves must complete in the order in which they were requested */
+	wait_async_save();
+
+	if (pipe(pd)) {
+		file_msg("Cannot create pipe, saving in the foreground: %s",
+				strerror(errno));
+		return write_file_bak(file_name, update_recent, backup);
+	}
+	/* the permissions of a file created by fopen() */
+	mask = umask(0);
+	(void)umask(mask);
+
+	async_save.pid = fork();
+	if (async_save.pid == -1) {
+		file_msg("Cannot fork, saving in the foreground: %s",
+				strerror(errno));
+		close(pd[0]);
+		close(pd[1]);
+		return write_file_bak(file_name, update_recent, backup);
+	}
+
+	if (async_save.pid == 0) {
+		/* the child, must not talk to the X server */
+		struct async_status	status;
+
+		close(pd[0]);
+		close_export_pipes();
+		update_figs = True;	/* any message goes to stderr */
+		num_object = 0;
+		status.err = write_tmpfile_rename(file_name,
+				(S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP |
+				 S_IROTH | S_IWOTH) & ~mask, backup);
+		status.num_object = num_object;
+		(void)write(pd[1], &status, sizeof status);
+		_exit(status.err ? 1 : 0);
+	}
+
+	/* the parent */
+	close(pd[1]);
+	async_save.fd = pd[0];
+	async_save.update_recent = update_recent;
+	async_save.file_name = strdup(file_name);
+	async_save.id = XtAppAddInput(tool_app, pd[0],
+			(XtPointer)XtInputReadMask, async_save_done, NULL);
+	put_msg("Saving \"%s\" in the background . . .", file_name);
+	return (0);
+}
+
+/*
+ * Block until a save running in the background is finished.
+ */
+void
+wait_async_save(void)
+{
+	if (async_save.pid == -1)
+		return;
+	XtRemoveInput(async_save.id);
+	finish_async_save();
+}
+
+/*
+ * Return True, if a save is running in the background.
+ */
+Boolean
+async_save_pending(void)
+{
+	return async_save.pid != -1;
+}
+
+/*
+ * Keep a copy of file as file.bak, a hard link if possible.
+ * Return 0 on success.
+ */
+static int
+backup_file(const char *file)
+{
+	int		in, out;
+	int		err = 0;
+	ssize_t		n;
+	char		bak_name[PATH_MAX + 4];
+	char		buf[8192];
+	struct stat	st;
+
+	sprintf(bak_name, "%s.bak", file);
+	(void)unlink(bak_name);
+	if (link(file, bak_name) == 0)
+		return 0;
+
+	/* e.g., the file system does not support hard links */
+	if ((in = open(file, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(in, &st) || (out = open(bak_name, O_WRONLY | O_CREAT |
+				O_EXCL, st.st_mode & (S_IRWXU|S_IRWXG|S_IRWXO)))
+			== -1) {
+		close(in);
+		return -1;
+	}
+	while ((n = read(in, buf, sizeof buf)) != 0) {
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 || write(out, buf, n) != n) {
+			err = -1;
+			break;
+		}
+	}
+	close(in);
+	if (close(out) || err) {
+		(void)unlink(bak_name);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Write the figure to a temporary file next to file_name, flush it to disk and
+ * rename it to file_name. If file_name exists, the temporary file gets its
+ * permissions, owner and group, otherwise mode, and if backup is True,
+ * file_name is kept as file_name.bak before it is replaced. Called in the
+ * child process forked by write_file_async(). Return 0 on success, an errno
+ * on failure.
+ */
+static int
+write_tmpfile_rename(char *file_name, mode_t mode, Boolean backup)
+{
+	int		fd;
+	int		err;
+	Boolean		exists;
+	char		target[PATH_MAX];
+	char		tmp_name[PATH_MAX + 8];
+	struct stat	st;
+	FILE		*fp;
+
+	/* do not replace a symbolic link, but the file it points to */
+	if (!realpath(file_name, target)) {
+		if (strlen(file_name) >= sizeof target)
+			return ENAMETOOLONG;
+		strcpy(target, file_name);
+	}
+	sprintf(tmp_name, "%s.XXXXXX", target);
+	if ((fd = mkstemp(tmp_name)) == -1)
+		return errno;
+	if ((exists = stat(target, &st) == 0)) {
+		/* keep the owner and group of the file that is replaced, as
+		   far as allowed; only the owner or root may change them */
+		mode = st.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO);
+		if (fchown(fd, st.st_uid, st.st_gid))
+			(void)fchown(fd, (uid_t)-1, st.st_gid);
+	}
+	if (fchmod(fd, mode) || !(fp = fdopen(fd, "wb"))) {
+		err = errno;
+		close(fd);
+		unlink(tmp_name);
+		return err;
+	}
+
+	if (write_figure(fp, file_name) || ferror(fp) || fsync(fileno(fp))) {
+		err = errno ? errno : EIO;
+		fclose(fp);
+		unlink(tmp_name);
+		return err;
+	}
+	if (fclose(fp) == EOF) {
+		err = errno;
+		unlink(tmp_name);
+		return err;
+	}
+	/* the figure is completely on disk, now replace the old file */
+	if (backup && exists && backup_file(target))
+		file_msg("Cannot make a backup of %s: %s", target,
+				strerror(errno));
+	if (rename(tmp_name, target)) {
+		err = errno;
+		unlink(tmp_name);
+		return err;
+	}
+	return 0;
+}
+
+/* called by XtAppAddInput, when the child process closes the pipe */
+static void
+async_save_done(XtPointer client_data, int *fd, XtInputId *id)
+{
+	(void)client_data;
+	(void)fd;
+
+	XtRemoveInput(*id);
+	finish_async_save();
+}
+
+/*
+ * Read the result of the save from the child process, reap the child and
+ * report success or failure.
+ */
+static void
+finish_async_save(void)
+{
+	struct async_status	status;
+	ssize_t			n;
+
+	while ((n = read(async_save.fd, &status, sizeof status)) == -1 &&
+			errno == EINTR)
+		;
+	if (n != sizeof status) {
+		status.err = n == -1 ? errno : EPIPE;
+		status.num_object = 0;
+	}
+	close(async_save.fd);
+	(void)waitpid(async_save.pid, NULL, 0);
+	async_save.fd = -1;
+	async_save.pid = -1;
+
+	if (status.err) {
+		file_msg("Error writing file %s, %s", async_save.file_name,
+				strerror(status.err));
+		beep();
+		/* the figure on disk is not current */
+		set_modifiedflag();
+	} else {
+		put_msg("%d object(s) saved in \"%s\"", status.num_object,
+				async_save.file_name);
+		if (async_save.update_recent)
+			update_recent_list(async_save.file_name);
+		/* the journal is obsolete, unless edited in the meantime */
+		if (!figure_modified)
+			journal_reset();
+	}
+	free(async_save.file_name);
+	async_save.file_name = NULL;
+}
+
 
 /* for fig2dev */
 
@@ -179,10 +495,95 @@ write_objects(FILE *fp)
 	}
 }
 
+/*
+ * Write a binary figure, see doc/FORMAT3.2B. The text written by
+ * write_objects() goes into the TEXT section, except for the points and shape
+ * factors, which write_line() and write_spline() put into the PNTS and SFAC
+ * sections.
+ */
+static void
+put_le32(FILE *fp, uint32_t u)
+{
+	putc(u & 0xff, fp);
+	putc(u >> 8 & 0xff, fp);
+	putc(u >> 16 & 0xff, fp);
+	putc(u >> 24 & 0xff, fp);
+}
+
+static void
+put_le64(FILE *fp, uint64_t u)
+{
+	put_le32(fp, (uint32_t)(u & 0xffffffff));
+	put_le32(fp, (uint32_t)(u >> 32));
+}
+
+static void
+put_section(FILE *fp, const char *tag, const char *data, size_t len)
+{
+	static const char	pad[8] = "";
+
+	fwrite(tag, 1, 4, fp);
+	put_le32(fp, 0);
+	put_le64(fp, (uint64_t)len);
+	fwrite(data, 1, len, fp);
+	fwrite(pad, 1, (8 - len % 8) % 8, fp);
+}
+
 static int
-write_objects_close(FILE *fp)
+write_objects_figb(FILE *fp)
 {
-	if (write_objects(fp) || ferror(fp)) {
+	int	err;
+	char	*text = NULL, *points = NULL, *sfactors = NULL;
+	size_t	text_len, points_len, sfactors_len;
+	FILE	*tp;
+
+	tp = open_memstream(&text, &text_len);
+	figb_points = open_memstream(&points, &points_len);
+	figb_sfactors = open_memstream(&sfactors, &sfactors_len);
+	if (!tp || !figb_points || !figb_sfactors)
+		err = errno;
+	else
+		err = write_objects(tp);
+	if ((tp && fclose(tp)) || (figb_points && fclose(figb_points)) ||
+			(figb_sfactors && fclose(figb_sfactors)))
+		err = err ? err : errno;
+	figb_points = figb_sfactors = NULL;
+
+	if (!err) {
+		fwrite(FIGB_MAGIC, 1, 8, fp);
+		put_le32(fp, FIGB_VERSION);
+		put_le32(fp, 0);		/* flags */
+		put_section(fp, "TEXT", text, text_len);
+		put_section(fp, "PNTS", points, points_len);
+		put_section(fp, "SFAC", sfactors, sfactors_len);
+		if (fflush(fp) == EOF)
+			err = errno;
+	}
+	if (err)
+		file_msg("Error writing binary figure: %s", strerror(err));
+	free(text);
+	free(points);
+	free(sfactors);
+	return err;
+}
+
+/* write the binary format, if file_name ends with FIGB_SUFFIX */
+static int
+write_figure(FILE *fp, char *file_name)
+{
+	size_t	len = strlen(file_name);
+	size_t	slen = sizeof FIGB_SUFFIX - 1;
+
+	if (!appres.write_v40 && len > slen &&
+			!strcmp(file_name + len - slen, FIGB_SUFFIX))
+		return write_objects_figb(fp);
+	return write_objects(fp);
+}
+
+static int
+write_objects_close(FILE *fp, char *file_name)
+{
+	if (write_figure(fp, file_name) || ferror(fp)) {
 		fclose(fp);
 		return (-1);
 	}
@@ -503,6 +904,14 @@ write_line(FILE *fp, F_line *l)
 				free(utf8_name);
 		}
 
+		if (figb_points) {
+			/* binary figure, see write_objects_figb() */
+			for (p = l->points; p != NULL; p = p->next) {
+				put_le32(figb_points, (uint32_t)p->x);
+				put_le32(figb_points, (uint32_t)p->y);
+			}
+			return;
+		}
 		fprintf(fp, "\t");
 		npts=0;
 		for (p = l->points; p != NULL; p = p->next) {
@@ -539,6 +948,20 @@ write_spline(FILE *fp, F_spline *s)
 			s->for_arrow ? 1 : 0, s->back_arrow ? 1 : 0, npts);
 	/* write any arrowheads */
 	write_arrows(fp, s->for_arrow, s->back_arrow);
+	if (figb_points) {
+		/* binary figure, see write_objects_figb() */
+		uint64_t	u;
+
+		for (p = s->points; p != NULL; p = p->next) {
+			put_le32(figb_points, (uint32_t)p->x);
+			put_le32(figb_points, (uint32_t)p->y);
+		}
+		for (cp = s->sfactors; cp != NULL; cp = cp->next) {
+			memcpy(&u, &cp->s, sizeof u);
+			put_le64(figb_sfactors, u);
+		}
+		return;
+	}
 	fprintf(fp, "\t");
 	npts=0;
 	for (p = s->points; p != NULL; p = p->next) {
@@ -652,7 +1075,7 @@ emergency_save(char *file_name)
 	/* first close any open compounds */
 	close_all_compounds();
 	num_object = 0;
-	if (write_objects_close(fp))
+	if (write_objects_close(fp, file_name))
 		return (-1);
 	if (file_name[0] != '/') {
 		(void)fprintf(stderr, "xfig: %d object(s) saved in \"%s/%s\"\n",
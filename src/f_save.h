@@ -34,6 +34,13 @@ extern void	write_text(FILE *fp, F_text *t);
 extern void	write_fig_header(FILE *fp);
 extern int	write_file(char *file_name, Boolean update_recent);
 extern int	write_fd(int fd);
+extern int	write_stream(FILE *fp);
+extern int	write_file_bak(char *file_name, Boolean update_recent,
+			Boolean backup);
+extern int	write_file_async(char *file_name, Boolean update_recent,
+			Boolean backup);
+extern void	wait_async_save(void);
+extern Boolean	async_save_pending(void);
 extern void	end_write_tmpfile(void);
 extern void	init_write_tmpfile(void);
 
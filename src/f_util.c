@@ -22,6 +22,7 @@
 #include "f_util.h"
 
 #include <errno.h>
+#include <signal.h>		/* signal(), SIGPIPE */
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -43,6 +44,8 @@
 #include "u_colors.h"
 #include "u_create.h"		/* new_string() */
 #include "u_fonts.h"		/* psfontnum() */
+#include "u_free.h"		/* free_objects() */
+#include "u_print.h"		/* print_export() */
 #include "w_file.h"		/* renamefile() */
 #include "w_color.h"		/* YStoreColors(), alloc_color_cells() */
 #include "w_cursor.h"
@@ -58,6 +61,7 @@ XftColor	image_cells[MAX_COLORMAP_SIZE];
 
 static int	count_colors(void);
 static int	count_pixels(void);
+static int	count_new_colors(void);
 
 
 /* PROCEDURES */
@@ -68,7 +72,10 @@ static void add_all_pixels (void);
 static void remap_image_colormap (void);
 static void extract_cmap (void);
 static void readjust_cmap (void);
-static void free_pixmaps (F_compound *obj);
+static void truecolor_cmap (void);
+static void free_pixmaps (F_compound *obj, struct _pics *pics);
+static Boolean add_imagecolors (int newcolors);
+static void mark_imagecolors (void);
 static void add_recent_file (char *file);
 static int strain_out (char *name);
 static void finish_update_xfigrc (void);
@@ -233,22 +240,35 @@ xf_basename(char *filename)
 
 static int	  scol, ncolors;
 static int	  num_oldcolors = -1;
+static int	  used_cells = 0;	/* image_cells used by the pictures */
 static Boolean	  usenet;
 static int	  npixels;
 
 #define REMAP_MSG	"Remapping picture colors..."
 #define REMAP_MSG2	"Remapping picture colors...Done"
 
-/* remap the colors for all the pictures in the picture repository */
+/*
+ * Remap the colors for all the pictures in the picture repository.
+ * Only the colors of pictures read since the last call are allocated, if
+ * they fit into the remaining color cells. Otherwise, the colors of all
+ * pictures are allocated again, possibly using the neural net.
+ */
 
 void remap_imagecolors(void)
 {
     int		    i;
+    int		    newcolors;
 
     /* if monochrome, return */
     if (tool_cells <= 2 || appres.monochrome)
 	return;
 
+    /* on a TrueColor visual, the pixel values follow from the colors */
+    if (tool_vclass == TrueColor) {
+	truecolor_cmap();
+	return;
+    }
+
     npixels = 0;
 
     /* first see if there are enough colorcells for all image colors */
@@ -259,6 +279,15 @@ void remap_imagecolors(void)
     if (ncolors == 0)
 	return;
 
+    /* nothing to do, e.g., if pictures were only removed */
+    newcolors = count_new_colors();
+    if (newcolors == 0)
+	return;
+
+    /* only allocate the colors of the new pictures, if possible */
+    if (add_imagecolors(newcolors))
+	return;
+
     put_msg(REMAP_MSG);
     set_temp_cursor(wait_cursor);
     app_flush();
@@ -357,6 +386,7 @@ void remap_imagecolors(void)
 
 	/* get the new, mapped indices for the image colormap */
 	remap_image_colormap();
+	used_cells = avail_image_cols;
     } else {
 	/*
 	 * Extract the RGB values from the image's colormap and allocate
@@ -370,12 +400,71 @@ void remap_imagecolors(void)
 	readjust_cmap();
 	if (appres.DEBUG)
 	    fprintf(stderr,"Able to use %d colors without neural net\n",scol);
+	used_cells = scol;
 	reset_cursor();
     }
+    mark_imagecolors();
     put_msg(REMAP_MSG2);
     app_flush();
 }
 
+/*
+ * Allocate the colors of the pictures that were not yet mapped in the
+ * color cells following the cells in use. First take the cells that are
+ * allocated but unused, e.g., because the neural net found fewer colors
+ * than cells, then allocate more. Return False, if there are not enough
+ * color cells left.
+ */
+
+static Boolean
+add_imagecolors(int newcolors)
+{
+    struct _pics   *pics;
+    int		    i, n;
+
+    if (num_oldcolors < used_cells ||
+		used_cells + newcolors > appres.max_image_colors ||
+		used_cells + newcolors > MAX_COLORMAP_SIZE)
+	return False;
+
+    /* num_oldcolors keeps track of the cells to free */
+    for (; num_oldcolors < used_cells + newcolors; ++num_oldcolors)
+	if (!alloc_color_cells(&image_cells[num_oldcolors].pixel, 1))
+	    return False;
+
+    n = used_cells;
+    for (pics = pictures; pics; pics = pics->next)
+	if (pics->bitmap != NULL && pics->numcols > 0 && !pics->cmap_mapped) {
+	    for (i = 0; i < pics->numcols; i++) {
+		image_cells[n + i].color.red   = pics->cmap[i].red << 8;
+		image_cells[n + i].color.green = pics->cmap[i].green << 8;
+		image_cells[n + i].color.blue  = pics->cmap[i].blue << 8;
+	    }
+	    alloc_or_store_colors(image_cells + n, pics->numcols);
+	    for (i = 0; i < pics->numcols; i++, n++)
+		pics->cmap[i].pixel = image_cells[n].pixel;
+	    pics->cmap_mapped = 1;
+	    /* the pixmaps of a picture read again are stale */
+	    free_pixmaps(&objects, pics);
+	}
+    used_cells = avail_image_cols = n;
+    if (appres.DEBUG)
+	fprintf(stderr,"Added %d colors for pictures\n",newcolors);
+    return True;
+}
+
+/* note that the colors of all pictures are mapped */
+
+static void
+mark_imagecolors(void)
+{
+    struct _pics   *pics;
+
+    for (pics = pictures; pics; pics = pics->next)
+	if (pics->bitmap != NULL && pics->numcols > 0)
+	    pics->cmap_mapped = 1;
+}
+
 /* allocate the color cells for the pictures */
 
 void alloc_imagecolors(int num)
@@ -406,6 +495,21 @@ count_colors(void)
 	return ncolors;
 }
 
+/* count the colors of the pictures whose colors are not yet mapped */
+
+static int
+count_new_colors(void)
+{
+	int		ncolors = 0;
+	struct _pics	*pics;
+
+	for (pics = pictures; pics; pics = pics->next)
+		if (pics->bitmap != NULL && pics->numcols > 0 &&
+				!pics->cmap_mapped)
+			ncolors += pics->numcols;
+	return ncolors;
+}
+
 int
 count_pixels(void)
 {
@@ -436,22 +540,26 @@ readjust_cmap(void)
 
 	/* now free up all pixmaps in picture objects */
 	/* start with main list */
-	free_pixmaps(&objects);
+	free_pixmaps(&objects, NULL);
 }
 
+/* free the pixmaps of the pictures with a colormap, or only those of pics */
+
 void
-free_pixmaps(F_compound *obj)
+free_pixmaps(F_compound *obj, struct _pics *pics)
 {
 	F_line		*l;
 	F_compound	*c;
 
 	/* traverse the compounds in this compound */
 	for (c = obj->compounds; c != NULL; c = c->next) {
-		free_pixmaps(c);
+		free_pixmaps(c, pics);
 	}
 	for (l = obj->lines; l != NULL; l = l->next) {
 		if (l->type != T_PICTURE)
 			continue;
+		if (pics != NULL && l->pic->pic_cache != pics)
+			continue;
 		if (l->pic->pixmap != (Pixmap)0 &&
 					l->pic->pic_cache->numcols > 0) {
 			XFreePixmap(tool_d, l->pic->pixmap);
@@ -464,6 +572,58 @@ free_pixmaps(F_compound *obj)
 	}
 }
 
+/*
+ * Return the value of the 8-bit color component c, shifted into mask.
+ */
+static unsigned long
+color_bits(unsigned short c, unsigned long mask)
+{
+	int	shift = 0;
+	int	bits = 0;
+
+	if (mask == 0)
+		return 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		++shift;
+	}
+	while (mask & 1) {
+		mask >>= 1;
+		++bits;
+	}
+	if (bits < 8)
+		c >>= 8 - bits;
+	else
+		c <<= bits - 8;
+	return (unsigned long)c << shift;
+}
+
+/*
+ * Compute the pixel values of the colormaps in the repository from the
+ * colors, for a TrueColor visual. No color cells need to be allocated,
+ * and the pixmaps already made stay valid.
+ */
+static void
+truecolor_cmap(void)
+{
+	struct _pics	*pics;
+	int		i;
+
+	for (pics = pictures; pics; pics = pics->next)
+		if (pics->bitmap != NULL && pics->numcols > 0 &&
+				!pics->cmap_mapped) {
+			pics->cmap_mapped = 1;
+			for (i = 0; i < pics->numcols; ++i)
+				pics->cmap[i].pixel =
+				    color_bits(pics->cmap[i].red,
+						tool_v->red_mask) |
+				    color_bits(pics->cmap[i].green,
+						tool_v->green_mask) |
+				    color_bits(pics->cmap[i].blue,
+						tool_v->blue_mask);
+		}
+}
+
 void
 extract_cmap(void)
 {
@@ -482,7 +642,7 @@ extract_cmap(void)
 	    }
 	}
     /* now free up the pixmaps */
-    free_pixmaps(&objects);
+    free_pixmaps(&objects, NULL);
 }
 
 void add_all_pixels(void)
@@ -528,7 +688,7 @@ void remap_image_colormap(void)
 		pics->cmap[i].pixel = image_cells[p].pixel;
 	    }
 	}
-    free_pixmaps(&objects);
+    free_pixmaps(&objects, NULL);
 }
 
 /* map the bytes in pic->pic_cache->bitmap to bits for monochrome display */
@@ -665,7 +825,9 @@ void map_to_mono(F_pic *pic)
 
 void beep(void)
 {
-	XBell(tool_d,0);
+	/* without a display, e.g., in batch mode, do nothing */
+	if (tool_d)
+		XBell(tool_d,0);
 }
 
 /* this routine will safely copy overlapping strings */
@@ -969,6 +1131,9 @@ void init_settings(void)
    and write them back (renaming the original to xxxx.fig.bak) so that they
    are updated to the current version.
    If the file is already in the current version it is untouched.
+   With -figb (-fig) on the command line, each file is instead converted to
+   the binary (text) format and written with the suffix .figb (.fig),
+   see doc/FORMAT3.2B.
 */
 
 int
@@ -976,6 +1141,9 @@ update_fig_files(int argc, char **argv)
 {
     fig_settings    settings;
     char	    file[PATH_MAX];
+    char	    out[PATH_MAX];
+    char	    *suffix = NULL;
+    char	    *dot;
     int		    i,col;
     Boolean	    status;
     int		    allstat;
@@ -983,6 +1151,13 @@ update_fig_files(int argc, char **argv)
     /* overall status - if any one file can't be read, return status is 1 */
     allstat = 0;
 
+    for (i=1; i<argc; i++) {
+	if (strcmp(argv[i], "-figb") == 0)
+	    suffix = FIGB_SUFFIX;
+	else if (strcmp(argv[i], "-fig") == 0)
+	    suffix = ".fig";
+    }
+
     for (i=1; i<argc; i++) {
 	/* skip any other options the user may have given */
 	if (argv[i][0] == '-') {
@@ -1013,10 +1188,26 @@ update_fig_files(int argc, char **argv)
 	if (status != 0) {
 	    fprintf(stderr," *** Error in reading, not updating this file\n");
 	    allstat = 1;
+	} else if (suffix) {
+	    /* replace the suffix .fig or .figb, or append suffix */
+	    strcpy(out, file);
+	    if ((dot = strrchr(out, '.')) && !strchr(dot, '/') &&
+		    (strcmp(dot, ".fig") == 0 || strcmp(dot, FIGB_SUFFIX) == 0))
+		*dot = '\0';
+	    if (strlen(out) + strlen(suffix) >= sizeof out) {
+		fprintf(stderr," *** File name too long\n");
+		allstat = 1;
+		continue;
+	    }
+	    strcat(out, suffix);
+	    fprintf(stderr,"Ok. Converting to %s. ",out);
 	} else {
+	    strcpy(out, file);
 	    fprintf(stderr,"Ok. Renamed to %s.bak. ",file);
 	    /* now rename original file to file.bak */
 	    renamefile(file);
+	}
+	if (status == 0) {
 	    fprintf(stderr,"Writing as protocol %s ... ",PROTOCOL_VERSION);
 	    /* first update the settings from appres */
 	    appres.landscape = settings.landscape;
@@ -1035,13 +1226,198 @@ update_fig_files(int argc, char **argv)
 	    }
 	    /* now write out the new one */
 	    num_usr_cols = MAX_USR_COLS;
-	    write_file(file, False);
+	    if (write_file(out, False))
+		allstat = 1;
 	    fprintf(stderr,"Ok\n");
 	}
     }
     return allstat;
 }
 
+/* Return the export language named name, e.g., "pdf", or -1. */
+static int
+export_lang(const char *restrict name)
+{
+	int	i;
+
+	for (i = 0; i < NUM_EXP_LANG; ++i)
+		if (!strcasecmp(name, lang_items[i]))
+			return i;
+	if (!strcasecmp(name, "jpg"))
+		return LANG_JPEG;
+	if (!strcasecmp(name, "tif"))
+		return LANG_TIFF;
+	return -1;
+}
+
+/* Write name, relative to dir, into path. Return 0 on success. */
+static int
+absolute_path(char path[restrict PATH_MAX], const char *restrict name,
+		const char *restrict dir)
+{
+	int	n;
+
+	if (*name == '/')
+		n = snprintf(path, PATH_MAX, "%s", name);
+	else
+		n = snprintf(path, PATH_MAX, "%s/%s", dir, name);
+	return n < 0 || n >= PATH_MAX;
+}
+
+/*
+ * Export a list of Fig files without a display. The list is read from the
+ * file given on the command line, or from standard input. Each line gives
+ * a Fig file, the output file and, optionally, the output language, e.g.,
+ *	drawing.fig drawing.pdf
+ *	drawing.fig drawing.tex pdftex
+ * Otherwise, the language is taken from the suffix of the output file.
+ * Empty lines and lines starting with # are ignored. The settings of each
+ * figure, e.g., paper size and magnification, are used for its export.
+ * With -jobs n, at most n exports run concurrently. By default, as many as
+ * processors are online.
+ * Return 0, if all files were exported.
+ */
+int
+export_fig_files(int argc, char **argv)
+{
+	int		i, col;
+	int		lang;
+	int		total = 0;
+	int		jobs = 0;
+	Boolean		cache = True;
+	char		*fig, *out, *name, *slash;
+	char		line[2 * PATH_MAX + 32];
+	char		start_dir[PATH_MAX];
+	char		file[PATH_MAX];
+	char		outfile[PATH_MAX];
+	FILE		*list = stdin;
+	fig_settings	settings;
+	struct timespec	start, end;
+
+	for (i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "-jobs") == 0 && i + 1 < argc) {
+			jobs = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-noexportcache") == 0) {
+			cache = False;
+		} else if (strcasecmp(argv[i], "-scale_factor") == 0) {
+			++i;		/* evaluated in main() */
+		} else if (strcmp(argv[i], "-") != 0 &&
+				!(list = fopen(argv[i], "r"))) {
+			fprintf(stderr, "Cannot open %s: %s\n", argv[i],
+					strerror(errno));
+			return 1;
+		}
+	}
+	if (jobs <= 0 && (jobs = (int)sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+		jobs = 1;
+	max_exports = jobs;
+
+	/* if fig2dev exits before reading the whole figure, let write() fail
+	   with EPIPE, main() ignores SIGPIPE only later, with a display */
+	(void) signal(SIGPIPE, SIG_IGN);
+
+	/* the exports are watched by XtAppAddInput(), no display is needed */
+	tool_app = XtCreateApplicationContext();
+	strcpy(start_dir, cur_file_dir);
+	warnexist = False;
+	appres.jpeg_quality = DEF_JPEG_QUALITY;
+	appres.export_margin = DEF_EXPORT_MARGIN;
+	appres.export_cache = cache;
+	appres.picture_cache_size = DEF_PICTURE_CACHE_SIZE;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (fgets(line, sizeof line, list)) {
+		if (!(fig = strtok(line, " \t\r\n")) || *fig == '#')
+			continue;
+		++total;
+		if (!(out = strtok(NULL, " \t\r\n"))) {
+			fprintf(stderr, "%s: No output file given\n", fig);
+			continue;
+		}
+		if (!(name = strtok(NULL, " \t\r\n"))) {
+			name = strrchr(out, '.');
+			name = name && !strchr(name, '/') ? name + 1 : "";
+		}
+		if ((lang = export_lang(name)) == -1) {
+			fprintf(stderr, "%s: Unknown export language \"%s\"\n",
+					out, name);
+			continue;
+		}
+		if (absolute_path(file, fig, start_dir) ||
+				absolute_path(outfile, out, start_dir)) {
+			fprintf(stderr, "%s: File name too long\n", fig);
+			continue;
+		}
+
+		/* picture paths are relative to the directory of the figure,
+		   and fig2dev runs there */
+		slash = strrchr(file, '/');
+		*slash = '\0';
+		strcpy(cur_file_dir, slash == file ? "/" : file);
+		*slash = '/';
+		strcpy(cur_export_dir, cur_file_dir);
+		if (change_directory(cur_file_dir))
+			continue;
+
+		/* as in update_fig_files() */
+		for (col = 0; col < MAX_USR_COLS; col++)
+			n_colorFree[col] = True;
+		display_zoomscale = 1.0f;
+		appres.landscape = True;
+		appres.flushleft = False;
+		appres.INCHES = True;
+		appres.papersize = 0;
+		appres.magnification = 100.0f;
+		appres.multiple = False;
+		appres.transparent = -2;
+
+		if (read_fig(file, &objects, DONT_MERGE, 0, 0, &settings)) {
+			fprintf(stderr, "%s: Error in reading, not exported\n",
+					file);
+			continue;
+		}
+		appres.landscape = settings.landscape;
+		appres.flushleft = settings.flushleft;
+		appres.INCHES = settings.units;
+		appres.papersize = settings.papersize;
+		appres.magnification = settings.magnification;
+		appres.multiple = settings.multiple;
+		appres.transparent = settings.transparent;
+		for (col = 0; col < MAX_USR_COLS; col++) {
+			colorUsed[col] = !n_colorFree[col];
+			user_color[col].color.red = n_user_colors[col].color.red;
+			user_color[col].color.green =
+						n_user_colors[col].color.green;
+			user_color[col].color.blue =
+						n_user_colors[col].color.blue;
+		}
+		num_usr_cols = MAX_USR_COLS;
+
+		/* print_export() writes the figure into memory and queues
+		   the fig2dev processes */
+		cur_exp_lang = lang;
+		strcpy(cur_filename, file);
+		print_export(outfile, 0, 0, "", NULL, False,
+				appres.export_margin, "", NULL);
+		free_objects();
+
+		/* do not read further figures than can be exported */
+		while (exports_pending() >= max_exports)
+			XtAppProcessEvent(tool_app, XtIMAlternateInput);
+	}
+	if (list != stdin)
+		fclose(list);
+	wait_exports(0);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fprintf(stderr, "%d of %d figures exported in %.2f s, with up to %d "
+			"concurrent exports\n", num_exports_done, total,
+			(double)(end.tv_sec - start.tv_sec) +
+				(end.tv_nsec - start.tv_nsec) / 1e9,
+			max_exports);
+	return num_exports_done != total;
+}
+
 /* replace all "%f" in "program" with value in filename */
 
 char *
@@ -53,5 +53,6 @@ extern void	remap_imagecolors(void);
 extern void	update_recent_files(void);
 extern void	update_xfigrc(char *name, char *string);
 extern int	update_fig_files(int argc, char **argv);
+extern int	export_fig_files(int argc, char **argv);
 
 #endif
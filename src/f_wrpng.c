@@ -16,12 +16,64 @@
  *
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_STRINGS_H
+#include <strings.h>
+#endif
 #include <X11/Intrinsic.h>	/* Boolean */
 #include <png.h>
 
-#include "resources.h"		/* IMAGE_PALETTE */
+#include "resources.h"		/* IMAGE_PALETTE, appres */
+
+/* the png row filters, by the names of the png_filter resource */
+static const struct {
+    const char	*name;
+    int		filters;
+} filters[] = {
+    { "none",	PNG_FILTER_NONE },
+    { "sub",	PNG_FILTER_SUB },
+    { "up",	PNG_FILTER_UP },
+    { "average",	PNG_FILTER_AVG },
+    { "paeth",	PNG_FILTER_PAETH },
+    { "all",	PNG_ALL_FILTERS }
+};
+
+/*
+ * Return True, if name is a value of the png_filter resource.
+ */
+Boolean
+valid_png_filter(const char *name)
+{
+    size_t	i;
+
+    for (i = 0; i < sizeof filters / sizeof filters[0]; ++i)
+	if (strcasecmp(name, filters[i].name) == 0)
+	    return True;
+    return False;
+}
+
+/*
+ * Return the png row filters named by the png_filter resource. The default,
+ * "all", lets libpng choose a filter for each row, which compresses best but
+ * is slowest.
+ */
+static int
+png_filters(const char *name)
+{
+    size_t	i;
+
+    if (name)
+	for (i = 0; i < sizeof filters / sizeof filters[0]; ++i)
+	    if (strcasecmp(name, filters[i].name) == 0)
+		return filters[i].filters;
+    return PNG_ALL_FILTERS;
+}
 
 /*
  * Write PNG file from rgb data
@@ -35,6 +87,9 @@
  * Red, Green, Blue - colormap values for IMAGE_PALETTE type
  * numcols - number of colors for IMAGE_PALETTE type
  * width, height of image
+ *
+ * The compression level and the row filters of rgb data are taken from the
+ * png_compression and png_filter resources.
  */
 
 Boolean
@@ -81,8 +136,11 @@ write_png(FILE *file, unsigned char *data, int type, unsigned char *Red, unsigne
 	bytes_per_pixel = 3;
     }
 
-    /* set best compression */
-    png_set_compression_level(png_ptr, 6);
+    /* lower levels compress faster */
+    png_set_compression_level(png_ptr, appres.png_compression);
+    if (type != IMAGE_PALETTE)
+	png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE,
+			png_filters(appres.png_filter));
 
     /* write the header info */
     png_set_IHDR(png_ptr, info_ptr, width, height, bit_depth, color_type,
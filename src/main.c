@@ -32,6 +32,9 @@
 #endif
 #include <unistd.h>
 #include <sys/types.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 
 #include <X11/IntrinsicP.h>
 #include <X11/Shell.h>
@@ -63,6 +66,7 @@
 #include "f_util.h"
 #include "u_colors.h"
 #include "u_error.h"
+#include "u_journal.h"
 #include "u_redraw.h"
 #include "u_undo.h"
 #include "w_canvas.h"
@@ -92,6 +96,10 @@
 #include "w_zoom.h"
 #include "xfig_math.h"
 
+#ifdef HAVE_PNG
+extern Boolean valid_png_filter(const char *name);
+#endif
+
 
 /* EXPORTS */
 
@@ -115,6 +123,8 @@ static void	parse_canvas_colors(void);
 static void	set_xpm_icon(void);
 static void	resize_canvas(void);
 static void	check_refresh(XtPointer client_data, XtIntervalId *id);
+static void	watch_figure(void);
+static void	unwatch_figure(void);
 
 /************** FIG options ******************/
 
@@ -308,6 +318,11 @@ static XtResource application_resources[] = {
       XtOffset(appresPtr, spellcheckcommand), XtRString, (caddr_t) "spell %f"},
     {"jpeg_quality", "Quality", XtRInt, sizeof(int),
       XtOffset(appresPtr, jpeg_quality), XtRImmediate, (caddr_t) 0},
+    {"png_compression", "Compression", XtRInt, sizeof(int),
+      XtOffset(appresPtr, png_compression), XtRImmediate,
+      (caddr_t) DEF_PNG_COMPRESSION},
+    {"png_filter", "Filter", XtRString, sizeof(char *),
+      XtOffset(appresPtr, png_filter), XtRString, (caddr_t) "all"},
     {"transparent", "Transparent", XtRInt, sizeof(int),
       XtOffset(appresPtr, transparent), XtRImmediate, (caddr_t) TRANSP_NONE },
     {"library_dir", "Directory", XtRString, sizeof(char *),
@@ -360,6 +375,23 @@ static XtResource application_resources[] = {
       XtOffset(appresPtr, autorefresh), XtRBoolean, (caddr_t) & false},
     {"write_bak", "Refresh",   XtRBoolean, sizeof(Boolean),
       XtOffset(appresPtr, write_bak), XtRBoolean, (caddr_t) & true},
+    {"async_save", "Refresh",   XtRBoolean, sizeof(Boolean),
+      XtOffset(appresPtr, async_save), XtRBoolean, (caddr_t) & true},
+    {"journal", "Refresh",   XtRBoolean, sizeof(Boolean),
+      XtOffset(appresPtr, journal), XtRBoolean, (caddr_t) & true},
+    {"exportcache", "ExportCache", XtRBoolean, sizeof(Boolean),
+      XtOffset(appresPtr, export_cache), XtRBoolean, (caddr_t) & true},
+    {"gifpipe", "GifPipe", XtRBoolean, sizeof(Boolean),
+      XtOffset(appresPtr, gif_pipe), XtRBoolean, (caddr_t) & false},
+    {"picturecachesize", "PictureCacheSize", XtRInt, sizeof(int),
+      XtOffset(appresPtr, picture_cache_size), XtRImmediate,
+      (caddr_t) DEF_PICTURE_CACHE_SIZE},
+    {"picturememory", "PictureMemory", XtRInt, sizeof(int),
+      XtOffset(appresPtr, picture_memory), XtRImmediate, (caddr_t) 0},
+    {"deferpictures", "DeferPictures", XtRBoolean, sizeof(Boolean),
+      XtOffset(appresPtr, defer_pictures), XtRBoolean, (caddr_t) & false},
+    {"deduppictures", "DedupPictures", XtRBoolean, sizeof(Boolean),
+      XtOffset(appresPtr, dedup_pictures), XtRBoolean, (caddr_t) & false},
     {"international", "International", XtRBoolean, sizeof(Boolean),
        XtOffset(appresPtr, international), XtRBoolean, (caddr_t) & true},
     {"fontMenulanguage", "Language", XtRString, sizeof(char *),
@@ -385,6 +417,7 @@ static XrmOptionDescRec options[] =
 	{"-depth", "*depth", XrmoptionSepArg, NULL},
 
 	{"-allownegcoords", ".allownegcoords", XrmoptionNoArg, "True"},
+	{"-async_save", ".async_save", XrmoptionNoArg, "True"},
 	{"-autorefresh", ".autorefresh", XrmoptionNoArg, "True"},
 	{"-balloon_delay", ".balloon_delay", XrmoptionSepArg, 0},
 	{"-buttonFont", ".buttonFont", XrmoptionSepArg, 0},
@@ -396,6 +429,8 @@ static XrmOptionDescRec options[] =
 	{"-correct_font_size", ".correct_font_size", XrmoptionNoArg, "True"},
 	{"-crosshair", ".crosshair", XrmoptionNoArg, "True"},
 	{"-debug", ".debug", XrmoptionNoArg, "True"},
+	{"-deduppictures", ".deduppictures", XrmoptionNoArg, "True"},
+	{"-deferpictures", ".deferpictures", XrmoptionNoArg, "True"},
 	{"-dontallownegcoords", ".allownegcoords", XrmoptionNoArg, "False"},
 	{"-dontshowaxislines", ".showaxislines", XrmoptionNoArg, "False"},
 	{"-dontshowballoons", ".showballoons", XrmoptionNoArg, "False"},
@@ -404,6 +439,7 @@ static XrmOptionDescRec options[] =
 	{"-dontshowpageborder", ".showpageborder", XrmoptionNoArg, "False"},
 	{"-dontswitchcmap", ".dontswitchcmap", XrmoptionNoArg, "True"},
 	{"-encoding", ".encoding", XrmoptionSepArg, 0},
+	{"-exportcache", ".exportcache", XrmoptionNoArg, "True"},
 	{"-exportLanguage", ".exportLanguage", XrmoptionSepArg, 0},
 	{"-export_margin", ".export_margin", XrmoptionSepArg, 0},
 	{"-flipvisualhints", ".flipvisualhints", XrmoptionNoArg, "True"},
@@ -411,6 +447,8 @@ static XrmOptionDescRec options[] =
 	{"-flushleft", ".flushleft", XrmoptionNoArg, "True"},
 	{"-freehand_resolution", ".freehand_resolution", XrmoptionSepArg, 0},
 	{"-ghostscript", ".ghostscript", XrmoptionSepArg, GSEXE},
+	{"-gifpipe", ".gifpipe", XrmoptionNoArg, "True"},
+	{"-nogifpipe", ".gifpipe", XrmoptionNoArg, "False"},
 	{"-grid_color", ".grid_color", XrmoptionSepArg, "lightblue"},
 	{"-grid_unit", ".grid_unit", XrmoptionSepArg, "default"},
 	{"-hiddentext", ".hiddentext", XrmoptionNoArg, "True"},
@@ -422,6 +460,7 @@ static XrmOptionDescRec options[] =
 	{"-inches", ".inches", XrmoptionNoArg, "True"},
 	{"-installowncmap", ".installowncmap", XrmoptionNoArg, "True"},
 	{"-internalBW", ".internalborderwidth", XrmoptionSepArg, 0},
+	{"-journal", ".journal", XrmoptionNoArg, "True"},
 	{"-jpeg_quality", ".jpeg_quality", XrmoptionSepArg, 0},
 	{"-keyFile", ".keyFile", XrmoptionSepArg, 0},
 	{"-Landscape", ".landscape", XrmoptionNoArg, "True"},
@@ -441,10 +480,19 @@ static XrmOptionDescRec options[] =
 	{"-nosplash", ".splash", XrmoptionNoArg, "False"},
 	{"-notrack", ".trackCursor", XrmoptionNoArg, "False"},
 	{"-nowrite_bak", ".write_bak", XrmoptionNoArg, "False"},
+	{"-noasync_save", ".async_save", XrmoptionNoArg, "False"},
+	{"-nodeduppictures", ".deduppictures", XrmoptionNoArg, "False"},
+	{"-nodeferpictures", ".deferpictures", XrmoptionNoArg, "False"},
+	{"-noexportcache", ".exportcache", XrmoptionNoArg, "False"},
+	{"-nojournal", ".journal", XrmoptionNoArg, "False"},
 	{"-overlap", ".overlap", XrmoptionNoArg, "True"},
 	{"-pageborder", ".pageborder", XrmoptionSepArg, (caddr_t) NULL},
 	{"-paper_size", ".paper_size", XrmoptionSepArg, (caddr_t) NULL},
 	{"-pheight", ".pheight", XrmoptionSepArg, 0},
+	{"-picturecachesize", ".picturecachesize", XrmoptionSepArg, 0},
+	{"-picturememory", ".picturememory", XrmoptionSepArg, 0},
+	{"-png_compression", ".png_compression", XrmoptionSepArg, 0},
+	{"-png_filter", ".png_filter", XrmoptionSepArg, 0},
 	{"-Portrait", ".landscape", XrmoptionNoArg, "False"},
 	{"-portrait", ".landscape", XrmoptionNoArg, "False"},
 	{"-pwidth", ".pwidth", XrmoptionSepArg, 0},
@@ -497,9 +545,11 @@ static XrmOptionDescRec options[] =
 
 static char *help_list[] = {
 	"[-allownegcoords] ",
+	"[-async_save] ",
 	"[-autorefresh] ",
 	"[-axislines <color>] ",
 	"[-balloon_delay <delay>] ",
+	"[-batch [-jobs <number>] [-noexportcache] [file]] ",
 	"[-but_per_row <number>] ",
 	"[-buttonFont <font>] ",
 	"[-cbg <color>] ",
@@ -508,6 +558,8 @@ static char *help_list[] = {
 	"[-centimeters] ",
 	"[-correct_font_size] ",
 	"[-debug] ",
+	"[-deduppictures] ",
+	"[-deferpictures] ",
 	"[-depth <visual_depth>] ",
 	"[-dontallownegcoords] ",
 	"[-dontshowaxislines] ",
@@ -517,6 +569,7 @@ static char *help_list[] = {
 	"[-dontshownums] ",
 	"[-dontswitchcmap] ",
 	"[-encoding <ISO-8859 encoding>] ",
+	"[-exportcache] ",
 	"[-exportLanguage <language>] ",
 	"[-export_margin <pixels>] ",
 	"[-flipvisualhints] ",
@@ -524,6 +577,7 @@ static char *help_list[] = {
 	"[-freehand_resolution <Fig_units>] ",
 	"[-geometry] ",
 	"[-ghostscript <gsname>] ",
+	"[-gifpipe] ",
 	"[-grid_color <grid_color>] ",
 	"[-grid_unit <grid_unit>] ",
 	"[-gslib <gslibrary name>] ",
@@ -536,6 +590,7 @@ static char *help_list[] = {
 	"[-inches] ",
 	"[-installowncmap] ",
 	"[-internalBW <width>] ",
+	"[-journal] ",
 	"[-jpeg_quality <quality>] ",
 	"[-keyFile <file>] ",
 	"[-landscape] ",
@@ -553,10 +608,20 @@ static char *help_list[] = {
 	"[-nosplash] ",
 	"[-notrack] ",
 	"[-nowrite_bak] ",
+	"[-noasync_save] ",
+	"[-nodeduppictures] ",
+	"[-nodeferpictures] ",
+	"[-noexportcache] ",
+	"[-nogifpipe] ",
+	"[-nojournal] ",
 	"[-overlap] ",
 	"[-pageborder <color>] ",
 	"[-paper_size <size>] ",
 	"[-pheight <height>] ",
+	"[-picturecachesize <megabytes>] ",
+	"[-picturememory <megabytes>] ",
+	"[-png_compression <level>] ",
+	"[-png_filter <filter>] ",
 	"[-portrait] ",
 	"[-pwidth <width>] ",
 	"[-right] ",
@@ -688,7 +753,22 @@ main(int argc, char **argv)
 	if (scale_factor <= 0.0)
 		scale_factor = 1.0;
 
-	if (argc > 1 && (strcasecmp(argv[1], "-update") == 0)) {
+	/* get FIG2DEV_DIR environment variable (if any is set) for the path to
+	   fig2dev, in case the user wants one not in the normal search path */
+	if ((fig2dev_path = getenv("FIG2DEV_DIR")) == NULL)
+		strcpy(fig2dev_cmd, "fig2dev");
+	else
+		sprintf(fig2dev_cmd, "%s/fig2dev", fig2dev_path);
+
+	if (argc > 1 && (strcasecmp(argv[1], "-batch") == 0)) {
+
+		/* export without a display, messages go to stderr */
+		update_figs = True;
+		setlocale(LC_CTYPE, "");
+		get_directory(cur_file_dir);
+		exit(export_fig_files(argc, argv));
+
+	} else if (argc > 1 && (strcasecmp(argv[1], "-update") == 0)) {
 
 		update_figs = True;
 
@@ -813,13 +893,6 @@ main(int argc, char **argv)
 	screen_wd = WidthOfScreen(XtScreen(tool));
 	screen_ht = HeightOfScreen(XtScreen(tool));
 
-	/* get FIG2DEV_DIR environment variable (if any is set) for the path to
-	   fig2dev, in case the user wants one not in the normal search path */
-	if ((fig2dev_path = getenv("FIG2DEV_DIR")) == NULL)
-		strcpy(fig2dev_cmd, "fig2dev");
-	else
-		sprintf(fig2dev_cmd, "%s/fig2dev", fig2dev_path);
-
 	/* install actions to get to the functions with accelerators */
 	XtAppAddActions(tool_app, main_actions, XtNumber(main_actions));
 
@@ -1377,6 +1450,9 @@ main(int argc, char **argv)
 	if (strlen(cur_filename))
 		load_file(cur_filename, 0, 0);
 
+	/* recover figures of crashed sessions from their journals */
+	journal_recover();
+
 	/* reset the cursor */
 	reset_cursor();
 
@@ -1791,6 +1867,18 @@ check_resource_ranges(void)
 	/* set jpeg quality to user selection (if any) and fix any bad value */
 	if (appres.jpeg_quality <= 0 || appres.jpeg_quality > 100)
 		appres.jpeg_quality = DEF_JPEG_QUALITY;
+
+	/* zlib knows the levels 0 to 9 */
+	if (appres.png_compression < 0 || appres.png_compression > 9)
+		appres.png_compression = DEF_PNG_COMPRESSION;
+
+#ifdef HAVE_PNG
+	if (appres.png_filter && !valid_png_filter(appres.png_filter)) {
+		fprintf(stderr, "png_filter must be none, sub, up, average, "
+				"paeth or all - setting to all\n");
+		appres.png_filter = "all";
+	}
+#endif
 }
 
 /* set the icon geometry */
@@ -2024,6 +2112,7 @@ get_pointer_mapping(void)
 }
 
 static XtIntervalId	refresh_timeout_id = 0;
+static XtIntervalId	reload_timeout_id = 0;
 static Widget		refresh_indicator = (Widget)NULL;
 static Dimension	refresh_w = 0;
 static Dimension	msg_w = 0;
@@ -2041,6 +2130,8 @@ set_autorefresh(void)
 
 	/* get the initial timestamp */
 	figure_timestamp = file_timestamp(cur_filename);
+	/* get notified of changes immediately, if possible */
+	watch_figure();
 	refresh_timeout_id = XtAppAddTimeOut(tool_app, CHECK_REFRESH_TIME,
 			(XtTimerCallbackProc) check_refresh, (XtPointer) NULL);
 	XtUnmanageChild(msg_panel);
@@ -2079,6 +2170,7 @@ cancel_autorefresh(void)
 
 	XtRemoveTimeOut(refresh_timeout_id);
 	refresh_timeout_id = 0;
+	unwatch_figure();
 	put_msg("Autorefresh mode OFF");
 	XtUnmanageChild(msg_panel);
 	XtUnmanageChild(refresh_indicator);
@@ -2102,8 +2194,134 @@ toggle_refresh_mode(void)
 	refresh_view_menu();
 }
 
-/* check if the file timestamp has changed since last displayed
-   and redisplay it */
+#ifdef HAVE_SYS_INOTIFY_H
+static int		notify_fd = -1;
+static int		notify_wd = -1;
+static XtInputId	notify_id;
+static char		notify_dir[PATH_MAX];
+#endif
+
+/* Reload the figure, called by XtAppAddTimeOut */
+
+static void
+reload_figure(XtPointer client_data, XtIntervalId *id)
+{
+	(void)client_data;
+	(void)id;
+
+	reload_timeout_id = 0;
+	figure_timestamp = file_timestamp(cur_filename);
+	(void)reload_file(cur_filename);
+}
+
+/* Reload the figure after a short delay, to coalesce a burst of writes */
+
+static void
+schedule_reload(void)
+{
+	if (reload_timeout_id == 0)
+		reload_timeout_id = XtAppAddTimeOut(tool_app, RELOAD_DELAY,
+				(XtTimerCallbackProc)reload_figure,
+				(XtPointer)NULL);
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/* Called by XtAppAddInput, if the directory of the figure changed */
+
+static void
+figure_changed(XtPointer client_data, int *fd, XtInputId *id)
+{
+	char		buf[4096]
+			__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	char		*p;
+	char		*name;
+	ssize_t		n;
+	struct inotify_event	*ev;
+
+	(void)client_data;
+	(void)id;
+
+	if ((name = strrchr(cur_filename, '/')))
+		++name;
+	else
+		name = cur_filename;
+
+	while ((n = read(*fd, buf, sizeof buf)) > 0) {
+		for (p = buf; p < buf + n; p += sizeof *ev + ev->len) {
+			ev = (struct inotify_event *)p;
+			if (ev->mask & IN_Q_OVERFLOW ||
+					(ev->len > 0 && *name &&
+					 !strcmp(ev->name, name)))
+				schedule_reload();
+		}
+	}
+}
+#endif
+
+/*
+ * Watch the directory of the current figure, not the file, because a program
+ * that re-creates a file often writes a new file and renames it. Do nothing,
+ * if the directory is already watched.
+ */
+
+static void
+watch_figure(void)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	char	dir[PATH_MAX];
+	char	*p;
+
+	if (notify_fd == -1) {
+		if ((notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+			return;
+		notify_id = XtAppAddInput(tool_app, notify_fd,
+				(XtPointer)XtInputReadMask, figure_changed,
+				NULL);
+	}
+
+	if (cur_filename[0] == '/') {
+		strcpy(dir, cur_filename);
+	} else {
+		get_directory(dir);
+		if (strlen(dir) + strlen(cur_filename) + 2 > sizeof dir)
+			return;
+		strcat(dir, "/");
+		strcat(dir, cur_filename);
+	}
+	p = strrchr(dir, '/');
+	*(p == dir ? p + 1 : p) = '\0';
+
+	if (notify_wd != -1) {
+		if (!strcmp(dir, notify_dir))
+			return;
+		inotify_rm_watch(notify_fd, notify_wd);
+	}
+	notify_wd = inotify_add_watch(notify_fd, dir, IN_CLOSE_WRITE |
+			IN_MOVED_TO);
+	strcpy(notify_dir, dir);
+#endif
+}
+
+static void
+unwatch_figure(void)
+{
+	if (reload_timeout_id) {
+		XtRemoveTimeOut(reload_timeout_id);
+		reload_timeout_id = 0;
+	}
+#ifdef HAVE_SYS_INOTIFY_H
+	if (notify_fd != -1) {
+		XtRemoveInput(notify_id);
+		close(notify_fd);
+		notify_fd = -1;
+		notify_wd = -1;
+	}
+#endif
+}
+
+/* Check if the file timestamp has changed since last displayed
+   and redisplay it. If the directory is watched, only follow changes of
+   the name of the current figure. */
 /* This is called by XtAppAddTimeOut */
 
 static void
@@ -2113,14 +2331,20 @@ check_refresh(XtPointer client_data, XtIntervalId *id)
 	(void)id;
 	time_t	    cur_timestamp;
 
-	/* get current timestamp and reload if newer */
-	cur_timestamp = file_timestamp(cur_filename);
-	if (cur_timestamp > figure_timestamp)
-		load_file(cur_filename, 0, 0);
-	figure_timestamp = cur_timestamp;
+	watch_figure();
+#ifdef HAVE_SYS_INOTIFY_H
+	if (notify_wd == -1) {
+#endif
+		/* get current timestamp and reload if newer */
+		cur_timestamp = file_timestamp(cur_filename);
+		if (cur_timestamp > figure_timestamp)
+			schedule_reload();
+		figure_timestamp = cur_timestamp;
+#ifdef HAVE_SYS_INOTIFY_H
+	}
+#endif
 
 	/* keep being called */
-	(void) XtAppAddTimeOut(tool_app, CHECK_REFRESH_TIME,
+	refresh_timeout_id = XtAppAddTimeOut(tool_app, CHECK_REFRESH_TIME,
 			(XtTimerCallbackProc)check_refresh, (XtPointer)NULL);
-	return;
 }
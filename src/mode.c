@@ -26,6 +26,7 @@
 #include "resources.h"
 #include "object.h"
 #include "u_fonts.h"
+#include "u_journal.h"
 #include "w_indpanel.h"
 #include "w_msgpanel.h"
 #include "w_setup.h"
@@ -268,12 +269,14 @@ void
 reset_modifiedflag(void)
 {
 	figure_modified = 0;
+	journal_reset();
 }
 
 void
 set_modifiedflag(void)
 {
 	figure_modified = 1;
+	journal_modified();
 }
 
 void
@@ -19,6 +19,7 @@
 #ifndef OBJECT_H
 #define OBJECT_H
 
+#include <stdint.h>
 #include <sys/types.h>
 #include <X11/Intrinsic.h>     /* includes X11/Xlib.h, which includes X11/X.h */
 #include <X11/Xft/Xft.h>
@@ -87,6 +88,11 @@ enum pictypes {
 
 #define NUM_PIC_TYPES LAST_PIC-1
 
+/* values of the deferred member of struct _pics */
+#define PIC_DEFERRED	1
+#define PIC_VISIBLE	2
+#define PIC_LOADING	3
+
 /* structure to contain a point */
 typedef struct f_pos {
 	int x, y;
@@ -101,9 +107,29 @@ struct _pics {
 	F_pos bit_size;		/* size of bitmap in pixels */
 	struct Cmap cmap[MAX_COLORMAP_SIZE];	/* for GIF/XPM/JPEG files */
 	int numcols;		/* number of colors in cmap */
+	int cmap_mapped;	/* the pixel values in cmap are allocated,
+				   see remap_imagecolors() */
 	int transp;		/* transparent color
 				   (TRANSP_NONE if none) for GIFs */
 	int refcount;		/* number of references to picture */
+	size_t mapped;		/* if the bitmap is mapped from the disk cache,
+				   the length of the mapping, otherwise 0 */
+	int reduction;		/* the bitmap is decoded at 1/reduction of the
+				   size of the image, e.g., for a large jpeg */
+	F_pos view_size;	/* the largest size, in pixels, the picture
+				   must be displayed at, or 0 if unknown */
+	int deferred;		/* PIC_DEFERRED, if the file is only read
+				   when the picture is first drawn,
+				   PIC_VISIBLE, if it waits to be read,
+				   PIC_LOADING, if a child process reads it */
+	F_pos area_min, area_max;	/* the region to redraw, after a
+					   deferred picture was read */
+	uint64_t content;	/* identifies the content of the file, or 0 */
+	struct _pics *same;	/* the entry of an identical file, whose
+				   bitmap this entry shares, or NULL */
+	unsigned long last_drawn;	/* when the picture was last drawn */
+	struct _pics *name_next;	/* the hash chains, see f_picobj.c */
+	struct _pics *content_next;
 	struct _pics *prev;
 	struct _pics *next;
 };
@@ -222,7 +248,11 @@ typedef struct f_pic {
 	int pix_rotation,
 	    pix_width,		/* current width of pixmap (pixels) */
 	    pix_height,		/* current height of pixmap (pixels) */
-	    pix_flipped;
+	    pix_flipped,
+	    pix_bit_width,	/* width of the bitmap the pixmap was made of */
+	    pix_x, pix_y,	/* position of the pixmap in the picture */
+	    pix_w, pix_h;	/* size of the pixmap, only a part of a
+				   picture much larger than the canvas */
 } F_pic;
 
 extern char EMPTY_PIC[];
@@ -104,12 +104,19 @@
 /* for JPEG export */
 #define	DEF_JPEG_QUALITY	75
 
+/* for screen captures, written as png */
+#define	DEF_PNG_COMPRESSION	6
+
 /* default border margin for export */
 #define DEF_EXPORT_MARGIN	0
 
+/* default size of the disk cache, megabytes */
+#define DEF_PICTURE_CACHE_SIZE	256
+
 /* how often to check for external file change, milliseconds (-autorefresh) */
 
 #define CHECK_REFRESH_TIME	1000
+#define RELOAD_DELAY		50	/* coalesce writes to the figure file, ms */
 
 /* for screen capture */
 
@@ -169,6 +176,8 @@ typedef struct _appres {
     Boolean	 INCHES;
     int		 internalborderwidth;
     int		 jpeg_quality;		/* jpeg image quality */
+    int		 png_compression;	/* zlib level of screen captures */
+    char	*png_filter;		/* png row filters of screen captures */
     char	*keyFile;
     Boolean	 landscape;
     Boolean	 latexfonts;
@@ -236,6 +245,15 @@ typedef struct _appres {
     Boolean	 crosshair;		/* draw crosshair cursor wherever the pointer is */
     Boolean	 autorefresh;		/* automatically redraw figure when file has changed */
     Boolean	 write_bak;		/* automatically rename current to .bak when saving */
+    Boolean	 async_save;		/* save in the background, continue editing */
+    Boolean	 journal;		/* journal edits, to recover from a crash */
+    Boolean	 export_cache;		/* do not export again unchanged figures */
+    int		 picture_cache_size;	/* megabytes of decoded pictures kept on disk */
+    int		 picture_memory;	/* megabytes of decoded pictures kept in memory */
+    Boolean	 defer_pictures;	/* read picture files when first drawn */
+    Boolean	 dedup_pictures;	/* share pictures of identical files */
+    Boolean	 gif_pipe;		/* convert gifs the built-in decoder
+					   rejects with external programs */
 
     Boolean	 international;
     String	 font_menu_language;
@@ -0,0 +1,362 @@
+/*
+ * FIG : Facility for Interactive Generation of figures
+ * Copyright (c) 1985-1988 by Supoj Sutanthavibul
+ * Parts Copyright (c) 1989-2015 by Brian V. Smith
+ * Parts Copyright (c) 1991 by Paul King
+ * Parts Copyright (c) 2016-2024 by Thomas Loimer
+ *
+ * Any party obtaining a copy of these files is granted, free of charge, a
+ * full and unrestricted irrevocable, world-wide, paid up, royalty-free,
+ * nonexclusive right and license to deal in this software and documentation
+ * files (the "Software"), including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense and/or sell copies of
+ * the Software, and to permit persons who receive copies from any such
+ * party to do so, with the only requirement being that the above copyright
+ * and this permission notice remain intact.
+ *
+ */
+
+/*
+ * A cache of derived data on disk, e.g., of bitmaps rendered by ghostscript.
+ * The cache is kept below $XDG_CACHE_HOME/xfig, or ~/.cache/xfig, in a
+ * subdirectory for each kind of data. Each entry is a file named by its
+ * 64-bit key, in hexadecimal. Entries are written to a temporary file and
+ * renamed, hence a reader never sees an incomplete entry. If the cache
+ * directory can not be created, nothing is cached.
+ * The modification time of an entry is updated when it is used. If the
+ * cache grows beyond appres.picture_cache_size megabytes, the least recently
+ * used entries are removed. A size of zero disables the cache.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "u_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>		/* PRIx64 */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "resources.h"		/* appres.DEBUG */
+
+#define	FNV_PRIME	UINT64_C(1099511628211)
+
+/*
+ * Hash len bytes of data into hash, using the FNV-1a algorithm.
+ * Start with hash = CACHE_HASH_INIT.
+ */
+uint64_t
+cache_hash(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char	*c = data;
+	const unsigned char	*end = c + len;
+
+	while (c < end) {
+		hash ^= *c++;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+/*
+ * Hash the contents of file and its size into *hash. Copies of a file hash
+ * to the same value. Return 0 on success, -1 if the file can not be read.
+ */
+int
+cache_hash_file(const char *restrict file, uint64_t *hash)
+{
+	size_t		n;
+	uint64_t	h = CACHE_HASH_INIT;
+	unsigned char	buf[BUFSIZ];
+	struct stat	st;
+	FILE		*fp;
+
+	if (!(fp = fopen(file, "rb")))
+		return -1;
+	if (fstat(fileno(fp), &st)) {
+		fclose(fp);
+		return -1;
+	}
+	while ((n = fread(buf, 1, sizeof buf, fp)) > 0)
+		h = cache_hash(h, buf, n);
+	if (ferror(fp)) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+
+	*hash = cache_hash(h, &st.st_size, sizeof st.st_size);
+	return 0;
+}
+
+/*
+ * Create, if necessary, the directory dir, and return 0 if it exists.
+ */
+static int
+make_dir(const char *restrict dir)
+{
+	struct stat	st;
+
+	if (!stat(dir, &st))
+		return S_ISDIR(st.st_mode) ? 0 : -1;
+	if (mkdir(dir, 0700) && errno != EEXIST)
+		return -1;
+	return 0;
+}
+
+/*
+ * Return the cache directory, or NULL if the cache is disabled or there is
+ * no usable cache directory. Create the directory, if necessary.
+ */
+static const char *
+cache_root(void)
+{
+	static int	state = 0;	/* 0 unknown, 1 usable, -1 broken */
+	static char	root[PATH_MAX];
+	char		*dir;
+	int		n;
+
+	if (appres.picture_cache_size <= 0 || state == -1)
+		return NULL;
+	if (state == 1)
+		return root;
+
+	state = -1;
+	if ((dir = getenv("XDG_CACHE_HOME")) && *dir == '/')
+		n = snprintf(root, sizeof root, "%s", dir);
+	else if ((dir = getenv("HOME")) && *dir)
+		n = snprintf(root, sizeof root, "%s/.cache", dir);
+	else
+		return NULL;
+	/* leave space for "/xfig/<kind>/<key>.XXXXXX" */
+	if (n < 0 || (size_t)n + 64 >= sizeof root || make_dir(root))
+		return NULL;
+	strcpy(root + n, "/xfig");
+	if (make_dir(root))
+		return NULL;
+	state = 1;
+	return root;
+}
+
+/*
+ * Return the path of the cache entry key of the given kind, in a static
+ * buffer. Create the directory for kind, if necessary.
+ * Return NULL if there is no usable cache directory.
+ */
+static char *
+cache_path(const char *restrict kind, uint64_t key)
+{
+	static char	path[PATH_MAX];
+	const char	*root;
+	int		n;
+
+	if (!(root = cache_root()))
+		return NULL;
+	n = snprintf(path, sizeof path, "%s/%s", root, kind);
+	if (n < 0 || (size_t)n + 30 >= sizeof path || make_dir(path))
+		return NULL;
+	sprintf(path + n, "/%016" PRIx64, key);
+	return path;
+}
+
+struct entry {
+	char	*path;
+	off_t	size;
+	time_t	mtime;
+};
+
+static int
+older(const void *a, const void *b)
+{
+	const struct entry	*ea = a;
+	const struct entry	*eb = b;
+
+	return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+/*
+ * Remove the least recently used entries, until the cache is smaller than
+ * appres.picture_cache_size megabytes.
+ */
+static void
+cache_trim(void)
+{
+	size_t		n = 0;
+	size_t		alloc = 0;
+	size_t		i;
+	off_t		total = 0;
+	off_t		limit = (off_t)appres.picture_cache_size << 20;
+	const char	*root;
+	char		path[PATH_MAX];
+	struct entry	*entries = NULL;
+	struct entry	*e;
+	struct dirent	*kind;
+	struct dirent	*file;
+	struct stat	st;
+	DIR		*rootdir;
+	DIR		*dir;
+
+	if (!(root = cache_root()) || !(rootdir = opendir(root)))
+		return;
+
+	while ((kind = readdir(rootdir))) {
+		if (kind->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof path, "%s/%s", root, kind->d_name);
+		if (!(dir = opendir(path)))
+			continue;
+		while ((file = readdir(dir))) {
+			if (file->d_name[0] == '.')
+				continue;
+			if ((size_t)snprintf(path, sizeof path, "%s/%s/%s",
+					root, kind->d_name, file->d_name)
+					>= sizeof path ||
+					stat(path, &st) || !S_ISREG(st.st_mode))
+				continue;
+			if (n == alloc) {
+				alloc = alloc ? 2 * alloc : 64;
+				if (!(e = realloc(entries,
+						alloc * sizeof *entries)))
+					break;
+				entries = e;
+			}
+			if (!(entries[n].path = strdup(path)))
+				break;
+			entries[n].size = st.st_size;
+			entries[n].mtime = st.st_mtime;
+			total += st.st_size;
+			++n;
+		}
+		closedir(dir);
+	}
+	closedir(rootdir);
+
+	if (total > limit) {
+		qsort(entries, n, sizeof *entries, older);
+		for (i = 0; i < n && total > limit; ++i) {
+			if (appres.DEBUG)
+				fprintf(stderr, "Cache: remove %s\n",
+						entries[i].path);
+			if (!unlink(entries[i].path))
+				total -= entries[i].size;
+		}
+	}
+	for (i = 0; i < n; ++i)
+		free(entries[i].path);
+	free(entries);
+}
+
+/*
+ * Open the cache entry key of the given kind for reading.
+ * Return NULL if there is no such entry.
+ */
+FILE *
+cache_open(const char *restrict kind, uint64_t key)
+{
+	char	*path;
+	FILE	*fp;
+
+	if (!(path = cache_path(kind, key)))
+		return NULL;
+	fp = fopen(path, "rb");
+	if (appres.DEBUG)
+		fprintf(stderr, "Cache %s: %s\n", fp ? "hit" : "miss", path);
+	if (fp)
+		(void)utime(path, NULL);
+	return fp;
+}
+
+/*
+ * Map the cache entry key of the given kind into memory. The mapping is
+ * private and writable, changes are not written back to the entry.
+ * Return the address and, in *len, the length of the mapping, or NULL if
+ * there is no such entry. Release the mapping with munmap().
+ */
+void *
+cache_map(const char *restrict kind, uint64_t key, size_t *len)
+{
+	int		fd;
+	char		*path;
+	void		*map;
+	struct stat	st;
+
+	if (!(path = cache_path(kind, key)))
+		return NULL;
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		if (appres.DEBUG)
+			fprintf(stderr, "Cache miss: %s\n", path);
+		return NULL;
+	}
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	if (appres.DEBUG)
+		fprintf(stderr, "Cache hit: %s\n", path);
+	(void)utime(path, NULL);
+	*len = (size_t)st.st_size;
+	return map;
+}
+
+/*
+ * Write the cache entry key of the given kind, consisting of headlen bytes
+ * of head followed by len bytes of data.
+ * Return 0 on success, -1 on failure.
+ */
+int
+cache_write(const char *restrict kind, uint64_t key, const void *head,
+		size_t headlen, const void *data, size_t len)
+{
+	static size_t	written = 0;
+	static int	trimmed = 0;
+	int		fd;
+	char		*path;
+	char		tmp[PATH_MAX];
+	FILE		*fp;
+
+	if (!(path = cache_path(kind, key)))
+		return -1;
+	if ((size_t)snprintf(tmp, sizeof tmp, "%s.XXXXXX", path) >= sizeof tmp)
+		return -1;
+	if ((fd = mkstemp(tmp)) == -1)
+		return -1;
+	if (!(fp = fdopen(fd, "wb"))) {
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	if ((headlen && fwrite(head, headlen, 1, fp) != 1) ||
+			(len && fwrite(data, len, 1, fp) != 1)) {
+		fclose(fp);
+		unlink(tmp);
+		return -1;
+	}
+	if (fclose(fp) || rename(tmp, path)) {
+		unlink(tmp);
+		return -1;
+	}
+
+	/* check the size of the cache on the first write, and whenever
+	   another sixteenth of the allowed size was written */
+	written += headlen + len;
+	if (!trimmed || written >
+			((size_t)appres.picture_cache_size << 20) / 16) {
+		cache_trim();
+		trimmed = 1;
+		written = 0;
+	}
+	return 0;
+}
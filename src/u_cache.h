@@ -0,0 +1,36 @@
+/*
+ * FIG : Facility for Interactive Generation of figures
+ * Copyright (c) 1985-1988 by Supoj Sutanthavibul
+ * Parts Copyright (c) 1989-2015 by Brian V. Smith
+ * Parts Copyright (c) 1991 by Paul King
+ * Parts Copyright (c) 2016-2024 by Thomas Loimer
+ *
+ * Any party obtaining a copy of these files is granted, free of charge, a
+ * full and unrestricted irrevocable, world-wide, paid up, royalty-free,
+ * nonexclusive right and license to deal in this software and documentation
+ * files (the "Software"), including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense and/or sell copies of
+ * the Software, and to permit persons who receive copies from any such
+ * party to do so, with the only requirement being that the above copyright
+ * and this permission notice remain intact.
+ *
+ */
+
+#ifndef U_CACHE_H
+#define U_CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define CACHE_HASH_INIT	UINT64_C(14695981039346656037)
+
+extern uint64_t	cache_hash(uint64_t hash, const void *data, size_t len);
+extern int	cache_hash_file(const char *restrict file, uint64_t *hash);
+extern FILE	*cache_open(const char *restrict kind, uint64_t key);
+extern void	*cache_map(const char *restrict kind, uint64_t key,
+				size_t *len);
+extern int	cache_write(const char *restrict kind, uint64_t key,
+				const void *head, size_t headlen,
+				const void *data, size_t len);
+
+#endif
@@ -470,7 +470,16 @@ create_picture_entry(void)
     picture->bitmap = NULL;
     picture->transp = TRANSP_NONE;
     picture->numcols = 0;
+    picture->cmap_mapped = 0;
     picture->refcount = 0;
+    picture->mapped = 0;
+    picture->reduction = 1;
+    picture->view_size.x = picture->view_size.y = 0;
+    picture->deferred = 0;
+    picture->content = 0;
+    picture->same = NULL;
+    picture->last_drawn = 0;
+    picture->name_next = picture->content_next = NULL;
     picture->prev = picture->next = NULL;
     if (appres.DEBUG)
 	fprintf(stderr, "create picture entry %p\n", (void *)picture);
@@ -529,8 +538,8 @@ copy_line(F_line *l)
 	if (line->pic->pic_cache)
 	    line->pic->pic_cache->refcount++;
 
-	width = l->pic->pix_width;
-	height = l->pic->pix_height;
+	width = l->pic->pix_w;
+	height = l->pic->pix_h;
 	/* copy pixmap */
 	if (l->pic->pixmap != 0) {
 	    line->pic->pixmap = XCreatePixmap(tool_d, tool_w,
@@ -48,6 +48,7 @@
 #include "w_file.h"		/* check_cancel() */
 #include "w_layers.h"		/* active_layer() */
 #include "w_msgpanel.h"		/* put_msg() */
+#include "w_setup.h"		/* CANVAS_WD, CANVAS_HT */
 #include "w_util.h"		/* NUM_ARROW_TYPES */
 #include "w_zoom.h"
 #include "xfig_math.h"
@@ -216,7 +217,7 @@ void debug_depth (int depth, int x, int y);
 void newpoint (float xp, float yp);
 void draw_arcbox (F_line *line, int op);
 void draw_pic_pixmap (F_line *box, int op);
-void create_pic_pixmap (F_line *box, int rotation, int width, int height, int flipped);
+void create_pic_pixmap (F_line *box, int rotation, int width, int height, int flipped, int x0, int y0, int w, int h);
 void clr_mask_bit (int r, int c, int bwidth, unsigned char *mask);
 void greek_text (F_text *text, int x1, int y1, int x2, int y2);
 
@@ -659,6 +660,9 @@ void draw_line(F_line *line, int op)
     /* is it a picture object or a Fig figure? */
     if (line->type == T_PICTURE) {
 	if (line->pic->pic_cache) {
+	    /* read a deferred picture when idle, label the box meanwhile */
+	    if (line->pic->pic_cache->deferred && active_layer(line->depth))
+		queue_picobj(line->pic->pic_cache, xmin, ymin, xmax, ymax);
 	    if ((line->pic->pic_cache->bitmap != NULL) && active_layer(line->depth)) {
 		/* only draw the picture if there is a pixmap AND this layer is active */
 		draw_pic_pixmap(line, op);
@@ -850,11 +854,21 @@ subset(int xmin1, int ymin1, int xmax1, int ymax1, int xmin2, int ymin2, int xma
            (ymin2 <= ymin1) && (ymax1 <= ymax2);
 }
 
+/*
+ * Of a picture with more pixels than four times the canvas, only the part on
+ * the canvas, with a margin of half the canvas on each side, is made into a
+ * pixmap.
+ */
+#define	large_picture(width, height) \
+		((double)(width) * (height) > 4.0 * CANVAS_WD * CANVAS_HT)
+
 void draw_pic_pixmap(F_line *box, int op)
 {
     int		    xmin, ymin;
     int		    xmax, ymax;
     int		    width, height, rotation;
+    int		    x0, y0, x1, y1;
+    Boolean	    large, partial;
     F_pos	    origin;
     F_pos	    opposite;
     Pixmap          clipmask;
@@ -885,14 +899,56 @@ void draw_pic_pixmap(F_line *box, int op)
     if (origin.x <= opposite.x && origin.y > opposite.y)
 	rotation = 90;
 
+    use_picobj(box->pic->pic_cache);
+
+    /* a picture decoded at a reduced size may have to be read again */
+    if (rotation == 90 || rotation == 270)
+	refine_picobj(box->pic, height, width);
+    else
+	refine_picobj(box->pic, width, height);
+
+    /* the part of the picture on the canvas */
+    x0 = y0 = 0;
+    x1 = width - 1;
+    y1 = height - 1;
+    large = large_picture(width, height);
+    if (large) {
+	x0 = max2(0, -xmin);
+	y0 = max2(0, -ymin);
+	x1 = min2(x1, CANVAS_WD - 1 - xmin);
+	y1 = min2(y1, CANVAS_HT - 1 - ymin);
+	if (x1 < x0 || y1 < y0)
+	    return;
+    }
+    partial = box->pic->pix_w < box->pic->pix_width ||
+		box->pic->pix_h < box->pic->pix_height;
+
     /* if something has changed regenerate the pixmap */
     if (box->pic->pixmap == 0 ||
+	box->pic->pix_bit_width != box->pic->pic_cache->bit_size.x ||
 	box->pic->color != box->pen_color ||
 	box->pic->pix_rotation != rotation ||
 	abs(box->pic->pix_width - width) > 1 ||		/* rounding makes diff of 1 bit */
 	abs(box->pic->pix_height - height) > 1 ||
-	box->pic->pix_flipped != box->pic->flipped)
-	    create_pic_pixmap(box, rotation, width, height, box->pic->flipped);
+	box->pic->pix_flipped != box->pic->flipped ||
+	((large || partial) && (x0 < box->pic->pix_x || y0 < box->pic->pix_y ||
+		x1 >= box->pic->pix_x + box->pic->pix_w ||
+		y1 >= box->pic->pix_y + box->pic->pix_h))) {
+	if (large) {
+	    x0 = max2(0, x0 - CANVAS_WD / 2);
+	    y0 = max2(0, y0 - CANVAS_HT / 2);
+	    x1 = min2(width - 1, x1 + CANVAS_WD / 2);
+	    y1 = min2(height - 1, y1 + CANVAS_HT / 2);
+	}
+	create_pic_pixmap(box, rotation, width, height, box->pic->flipped,
+			x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+    }
+
+    /* the rectangle covered by the pixmap */
+    xmin += box->pic->pix_x;
+    ymin += box->pic->pix_y;
+    xmax = xmin + box->pic->pix_w - 1;
+    ymax = ymin + box->pic->pix_h - 1;
 
     if (box->pic->mask) {
       /* mask is in rectangle (xmin,ymin)...(xmax,ymax)
@@ -932,7 +988,7 @@ void draw_pic_pixmap(F_line *box, int op)
       XChangeGC(tool_d, gccache[op], GCClipMask|GCClipXOrigin|GCClipYOrigin, &gcv);
     }
     XCopyArea(tool_d, box->pic->pixmap, canvas_win, gccache[op],
-	      0, 0, width, height, xmin, ymin);
+	      0, 0, box->pic->pix_w, box->pic->pix_h, xmin, ymin);
     if (box->pic->mask) {
 	gcv.clip_mask = 0;
 	XChangeGC(tool_d, gccache[op], GCClipMask, &gcv);
@@ -948,23 +1004,26 @@ void draw_pic_pixmap(F_line *box, int op)
  * The input to this routine is the bitmap read from the source
  * image file. That input bitmap has an arbitrary number of rows
  * and columns. This routine re-samples the input bitmap creating
- * an output bitmap of dimensions width-by-height. This output
- * bitmap is made into a Pixmap for display purposes.
+ * an output bitmap of dimensions width-by-height. Of the output bitmap,
+ * the w-by-h rectangle at x0, y0 is made into a Pixmap for display
+ * purposes. Only this rectangle is re-sampled.
  */
 
 #define	ALLOC_PIC_ERR "Can't alloc memory for image: %s"
 
-void create_pic_pixmap(F_line *box, int rotation, int width, int height, int flipped)
+void create_pic_pixmap(F_line *box, int rotation, int width, int height,
+		int flipped, int x0, int y0, int w, int h)
 {
     int		    cwidth, cheight;
-    int		    i,j,k;
+    int		    i,j;
+    int		    r,c;
     int		    bwidth;
-    unsigned char  *data, *tdata, *mask;
+    unsigned char  *data, *mask;
     int		    bbytes;
-    int		    ibit, jbit;
+    size_t	    ibit, jbit;
     int		    wbit;
     int		    fg, bg;
-    size_t	    jnb, nbytes;
+    size_t	    nbytes;
     XImage	   *image;
     Boolean	    type1,hswap,vswap;
 
@@ -976,7 +1035,8 @@ void create_pic_pixmap(F_line *box, int rotation, int width, int height, int fli
 	XFreePixmap(tool_d, box->pic->mask);
 
     if (appres.DEBUG)
-	fprintf(stderr,"Scaling pic pixmap to %dx%d pixels\n",width,height);
+	fprintf(stderr,"Scaling pic pixmap to %dx%d pixels, %dx%d+%d+%d of it\n",
+			width,height,w,h,x0,y0);
 
     cwidth = box->pic->pic_cache->bit_size.x;	/* current width, height */
     cheight = box->pic->pic_cache->bit_size.y;
@@ -986,6 +1046,11 @@ void create_pic_pixmap(F_line *box, int rotation, int width, int height, int fli
     box->pic->pix_width = width;
     box->pic->pix_height = height;
     box->pic->pix_flipped = flipped;
+    box->pic->pix_bit_width = cwidth;
+    box->pic->pix_x = x0;
+    box->pic->pix_y = y0;
+    box->pic->pix_w = w;
+    box->pic->pix_h = h;
     box->pic->pixmap = (Pixmap) 0;
     box->pic->mask = (Pixmap) 0;
 
@@ -993,73 +1058,54 @@ void create_pic_pixmap(F_line *box, int rotation, int width, int height, int fli
 
     /* create a new bitmap at the specified size (requires interpolation) */
 
+    /*
+     * Each pixel x, y of the rectangle is taken from column c and row r of
+     * the re-sampled bitmap before it is swapped horizontally or vertically.
+     * Zoomed into a large picture, the products of the indices exceed an
+     * int; compute them in size_t.
+     */
+    if ((!flipped && (rotation == 0 || rotation == 180)) ||
+	(flipped && !(rotation == 0 || rotation == 180)))
+		type1 = True;
+    else
+		type1 = False;
+    /* horizontal swap */
+    hswap = rotation == 180 || rotation == 270;
+
     /* MONOCHROME display OR XBM */
     if (box->pic->pic_cache->numcols == 0) {
-	    nbytes = (width + 7) / 8;
+	    /* vertical swap */
+	    vswap = (!flipped && (rotation == 180 || rotation == 270)) ||
+		(flipped && !(rotation == 180 || rotation == 270));
+
+	    nbytes = (w + 7) / 8;
 	    bbytes = (cwidth + 7) / 8;
-	    if ((data = (unsigned char *) malloc(nbytes * height)) == NULL) {
-		file_msg(ALLOC_PIC_ERR,
-				ABSOLUTE_PATH(box->pic->pic_cache->file));
-		return;
-	    }
-	    if ((tdata = (unsigned char *) malloc(nbytes)) == NULL) {
+	    if ((data = (unsigned char *) malloc(nbytes * h)) == NULL) {
 		file_msg(ALLOC_PIC_ERR,
 				ABSOLUTE_PATH(box->pic->pic_cache->file));
-		free(data);
 		return;
 	    }
-	    memset(data, 0, nbytes * height);
-	    if ((!flipped && (rotation == 0 || rotation == 180)) ||
-		(flipped && !(rotation == 0 || rotation == 180))) {
-		for (j = 0; j < height; j++) {
-		    /* check if user pressed cancel button */
-		    if (check_cancel())
-			break;
-		    jbit = cheight * j / height * bbytes;
-		    for (i = 0; i < width; i++) {
-			ibit = cwidth * i / width;
-			wbit = (unsigned char) *(box->pic->pic_cache->bitmap + jbit + ibit / 8);
-			if (wbit & (1 << (7 - (ibit & 7))))
-			    *(data + j * nbytes + i / 8) += (1 << (i & 7));
-		    }
-		}
-	    } else {
-		for (j = 0; j < height; j++) {
-		    /* check if user pressed cancel button */
-		    if (check_cancel())
-			break;
-		    ibit = cwidth * j / height;
-		    for (i = 0; i < width; i++) {
-			jbit = cheight * i / width * bbytes;
-			wbit = (unsigned char) *(box->pic->pic_cache->bitmap + jbit + ibit / 8);
-			if (wbit & (1 << (7 - (ibit & 7))))
-			    *(data + (height - j - 1) * nbytes + i / 8) += (1 << (i & 7));
+	    memset(data, 0, nbytes * h);
+	    for (j = 0; j < h; j++) {
+		/* check if user pressed cancel button */
+		if (check_cancel())
+		    break;
+		r = vswap ? height - 1 - (y0 + j) : y0 + j;
+		/* other types are turned upside down */
+		if (!type1)
+		    r = height - 1 - r;
+		for (i = 0; i < w; i++) {
+		    c = hswap ? width - 1 - (x0 + i) : x0 + i;
+		    if (type1) {
+			ibit = (size_t)cwidth * c / width;
+			jbit = (size_t)cheight * r / height * bbytes;
+		    } else {
+			ibit = (size_t)cwidth * r / height;
+			jbit = (size_t)cheight * c / width * bbytes;
 		    }
-		}
-	    }
-
-	    /* horizontal swap */
-	    if (rotation == 180 || rotation == 270)
-		for (j = 0; j < height; j++) {
-		    /* check if user pressed cancel button */
-		    if (check_cancel())
-			break;
-		    jnb = j*nbytes;
-		    memset(tdata, 0, nbytes);
-		    for (i = 0; i < width; i++)
-			if (*(data + jnb + (width - i - 1) / 8) & (1 << ((width - i - 1) & 7)))
-			    *(tdata + i / 8) += (1 << (i & 7));
-		    memcpy(data + j * nbytes, tdata, nbytes);
-		}
-
-	    /* vertical swap */
-	    if ((!flipped && (rotation == 180 || rotation == 270)) ||
-		(flipped && !(rotation == 180 || rotation == 270))) {
-		for (j = 0; j < (height + 1) / 2; j++) {
-		    jnb = j*nbytes;
-		    memcpy(tdata, data + jnb, nbytes);
-		    memmove(data + jnb, data + (height - j - 1) * nbytes, nbytes);
-		    memcpy(data + (height - j - 1) * nbytes, tdata, nbytes);
+		    wbit = (unsigned char) *(box->pic->pic_cache->bitmap + jbit + ibit / 8);
+		    if (wbit & (1 << (7 - (ibit & 7))))
+			*(data + j * nbytes + i / 8) += (1 << (i & 7));
 		}
 	    }
 
@@ -1075,9 +1121,8 @@ void create_pic_pixmap(F_line *box, int rotation, int width, int height, int fli
 	    }
 
 	    box->pic->pixmap = XCreatePixmapFromBitmapData(tool_d, canvas_win,
-					(char *)data, width, height, fg,bg, tool_dpth);
+					(char *)data, w, h, fg,bg, tool_dpth);
 	    free(data);
-	    free(tdata);
 
       /* EPS, PCX, XPM, GIF, PNG or JPEG on *COLOR* display */
       /* It is important to note that the Cmap pixels are unsigned long. */
@@ -1085,7 +1130,7 @@ void create_pic_pixmap(F_line *box, int rotation, int width, int height, int fli
       /* bpl = bytes per line */
 
       } else {
-	    unsigned char	*pixel, *cpixel, *dst, *src, tmp;
+	    unsigned char	*pixel, *cpixel, *src;
 	    int			 bpl, cbpp, cbpl;
 	    unsigned int	*Lpixel;
 	    unsigned short	*Spixel;
@@ -1115,8 +1160,8 @@ void create_pic_pixmap(F_line *box, int rotation, int width, int height, int fli
 	    else
 		    cbpp = 1;
 	    cbpl = cwidth * cbpp;
-	    bpl = width * image_bpp;
-	    if ((data = malloc(bpl * height)) == NULL) {
+	    bpl = w * image_bpp;
+	    if ((data = malloc(bpl * h)) == NULL) {
 		file_msg(ALLOC_PIC_ERR,
 				ABSOLUTE_PATH(box->pic->pic_cache->file));
 		return;
@@ -1124,85 +1169,48 @@ void create_pic_pixmap(F_line *box, int rotation, int width, int height, int fli
 	    /* allocate mask for any transparency information */
 	    if (box->pic->pic_cache->subtype == T_PIC_GIF &&
 	        box->pic->pic_cache->transp != TRANSP_NONE) {
-		    if ((mask = (unsigned char *) malloc((width+7)/8 * height)) == NULL) {
+		    if ((mask = (unsigned char *) malloc((w+7)/8 * h)) == NULL) {
 			file_msg(ALLOC_PIC_ERR,
 				    ABSOLUTE_PATH(box->pic->pic_cache->file));
 			free(data);
 			return;
 		    }
 		    /* set all bits in mask */
-		    for (i = (width+7)/8 * height - 1; i >= 0; i--)
+		    for (i = (w+7)/8 * h - 1; i >= 0; i--)
 			*(mask+i)=  (unsigned char) 255;
 	    }
-	    bwidth = (width+7)/8;
-	    memset(data, 0, bpl * height);
-
-	    type1 = False;
-	    hswap = False;
-	    vswap = False;
-
-	    if ((!flipped && (rotation == 0 || rotation == 180)) ||
-		(flipped && !(rotation == 0 || rotation == 180)))
-			type1 = True;
-	    /* horizontal swap */
-	    if (rotation == 180 || rotation == 270)
-		hswap = True;
+	    bwidth = (w+7)/8;
+	    memset(data, 0, bpl * h);
+
 	    /* vertical swap */
-	    if ((!flipped && (rotation == 90 || rotation == 180)) ||
-		( flipped && (rotation == 90 || rotation == 180)))
-			vswap = True;
+	    vswap = rotation == 90 || rotation == 180;
 
-	    for( j=0; j<height; j++ ) {
+	    for( j=0; j<h; j++ ) {
 		  /* check if user pressed cancel button */
 		  if (check_cancel())
 			break;
 
-		if (type1) {
+		r = vswap ? height - 1 - (y0 + j) : y0 + j;
+		if (type1)
 			src = box->pic->pic_cache->bitmap +
-				(j * cheight / height) * cbpl;
-			dst = data + (j * bpl);
-		} else {
-			src = box->pic->pic_cache->bitmap + (j * cwidth /
-					height) * cbpp;
-			dst = data + (j * bpl);
-		}
+				((size_t)r * cheight / height) * cbpl;
+		else
+			src = box->pic->pic_cache->bitmap + ((size_t)r *
+					cwidth / height) * cbpp;
 
-		pixel = dst;
-		for( i=0; i<width; i++ ) {
+		pixel = data + (j * bpl);
+		for( i=0; i<w; i++ ) {
+		    c = hswap ? width - 1 - (x0 + i) : x0 + i;
 		    if (type1) {
-			    cpixel = src + (i * cwidth / width) * cbpp;
+			    cpixel = src + ((size_t)c * cwidth / width) * cbpp;
 		    } else {
-			    cpixel = src + (i * cheight / width * cwidth) * cbpp;
+			    cpixel = src + ((size_t)c * cheight / width *
+					    cwidth) * cbpp;
 		    }
 		    /* if this pixel is the transparent color then clear the mask pixel */
 		    if (box->pic->pic_cache->transp != TRANSP_NONE &&
-			(*cpixel==(unsigned char) box->pic->pic_cache->transp)) {
-			  if (type1) {
-			    if (hswap) {
-				if (vswap)
-				    clr_mask_bit(height-j-1,width-i-1,bwidth,mask);
-				else
-				    clr_mask_bit(j,width-i-1,bwidth,mask);
-			    } else {
-				if (vswap)
-				    clr_mask_bit(height-j-1,i,bwidth,mask);
-				else
-				    clr_mask_bit(j,i,bwidth,mask);
-			    }
-			  } else {
-			    if (!vswap) {
-				if (hswap)
-				    clr_mask_bit(j,width-i-1,bwidth,mask);
-				else
-				    clr_mask_bit(j,i,bwidth,mask);
-			    } else {
-				if (hswap)
-				    clr_mask_bit(height-j-1,width-i-1,bwidth,mask);
-				else
-				    clr_mask_bit(height-j-1,i,bwidth,mask);
-			    }
-			  } /* type */
-		    }
+			(*cpixel==(unsigned char) box->pic->pic_cache->transp))
+			clr_mask_bit(j,i,bwidth,mask);
 		    if (image_bpp == 4) {
 			Lpixel = (unsigned int *) pixel;
 			if (box->pic->pic_cache->numcols <= 0)
@@ -1249,43 +1257,10 @@ void create_pic_pixmap(F_line *box, int rotation, int width, int height, int fli
 		}
 	    }
 
-	    /* horizontal swap */
-	    if (hswap) {
-		for( j=0; j<height; j++ ) {
-		  /* check if user pressed cancel button */
-		  if (check_cancel())
-			break;
-		  dst = data + (j * bpl);
-		  src = dst + ((width - 1) * image_bpp);
-		  for( i=0; i<width/2; i++, src -= 2*image_bpp ) {
-		    for( k=0; k<image_bpp; k++, dst++, src++ ) {
-		      tmp = *dst;
-		      *dst = *src;
-		      *src = tmp;
-		    }
-		  }
-		}
-	    }
-
-	    /* vertical swap */
-	    if (vswap) {
-		for( i=0; i<width; i++ ) {
-		  dst = data + (i * image_bpp);
-		  src = dst + ((height - 1) * bpl);
-		  for( j=0; j<height/2; j++, dst += (width-1)*image_bpp, src -= (width+1)*image_bpp ) {
-		    for( k=0; k<image_bpp; k++, dst++, src++ ) {
-		      tmp = *dst;
-		      *dst = *src;
-		      *src = tmp;
-		    }
-		  }
-		}
-	    }
-
 	    image = XCreateImage(tool_d, tool_v, tool_dpth,
-				ZPixmap, 0, (char *)data, width, height, 8, 0);
+				ZPixmap, 0, (char *)data, w, h, 8, 0);
 	    box->pic->pixmap = XCreatePixmap(tool_d, canvas_win,
-				width, height, tool_dpth);
+				w, h, tool_dpth);
 	    if (image->byte_order == MSBFirst) {
 		    image->byte_order = LSBFirst;
 		    _XInitImageFuncPtrs(image);
@@ -1294,12 +1269,12 @@ void create_pic_pixmap(F_line *box, int rotation, int width, int height, int fli
 		    image->bitmap_bit_order = LSBFirst;
 		    _XInitImageFuncPtrs(image);
 	    }
-	    XPutImage(tool_d, box->pic->pixmap, pic_gc, image, 0, 0, 0, 0, width, height);
+	    XPutImage(tool_d, box->pic->pixmap, pic_gc, image, 0, 0, 0, 0, w, h);
 	    XDestroyImage(image);
 	    /* make the clipmask to do the GIF transparency */
 	    if (mask) {
 		box->pic->mask = XCreateBitmapFromData(tool_d, tool_w, (char*) mask,
-						width, height);
+						w, h);
 		free(mask);
 	    }
     }
@@ -33,6 +33,7 @@
 
 #include "f_save.h"
 #include "f_util.h"
+#include "u_journal.h"
 #include "w_cmdpanel.h"
 
 #define MAXERRORS 6
@@ -104,7 +105,9 @@ void emergency_quit(Boolean abortflag)
     signal(SIGSEGV, SIG_DFL);
 
     aborting = abortflag;
-    if (figure_modified && !emptyfigure()) {
+    if (figure_modified && !emptyfigure() && journal_preserve()) {
+	/* the figure is recovered from the journal at the next start */
+    } else if (figure_modified && !emptyfigure()) {
 	fprintf(stderr, "xfig: attempting to save figure\n");
 	if (emergency_save("SAVE.fig") == -1)
 	    if (emergency_save(strcat(TMPDIR,"/SAVE.fig")) == -1)
@@ -29,6 +29,7 @@
 #include "resources.h"
 #include "object.h"
 #include "paintop.h"
+#include "f_picobj.h"		/* free_bitmap(), unhash_picture() */
 #include "u_fonts.h"
 #include "u_undo.h"		/* saved_objects */
 #include "w_drawprim.h"
@@ -190,8 +191,8 @@ free_picture_entry(struct _pics *picture)
 			fprintf(stderr, "Delete picture %p %s, refcount = %d\n",
 					(void *)picture, picture->file,
 					picture->refcount);
-		if (picture->bitmap)
-			free(picture->bitmap);
+		free_bitmap(picture);
+		unhash_picture(picture);
 		free(picture->file);
 		/* unlink from list */
 		if (picture->next)
@@ -199,8 +200,8 @@ free_picture_entry(struct _pics *picture)
 		if (picture->prev)
 			picture->prev->next = picture->next;
 		/* at the head of the list */
-		if (picture->prev == NULL)
-			pictures = NULL;
+		else if (pictures == picture)
+			pictures = picture->next;
 		free(picture);
 	} else {
 		if (appres.DEBUG)
@@ -43,6 +43,7 @@
 #include "object.h"
 #include "resources.h"
 #include "f_util.h"		/* map_to_pattern(), map_to_mono() */
+#include "u_cache.h"
 #include "w_msgpanel.h"		/* file_msg() */
 
 /*
@@ -53,6 +54,7 @@
 
 #define BITMAP_PPI	160	/* the resolution for rendering bitmaps */
 #define GS_ERROR	(-2)
+#define GS_CACHE	"gs"	/* the kind of entries in the disk cache */
 
 /*
  * Ghostscript command lines to get the mediabox of a pdf
@@ -269,6 +271,101 @@ gslib(struct _callback_data *data, int (*gs_stdin)(void *, char*, int),
 }
 #endif /* HAVE_GSLIB */
 
+/*
+ * The disk cache.
+ * Rendering eps or pdf files with ghostscript is slow. Therefore, keep the
+ * bitmaps and the /MediaBox obtained from ghostscript in a disk cache, keyed
+ * by the content, size and modification time of the file and by the
+ * parameters of the rendering.
+ */
+
+/* The header of a cached bitmap. The bitmap follows. */
+struct gs_cache_head {
+	int	width;
+	int	height;
+	int	numcols;
+	size_t	len;
+};
+
+/*
+ * Return the length of the bitmap of width w and height h rendered by
+ * ghostscript, for the current visual.
+ */
+static size_t
+bitmap_len(int w, int h)
+{
+	if (tool_cells <= 2 || appres.monochrome)
+		return (size_t)((w + 7) / 8) * h;
+	else if (tool_vclass == TrueColor && image_bpp == 4)
+		return (size_t)w * h * image_bpp;
+	else
+		return (size_t)w * h * 3;
+}
+
+/*
+ * Compute the key of the bitmap rendered from the file with the hash
+ * file_hash and the bounding box bb[4].
+ */
+static void
+bitmap_key(uint64_t file_hash, const int bb[4], uint64_t *key)
+{
+	int	par[4];
+
+	*key = file_hash;
+	par[0] = BITMAP_PPI;
+	par[1] = tool_cells <= 2 || appres.monochrome;
+	par[2] = tool_vclass;
+	par[3] = image_bpp;
+	*key = cache_hash(*key, bb, 4 * sizeof(int));
+	*key = cache_hash(*key, par, sizeof par);
+}
+
+/*
+ * Read the cached bitmap key into pic. Return 0 on success, -1 on failure.
+ */
+static int
+cache_load_bitmap(uint64_t key, F_pic *pic)
+{
+	struct gs_cache_head	head;
+	FILE			*fp;
+
+	if (!(fp = cache_open(GS_CACHE, key)))
+		return -1;
+	if (fread(&head, sizeof head, 1, fp) != 1 || head.width <= 0 ||
+			head.height <= 0 ||
+			head.len != bitmap_len(head.width, head.height) ||
+			!(pic->pic_cache->bitmap = malloc(head.len))) {
+		fclose(fp);
+		return -1;
+	}
+	if (fread(pic->pic_cache->bitmap, head.len, 1, fp) != 1) {
+		fclose(fp);
+		free(pic->pic_cache->bitmap);
+		pic->pic_cache->bitmap = NULL;
+		return -1;
+	}
+	fclose(fp);
+	pic->pic_cache->bit_size.x = head.width;
+	pic->pic_cache->bit_size.y = head.height;
+	pic->pic_cache->numcols = head.numcols;
+	return 0;
+}
+
+static void
+cache_store_bitmap(uint64_t key, F_pic *pic)
+{
+	struct gs_cache_head	head;
+
+	/* zero the padding, too */
+	memset(&head, 0, sizeof head);
+	head.width = pic->pic_cache->bit_size.x;
+	head.height = pic->pic_cache->bit_size.y;
+	head.numcols = pic->pic_cache->numcols;
+	head.len = bitmap_len(head.width, head.height);
+	(void)cache_write(GS_CACHE, key, &head, sizeof head,
+			pic->pic_cache->bitmap, head.len);
+}
+
 /*
  * Call ghostscript.
  * Return an open file stream for reading,
@@ -550,18 +647,48 @@ gslib_mediabox(char *file, int *llx, int *lly, int *urx, int *ury)
 
 /*
  * Call ghostscript to extract the /MediaBox from the pdf given in file.
+ * file_hash, the hash of the file computed by cache_hash_file(), is the key
+ * of the result in the cache; without it, the result is not cached.
  * Return 0 on success, -1 on failure, GS_ERROR (-2) for a ghostscript error.
  */
 int
-gs_mediabox(char *file, int *llx, int *lly, int *urx, int *ury)
+gs_mediabox(char *file, const uint64_t *file_hash, int *llx, int *lly,
+		int *urx, int *ury)
 {
-	int	stat;
+	int		stat;
+	int		bb[4];
+	uint64_t	key;
+	bool		use_cache;
+	FILE		*fp;
+
+	use_cache = file_hash != NULL;
+	if (use_cache) {
+		key = cache_hash(*file_hash, "/MediaBox", 9);
+		if ((fp = cache_open(GS_CACHE, key))) {
+			stat = fread(bb, sizeof bb, 1, fp) == 1 ? 0 : -1;
+			fclose(fp);
+			if (stat == 0) {
+				*llx = bb[0];
+				*lly = bb[1];
+				*urx = bb[2];
+				*ury = bb[3];
+				return 0;
+			}
+		}
+	}
 
 #ifdef HAVE_GSLIB
 	stat = gslib_mediabox(file, llx, lly, urx, ury);
 	if (stat == -1)
 #endif
 		stat = gsexe_mediabox(file, llx, lly, urx, ury);
+	if (stat == 0 && use_cache) {
+		bb[0] = *llx;
+		bb[1] = *lly;
+		bb[2] = *urx;
+		bb[3] = *ury;
+		(void)cache_write(GS_CACHE, key, NULL, 0, bb, sizeof bb);
+	}
 	if (stat == GS_ERROR) {
 		file_msg("Could not parse file '%s' with ghostscript.", file);
 		file_msg("If available, error messages are displayed above.");
@@ -745,14 +872,6 @@ gsexe_bitmap(char *file, F_pic *pic, int llx, int lly, int urx, int ury)
 		return GS_ERROR;
 	}
 
-	if (tool_vclass != TrueColor && tool_cells > 2 && !appres.monochrome) {
-		if (!map_to_palette(pic)) {
-			file_msg("Cannot create colormapped image for %s.",
-					file);
-			return failure;
-		}
-	}
-
 	return 0;
 }
 
@@ -1183,36 +1302,51 @@ gslib_bitmap(char *file, F_pic *pic, int llx, int lly, int urx, int ury)
 	pic->pic_cache->bit_size.y = h;
 	pic->pic_cache->bitmap = handle.img;
 
-	if (tool_vclass != TrueColor && tool_cells > 2 && !appres.monochrome) {
-		if (!map_to_palette(pic)) {
-			file_msg("Cannot create colormapped image for %s.",
-					file);
-			return failure;
-		}
-	}
-
 	return 0;
 }
 #endif /* HAVE_GSLIB */
 
 /*
  * Create a pixmap in pic->pic_cache->bitmap from the ps/eps/pdf file "file"
- * having the bounding box llx lly urx ury.
+ * having the bounding box llx lly urx ury. The bitmap is cached under
+ * file_hash, see gs_mediabox().
  * Return 0 on success, -1 on failure, or GS_ERROR for a ghostscript error.
  */
 int
-gs_bitmap(char *file, F_pic *pic, int llx, int lly, int urx, int ury)
+gs_bitmap(char *file, const uint64_t *file_hash, F_pic *pic, int llx,
+		int lly, int urx, int ury)
 {
-	int	stat;
-
+	int		stat;
+	const int	bb[4] = {llx, lly, urx, ury};
+	uint64_t	key;
+	bool		use_cache;
+
+	use_cache = file_hash != NULL;
+	if (use_cache)
+		bitmap_key(*file_hash, bb, &key);
+	if (use_cache && !cache_load_bitmap(key, pic)) {
+		stat = 0;
+	} else {
 #ifdef HAVE_GSLIB
-	stat = gslib_bitmap(file, pic, llx, lly, urx, ury);
+		stat = gslib_bitmap(file, pic, llx, lly, urx, ury);
 #else
-	stat = gsexe_bitmap(file, pic, llx, lly, urx, ury);
+		stat = gsexe_bitmap(file, pic, llx, lly, urx, ury);
 #endif
+		if (stat == 0 && use_cache)
+			cache_store_bitmap(key, pic);
+	}
 	if (stat == GS_ERROR) {
 		file_msg("Could not create pixmap from '%s' with ghostscript.",
 				file);
 	}
+
+	if (stat == 0 && tool_vclass != TrueColor && tool_cells > 2 &&
+			!appres.monochrome) {
+		if (!map_to_palette(pic)) {
+			file_msg("Cannot create colormapped image for %s.",
+					file);
+			return -1;
+		}
+	}
 	return stat;
 }
@@ -0,0 +1,1156 @@
+/*
+ * FIG : Facility for Interactive Generation of figures
+ * Copyright (c) 1985-1988 by Supoj Sutanthavibul
+ * Parts Copyright (c) 1989-2015 by Brian V. Smith
+ * Parts Copyright (c) 1991 by Paul King
+ * Parts Copyright (c) 2016-2024 by Thomas Loimer
+ *
+ * Any party obtaining a copy of these files is granted, free of charge, a
+ * full and unrestricted irrevocable, world-wide, paid up, royalty-free,
+ * nonexclusive right and license to deal in this software and documentation
+ * files (the "Software"), including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense and/or sell copies of
+ * the Software, and to permit persons who receive copies from any such
+ * party to do so, with the only requirement being that the above copyright
+ * and this permission notice remain intact.
+ *
+ */
+
+/*
+ * An append-only journal of the edits to the figure, for crash recovery.
+ *
+ * After each operation, i.e., each time set_modifiedflag() is called, the
+ * top-level object lists are compared to a shadow copy of the object pointers
+ * taken when the journal was last written. Removed objects, new objects
+ * and objects that the undo information marks as changed are written to the
+ * journal. A checkpoint of the whole figure is written by a forked child
+ * process, hence never on the user interface path, first when the figure is
+ * modified after it was loaded or saved, and again whenever the journal grows
+ * larger than the last checkpoint. The journal is removed when the figure is
+ * saved or xfig exits normally. On start-up, journals left behind by a
+ * crashed xfig are replayed into a .fig file.
+ *
+ * Files, in the directory TMPDIR/xfig-<uid>, accessible only by the user:
+ *	xfig-journal-<host>-<pid>.<generation>.ckpt	checkpoint
+ *	xfig-journal-<host>-<pid>.<generation>.jnl	edits after the checkpoint
+ * The running xfig holds a lock on its current journal, which tells
+ * recovery that the files are in use.
+ * Both files consist of records, each a line "<kind> <type> <index> <length>"
+ * followed by <length> bytes of data. The kinds are
+ *	P	the path of the figure file
+ *	W	the directory that picture paths are relative to
+ *	H	the header of the figure file, including the color definitions
+ *	A	insert the object given in the data at position <index> of the
+ *		list <type>, or append it, if <index> is -1
+ *	R	replace object number <index> of the list <type>
+ *	D	delete object number <index> of the list <type>
+ * A list <type> contains the top-level arcs, compounds, ellipses, lines,
+ * splines or texts, as written into a fig file by write_objects().
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "u_journal.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <locale.h>
+#include <signal.h>		/* kill() */
+#include <stdint.h>		/* SIZE_MAX */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <X11/Intrinsic.h>
+
+#include "resources.h"
+#include "mode.h"
+#include "object.h"
+#include "f_save.h"
+#include "u_print.h"
+#include "u_undo.h"
+#include "w_msgpanel.h"
+
+#define JOURNAL_MAGIC	"#XFIG JOURNAL 1\n"
+#define JOURNAL_PREFIX	"xfig-journal-"
+#define MAX_HINTS	256	/* changed objects to remember per operation */
+#define MIN_COMPACT	65536	/* do not compact journals smaller than that */
+
+/* the top-level object lists, in the order written by write_objects() */
+enum { J_ARC, J_COMPOUND, J_ELLIPSE, J_LINE, J_SPLINE, J_TEXT, J_NTYPES };
+
+enum journal_state {
+	J_OFF,		/* not journaling */
+	J_CLEAN,	/* the figure on disk is current, no journal files */
+	J_ACTIVE,	/* edits are written to the journal */
+	J_STALE		/* edits were missed, a checkpoint is needed */
+};
+
+struct ptr_array {
+	void	**p;
+	size_t	n;
+	size_t	size;
+};
+
+/* the object pointers at the time the journal was last written */
+static struct ptr_array	shadow[J_NTYPES];
+/* objects possibly changed in place since the journal was last written */
+static struct ptr_array	hints[J_NTYPES];
+static Boolean		hints_overflow = False;
+
+static struct {
+	enum journal_state	state;
+	int		gen;		/* generation of the current journal */
+	int		first_gen;	/* oldest generation with files */
+	Boolean		have_ckpt;	/* a checkpoint was written */
+	Boolean		keep;		/* do not remove the files on exit */
+	FILE		*fp;		/* the current journal */
+	off_t		bytes;		/* size of the current journal */
+	off_t		ckpt_bytes;	/* size of the last checkpoint */
+	char		*header;	/* the last header written */
+	size_t		header_len;
+	XtWorkProcId	work;		/* journal_work(), if pending */
+	pid_t		pid;		/* child writing a checkpoint */
+	int		fd;		/* pipe from the child */
+	int		ckpt_gen;	/* generation written by the child */
+	XtInputId	id;
+} journal = { J_CLEAN, 0, 1, False, False, NULL, 0, 0, NULL, 0, 0, -1, -1,
+	0, 0 };
+
+/* sent by the child process writing a checkpoint */
+struct ckpt_status {
+	int	err;
+	off_t	bytes;
+};
+
+static Boolean	journal_work(XtPointer client_data);
+static void	journal_sync(void);
+static void	checkpoint(void);
+static void	ckpt_done(XtPointer client_data, int *fd, XtInputId *id);
+static void	finish_ckpt(void);
+static void	remove_files(pid_t pid, int from, int to);
+
+
+static int
+obj_type(int object)
+{
+	switch (object) {
+	case O_ARC:
+		return J_ARC;
+	case O_COMPOUND:
+		return J_COMPOUND;
+	case O_ELLIPSE:
+		return J_ELLIPSE;
+	case O_POLYLINE:
+		return J_LINE;
+	case O_SPLINE:
+		return J_SPLINE;
+	case O_TXT:
+		return J_TEXT;
+	default:
+		return -1;
+	}
+}
+
+static void *
+first_obj(int t, F_compound *c)
+{
+	switch (t) {
+	case J_ARC:
+		return c->arcs;
+	case J_COMPOUND:
+		return c->compounds;
+	case J_ELLIPSE:
+		return c->ellipses;
+	case J_LINE:
+		return c->lines;
+	case J_SPLINE:
+		return c->splines;
+	default: /* J_TEXT */
+		return c->texts;
+	}
+}
+
+static void *
+next_obj(int t, void *o)
+{
+	switch (t) {
+	case J_ARC:
+		return ((F_arc *)o)->next;
+	case J_COMPOUND:
+		return ((F_compound *)o)->next;
+	case J_ELLIPSE:
+		return ((F_ellipse *)o)->next;
+	case J_LINE:
+		return ((F_line *)o)->next;
+	case J_SPLINE:
+		return ((F_spline *)o)->next;
+	default: /* J_TEXT */
+		return ((F_text *)o)->next;
+	}
+}
+
+static void
+write_obj(FILE *fp, int t, void *o)
+{
+	switch (t) {
+	case J_ARC:
+		write_arc(fp, o);
+		break;
+	case J_COMPOUND:
+		write_compound(fp, o);
+		break;
+	case J_ELLIPSE:
+		write_ellipse(fp, o);
+		break;
+	case J_LINE:
+		write_line(fp, o);
+		break;
+	case J_SPLINE:
+		write_spline(fp, o);
+		break;
+	case J_TEXT:
+		write_text(fp, o);
+		break;
+	}
+}
+
+static int
+ptr_append(struct ptr_array *a, void *o)
+{
+	if (a->n == a->size) {
+		size_t	size = a->size ? 2 * a->size : 256;
+		void	**p = realloc(a->p, size * sizeof *p);
+		if (!p)
+			return -1;
+		a->p = p;
+		a->size = size;
+	}
+	a->p[a->n++] = o;
+	return 0;
+}
+
+static int
+ptr_cmp(const void *a, const void *b)
+{
+	const char	*p = *(void *const *)a;
+	const char	*q = *(void *const *)b;
+
+	return p < q ? -1 : p > q;
+}
+
+/*
+ * Return the directory of the journals, TMPDIR/xfig-<uid>. Create it, if
+ * necessary. Return NULL, if the directory cannot be created, or if it is
+ * not a directory owned by the user and inaccessible to others.
+ */
+static const char *
+journal_dir(void)
+{
+	static char	dir[PATH_MAX];
+	struct stat	st;
+
+	if (*dir)
+		return dir;
+	if ((size_t)snprintf(dir, sizeof dir, "%s/xfig-%ld", TMPDIR,
+				(long)getuid()) >= sizeof dir)
+		goto error;
+	if (mkdir(dir, S_IRWXU) && errno != EEXIST)
+		goto error;
+	if (lstat(dir, &st))
+		goto error;
+	if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() ||
+			(st.st_mode & (S_IRWXG | S_IRWXO))) {
+		errno = EPERM;
+		goto error;
+	}
+	return dir;
+
+error:
+	*dir = '\0';
+	return NULL;
+}
+
+/* only call after journal_dir() succeeded */
+static char *
+journal_name(char *buf, size_t size, pid_t pid, int gen, const char *ext)
+{
+	char	host[64];
+
+	if (gethostname(host, sizeof host))
+		strcpy(host, "localhost");
+	host[sizeof host - 1] = '\0';
+	snprintf(buf, size, "%s/%s%s-%ld.%d.%s", journal_dir(), JOURNAL_PREFIX,
+			host, (long)pid, gen, ext);
+	return buf;
+}
+
+/*
+ * Create the file name, readable and writable only by the user. A file of
+ * that name, left behind by an earlier process with the same pid, is
+ * replaced.
+ */
+static FILE *
+create_file(const char *name)
+{
+	int	fd;
+	FILE	*fp;
+
+	(void)unlink(name);
+	if ((fd = open(name, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR))
+			== -1)
+		return NULL;
+	if (!(fp = fdopen(fd, "wb")))
+		close(fd);
+	return fp;
+}
+
+static void
+put_record(FILE *fp, int kind, int t, long idx, const char *data, size_t len)
+{
+	fprintf(fp, "%c %d %ld %zu\n", kind, t, idx, len);
+	if (len > 0)
+		fwrite(data, 1, len, fp);
+}
+
+/* write object o, of type t, as record kind to fp */
+static int
+put_object(FILE *fp, int kind, int t, long idx, void *o)
+{
+	char	*buf = NULL;
+	size_t	len;
+	FILE	*mp;
+
+	if (!(mp = open_memstream(&buf, &len)))
+		return -1;
+	write_obj(mp, t, o);
+	if (fclose(mp)) {
+		free(buf);
+		return -1;
+	}
+	put_record(fp, kind, t, idx, buf, len);
+	free(buf);
+	return 0;
+}
+
+/* return the file header, as written by write_fig_header() */
+static char *
+header_text(size_t *len)
+{
+	char	*buf = NULL;
+	FILE	*mp;
+
+	if (!(mp = open_memstream(&buf, len)))
+		return NULL;
+	write_fig_header(mp);
+	if (fclose(mp)) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+static void
+put_names(FILE *fp)
+{
+	put_record(fp, 'P', 0, 0, cur_filename, strlen(cur_filename));
+	put_record(fp, 'W', 0, 0, cur_file_dir, strlen(cur_file_dir));
+}
+
+static void
+add_hints(int t, void *o, int max)
+{
+	for (; o && max > 0; o = next_obj(t, o), --max) {
+		if (ptr_append(&hints[t], o)) {
+			hints_overflow = True;
+			return;
+		}
+	}
+	if (o || hints[t].n > MAX_HINTS)
+		hints_overflow = True;
+}
+
+static void
+clear_hints(void)
+{
+	int	t;
+
+	for (t = 0; t < J_NTYPES; ++t)
+		hints[t].n = 0;
+	hints_overflow = False;
+}
+
+/*
+ * Called by set_modifiedflag(), after an operation is completed.
+ * Remember the objects that the undo information holds as changed, and
+ * write the journal when xfig is idle.
+ */
+void
+journal_modified(void)
+{
+	int	t;
+
+	if (!appres.journal || update_figs || journal.state == J_OFF)
+		return;
+
+	if (last_object == O_ALL_OBJECT) {
+		for (t = 0; t < J_NTYPES; ++t)
+			add_hints(t, first_obj(t, &saved_objects), MAX_HINTS);
+	} else if ((t = obj_type(last_object)) >= 0) {
+		/* the changed object, or the original followed by
+		   the changed object, see change_line() */
+		add_hints(t, first_obj(t, &saved_objects), 2);
+	}
+	if (latest_line)
+		add_hints(J_LINE, latest_line, 1);
+	if (latest_spline)
+		add_hints(J_SPLINE, latest_spline, 1);
+
+	if (!journal.work)
+		journal.work = XtAppAddWorkProc(tool_app, journal_work, NULL);
+}
+
+/* called by XtAppAddWorkProc */
+static Boolean
+journal_work(XtPointer client_data)
+{
+	(void)client_data;
+
+	journal.work = 0;
+	journal_sync();
+	return True;	/* remove the work procedure */
+}
+
+/* an object pointer and its position in the shadow */
+struct position {
+	void	*p;
+	size_t	i;
+};
+
+static int
+pos_cmp(const void *a, const void *b)
+{
+	const char	*p = ((const struct position *)a)->p;
+	const char	*q = ((const struct position *)b)->p;
+
+	return p < q ? -1 : p > q;
+}
+
+/*
+ * Compare the object list t to its shadow, and write the differences to fp.
+ * An object that is not found further down in the shadow is inserted, the
+ * objects in the shadow that are skipped over are deleted. Replace the shadow
+ * by the current list. Return the number of records written, or a number
+ * larger than max_records, if the comparison was given up.
+ */
+static size_t
+diff_list(FILE *fp, int t, size_t max_records)
+{
+	size_t			i = 0;		/* position in the old shadow */
+	size_t			k = 0;		/* position in the new list */
+	size_t			n = shadow[t].n;
+	size_t			records = 0;
+	void			*o;
+	struct position		key;
+	struct position		*found;
+	struct position		*pos;
+	struct ptr_array	new = { NULL, 0, 0 };
+
+	if (hints[t].n > 1)
+		qsort(hints[t].p, hints[t].n, sizeof(void *), ptr_cmp);
+	if (n > 0) {
+		if (!(pos = malloc(n * sizeof *pos)))
+			return SIZE_MAX;
+		for (i = 0; i < n; ++i) {
+			pos[i].p = shadow[t].p[i];
+			pos[i].i = i;
+		}
+		qsort(pos, n, sizeof *pos, pos_cmp);
+		i = 0;
+	} else {
+		pos = NULL;
+	}
+
+	for (o = first_obj(t, &objects); o && records <= max_records;
+			o = next_obj(t, o), ++k) {
+		if (ptr_append(&new, o)) {
+			records = SIZE_MAX;
+			break;
+		}
+		key.p = o;
+		found = n > 0 ? bsearch(&key, pos, n, sizeof *pos, pos_cmp)
+			: NULL;
+		if (found && found->i >= i) {
+			/* skip, i.e., delete, the objects in between */
+			for (; i < found->i; ++i, ++records)
+				put_record(fp, 'D', t, (long)k, NULL, 0);
+			++i;
+			/* the object is still there, but might be changed */
+			if (hints[t].n > 0 && bsearch(&o, hints[t].p,
+						hints[t].n, sizeof(void *),
+						ptr_cmp)) {
+				put_object(fp, 'R', t, (long)k, o);
+				++records;
+			}
+		} else {
+			/* a new object, or an object moved up the list */
+			put_object(fp, 'A', t, (long)k, o);
+			++records;
+		}
+	}
+	for (; i < n; ++i, ++records)
+		put_record(fp, 'D', t, (long)k, NULL, 0);
+
+	free(pos);
+	free(shadow[t].p);
+	shadow[t] = new;
+	return records;
+}
+
+/*
+ * Write the changes since the journal was last written.
+ * If that is more work than writing a checkpoint, write a checkpoint.
+ */
+static void
+journal_sync(void)
+{
+	int	t;
+	char	*buf = NULL;
+	char	*header;
+	size_t	len;
+	size_t	header_len;
+	size_t	max_records;
+	size_t	records = 0;
+	FILE	*mp;
+
+	if (journal.state == J_OFF)
+		return;
+
+	/* inside an open compound, objects are not the top-level lists */
+	if (objects.parent != NULL) {
+		if (journal.state != J_CLEAN)
+			journal.state = J_STALE;
+		clear_hints();
+		return;
+	}
+
+	if (journal.state != J_ACTIVE || hints_overflow || !journal.fp) {
+		checkpoint();
+		return;
+	}
+
+	if (!(mp = open_memstream(&buf, &len))) {
+		checkpoint();
+		return;
+	}
+	setlocale(LC_NUMERIC, "C");
+	if ((header = header_text(&header_len)) && (header_len !=
+				journal.header_len || memcmp(header,
+					journal.header, header_len))) {
+		put_record(mp, 'H', 0, 0, header, header_len);
+		free(journal.header);
+		journal.header = header;
+		journal.header_len = header_len;
+	} else {
+		free(header);
+	}
+	for (t = 0; t < J_NTYPES; ++t) {
+		max_records = 16 + shadow[t].n / 4;
+		if ((records = diff_list(mp, t, max_records)) > max_records)
+			break;
+	}
+	setlocale(LC_NUMERIC, "");
+	clear_hints();
+	if (fclose(mp) || records > max_records) {
+		/* the shadow is inconsistent, start afresh */
+		free(buf);
+		checkpoint();
+		return;
+	}
+
+	if (len > 0) {
+		if (fwrite(buf, 1, len, journal.fp) != len ||
+				fflush(journal.fp) == EOF) {
+			file_msg("Error writing the journal: %s",
+					strerror(errno));
+			journal.state = J_STALE;
+		}
+		journal.bytes += len;
+	}
+	free(buf);
+
+	/* compact the journal into a checkpoint */
+	if (journal.bytes > journal.ckpt_bytes && journal.bytes > MIN_COMPACT)
+		checkpoint();
+}
+
+/*
+ * Write a checkpoint of the entire figure in a forked child process and start
+ * a new generation of the journal. The files of older generations are removed
+ * once the checkpoint is complete.
+ */
+static void
+checkpoint(void)
+{
+	int		t;
+	int		pd[2];
+	char		name[PATH_MAX];
+	pid_t		parent;
+	void		*o;
+	struct flock	lock;
+	FILE		*fp;
+
+	/* finish the previous checkpoint first */
+	if (journal.pid != -1) {
+		XtRemoveInput(journal.id);
+		finish_ckpt();
+	}
+
+	clear_hints();
+	for (t = 0; t < J_NTYPES; ++t) {
+		shadow[t].n = 0;
+		for (o = first_obj(t, &objects); o; o = next_obj(t, o))
+			if (ptr_append(&shadow[t], o))
+				goto error;
+	}
+
+	if (journal.fp) {
+		fclose(journal.fp);
+		journal.fp = NULL;
+	}
+	if (!journal_dir())
+		goto error;
+	++journal.gen;
+	if (!(journal.fp = create_file(journal_name(name, sizeof name,
+						getpid(), journal.gen, "jnl"))))
+		goto error;
+	/* tell journal_recover() of another xfig that the files are in use */
+	memset(&lock, 0, sizeof lock);
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	(void)fcntl(fileno(journal.fp), F_SETLK, &lock);
+	setlocale(LC_NUMERIC, "C");
+	free(journal.header);
+	journal.header = header_text(&journal.header_len);
+	setlocale(LC_NUMERIC, "");
+	fputs(JOURNAL_MAGIC, journal.fp);
+	put_names(journal.fp);
+	if (journal.header)
+		put_record(journal.fp, 'H', 0, 0, journal.header,
+				journal.header_len);
+	if (fflush(journal.fp) == EOF || pipe(pd))
+		goto error;
+	journal.bytes = 0;
+	parent = getpid();
+
+	journal.pid = fork();
+	if (journal.pid == -1) {
+		close(pd[0]);
+		close(pd[1]);
+		goto error;
+	}
+
+	if (journal.pid == 0) {
+		/* the child, must not talk to the X server */
+		struct ckpt_status	status = {0, 0};
+		char			tmp_name[PATH_MAX + 4];
+
+		close(pd[0]);
+		close_export_pipes();
+		update_figs = True;	/* any message goes to stderr */
+		setlocale(LC_NUMERIC, "C");
+		journal_name(name, sizeof name, parent, journal.gen, "ckpt");
+		sprintf(tmp_name, "%s.tmp", name);
+		if ((fp = create_file(tmp_name))) {
+			fputs(JOURNAL_MAGIC, fp);
+			put_names(fp);
+			if (journal.header)
+				put_record(fp, 'H', 0, 0, journal.header,
+						journal.header_len);
+			for (t = 0; t < J_NTYPES; ++t)
+				for (o = first_obj(t, &objects); o;
+						o = next_obj(t, o))
+					put_object(fp, 'A', t, -1L, o);
+			status.bytes = ftello(fp);
+			if (ferror(fp) || fflush(fp) == EOF ||
+					fsync(fileno(fp)))
+				status.err = errno ? errno : EIO;
+			if (fclose(fp) == EOF && !status.err)
+				status.err = errno;
+			if (!status.err && rename(tmp_name, name))
+				status.err = errno;
+			if (status.err)
+				unlink(tmp_name);
+		} else {
+			status.err = errno;
+		}
+		(void)write(pd[1], &status, sizeof status);
+		_exit(status.err ? 1 : 0);
+	}
+
+	/* the parent */
+	close(pd[1]);
+	journal.fd = pd[0];
+	journal.ckpt_gen = journal.gen;
+	journal.id = XtAppAddInput(tool_app, pd[0], (XtPointer)XtInputReadMask,
+			ckpt_done, NULL);
+	journal.state = J_ACTIVE;
+	return;
+
+error:
+	file_msg("Cannot write the journal for crash recovery: %s",
+			strerror(errno));
+	if (journal.fp) {
+		fclose(journal.fp);
+		journal.fp = NULL;
+	}
+	journal.state = J_STALE;
+}
+
+/* called by XtAppAddInput, when the child process closes the pipe */
+static void
+ckpt_done(XtPointer client_data, int *fd, XtInputId *id)
+{
+	(void)client_data;
+	(void)fd;
+
+	XtRemoveInput(*id);
+	finish_ckpt();
+}
+
+static void
+finish_ckpt(void)
+{
+	struct ckpt_status	status;
+	ssize_t			n;
+
+	while ((n = read(journal.fd, &status, sizeof status)) == -1 &&
+			errno == EINTR)
+		;
+	if (n != sizeof status)
+		status.err = n == -1 ? errno : EPIPE;
+	close(journal.fd);
+	(void)waitpid(journal.pid, NULL, 0);
+	journal.fd = -1;
+	journal.pid = -1;
+
+	if (status.err) {
+		/* keep the older generations, they are still needed */
+		file_msg("Cannot write a checkpoint for crash recovery: %s",
+				strerror(status.err));
+		return;
+	}
+	journal.have_ckpt = True;
+	journal.ckpt_bytes = status.bytes;
+	/* the older generations are not needed any more */
+	remove_files(getpid(), journal.first_gen, journal.ckpt_gen - 1);
+	journal.first_gen = journal.ckpt_gen;
+}
+
+static void
+remove_files(pid_t pid, int from, int to)
+{
+	char	name[PATH_MAX];
+
+	for (; from <= to; ++from) {
+		(void)unlink(journal_name(name, sizeof name, pid, from, "jnl"));
+		(void)unlink(journal_name(name, sizeof name, pid, from,"ckpt"));
+	}
+}
+
+/*
+ * The figure on disk is current. Remove the journal.
+ * A save running in the background calls journal_reset() when it completes.
+ */
+void
+journal_reset(void)
+{
+	if (!appres.journal || update_figs || journal.state == J_OFF ||
+			async_save_pending())
+		return;
+
+	if (journal.work) {
+		XtRemoveWorkProc(journal.work);
+		journal.work = 0;
+	}
+	if (journal.pid != -1) {
+		XtRemoveInput(journal.id);
+		(void)kill(journal.pid, SIGTERM);
+		finish_ckpt();
+	}
+	if (journal.fp) {
+		fclose(journal.fp);
+		journal.fp = NULL;
+	}
+	remove_files(getpid(), journal.first_gen, journal.gen);
+	journal.first_gen = journal.gen + 1;
+	journal.have_ckpt = False;
+	journal.ckpt_bytes = 0;
+	journal.state = J_CLEAN;
+	clear_hints();
+}
+
+/*
+ * Called on a crash. Return True, if the edits are recoverable from the
+ * journal, and keep the journal files.
+ */
+Boolean
+journal_preserve(void)
+{
+	char	name[PATH_MAX];
+
+	if (!appres.journal || update_figs || journal.state != J_ACTIVE ||
+			journal.work || !journal.have_ckpt || !journal.fp)
+		return False;
+	if (fflush(journal.fp) == EOF)
+		return False;
+	journal.keep = True;
+	fprintf(stderr, "xfig: the figure can be recovered from %s, "
+			"by starting xfig again\n",
+			journal_name(name, sizeof name, getpid(), journal.gen,
+				"jnl"));
+	return True;
+}
+
+/* on exit, remove the journal files */
+void
+journal_close(void)
+{
+	if (journal.keep || journal.state == J_OFF)
+		return;
+	if (journal.pid != -1) {
+		(void)kill(journal.pid, SIGTERM);
+		(void)waitpid(journal.pid, NULL, 0);
+		journal.pid = -1;
+	}
+	if (journal.fp) {
+		fclose(journal.fp);
+		journal.fp = NULL;
+	}
+	remove_files(getpid(), journal.first_gen, journal.gen);
+	journal.state = J_OFF;
+}
+
+
+/*
+ * Recovery: replay the records into text blocks, one per top-level object.
+ */
+
+struct text {
+	char	*s;
+	size_t	len;
+};
+
+struct text_array {
+	struct text	*t;
+	size_t		n;
+	size_t		size;
+};
+
+struct replay {
+	struct text		header;
+	struct text		path;
+	struct text		dir;
+	struct text_array	list[J_NTYPES];
+};
+
+static void
+free_text(struct text *t)
+{
+	free(t->s);
+	t->s = NULL;
+	t->len = 0;
+}
+
+static int
+replay_record(struct replay *r, int kind, int t, long idx, struct text *data)
+{
+	struct text_array	*a;
+
+	switch (kind) {
+	case 'P':
+		free_text(&r->path);
+		r->path = *data;
+		return 0;
+	case 'W':
+		free_text(&r->dir);
+		r->dir = *data;
+		return 0;
+	case 'H':
+		free_text(&r->header);
+		r->header = *data;
+		return 0;
+	}
+
+	if (t < 0 || t >= J_NTYPES)
+		return -1;
+	a = &r->list[t];
+	switch (kind) {
+	case 'A':
+		if (a->n == a->size) {
+			size_t		size = a->size ? 2 * a->size : 256;
+			struct text	*p = realloc(a->t, size * sizeof *p);
+			if (!p)
+				return -1;
+			a->t = p;
+			a->size = size;
+		}
+		if (idx < 0 || (size_t)idx > a->n)
+			idx = a->n;
+		memmove(a->t + idx + 1, a->t + idx,
+				(a->n - idx) * sizeof *a->t);
+		a->t[idx] = *data;
+		++a->n;
+		return 0;
+	case 'R':
+		if (idx < 0 || (size_t)idx >= a->n)
+			return -1;
+		free_text(&a->t[idx]);
+		a->t[idx] = *data;
+		return 0;
+	case 'D':
+		if (idx < 0 || (size_t)idx >= a->n)
+			return -1;
+		free_text(&a->t[idx]);
+		memmove(a->t + idx, a->t + idx + 1,
+				(a->n - idx - 1) * sizeof *a->t);
+		--a->n;
+		free_text(data);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Replay the records in file name. A truncated last record, e.g., written
+ * during the crash, ends the replay. Return -1, if the file cannot be read.
+ */
+static int
+replay_file(const char *name, struct replay *r)
+{
+	char		line[128];
+	char		kind;
+	int		t;
+	long		idx;
+	size_t		len;
+	struct text	data;
+	FILE		*fp;
+
+	if (!(fp = fopen(name, "rb")))
+		return -1;
+	if (!fgets(line, sizeof line, fp) || strcmp(line, JOURNAL_MAGIC)) {
+		fclose(fp);
+		return -1;
+	}
+	while (fgets(line, sizeof line, fp) &&
+			sscanf(line, "%c %d %ld %zu", &kind, &t, &idx,
+				&len) == 4) {
+		data.len = len;
+		if (!(data.s = malloc(len + 1)))
+			break;
+		if (fread(data.s, 1, len, fp) != len) {
+			free(data.s);
+			break;
+		}
+		data.s[len] = '\0';
+		if (replay_record(r, kind, t, idx, &data)) {
+			free(data.s);
+			break;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+/* Write the recovered figure, return 0 on success. */
+static int
+write_recovered(struct replay *r, char *name, size_t size)
+{
+	int	t;
+	size_t	i;
+	int	fd;
+	char	*base;
+	char	*dot;
+	Boolean	in_dir;
+	FILE	*fp;
+
+	base = r->path.s && *r->path.s ? strrchr(r->path.s, '/') : NULL;
+	base = base ? base + 1 : r->path.s && *r->path.s ? r->path.s : "SAVE";
+	/* write into the directory of the figure, if possible, otherwise
+	   into the private directory of the journals */
+	in_dir = r->dir.s && !access(r->dir.s, W_OK);
+	snprintf(name, size, "%s/%s", in_dir ? r->dir.s : journal_dir(), base);
+	if ((dot = strrchr(name, '.')) && !strcmp(dot, ".fig"))
+		*dot = '\0';
+	snprintf(name + strlen(name), size - strlen(name), ".recovered-%ld.fig",
+			(long)getpid());
+
+	/* do not follow a link, or overwrite a file, planted under that name */
+	if ((fd = open(name, O_WRONLY | O_CREAT | O_EXCL, in_dir ?
+			S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH |
+			S_IWOTH : S_IRUSR | S_IWUSR)) == -1)
+		return -1;
+	if (!(fp = fdopen(fd, "wb"))) {
+		close(fd);
+		return -1;
+	}
+	fwrite(r->header.s, 1, r->header.len, fp);
+	for (t = 0; t < J_NTYPES; ++t)
+		for (i = 0; i < r->list[t].n; ++i)
+			fwrite(r->list[t].t[i].s, 1, r->list[t].t[i].len, fp);
+	if (ferror(fp)) {
+		fclose(fp);
+		return -1;
+	}
+	return fclose(fp);
+}
+
+static void
+recover_pid(pid_t pid, int min_gen, int max_gen)
+{
+	int		g;
+	int		ckpt;
+	size_t		i;
+	char		name[PATH_MAX];
+	struct replay	r;
+
+	/* the newest complete checkpoint */
+	for (ckpt = max_gen; ckpt >= min_gen; --ckpt)
+		if (!access(journal_name(name, sizeof name, pid, ckpt, "ckpt"),
+					R_OK))
+			break;
+	if (ckpt < min_gen) {
+		/* only a journal, without its starting point */
+		remove_files(pid, min_gen, max_gen);
+		return;
+	}
+
+	memset(&r, 0, sizeof r);
+	if (replay_file(name, &r) == 0) {
+		for (g = ckpt; g <= max_gen; ++g)
+			(void)replay_file(journal_name(name, sizeof name, pid,
+						g, "jnl"), &r);
+		if (r.header.s && write_recovered(&r, name, sizeof name) == 0)
+			file_msg("Recovered the figure %s of an interrupted "
+					"session into %s", r.path.s && *r.path.s
+					? r.path.s : "(unnamed)", name);
+		else
+			file_msg("Cannot recover the figure of an interrupted "
+					"session: %s", strerror(errno));
+	}
+	free_text(&r.header);
+	free_text(&r.path);
+	free_text(&r.dir);
+	for (g = 0; g < J_NTYPES; ++g) {
+		for (i = 0; i < r.list[g].n; ++i)
+			free_text(&r.list[g].t[i]);
+		free(r.list[g].t);
+	}
+	remove_files(pid, min_gen, max_gen);
+}
+
+/* Return True, if name is a regular file of the user. */
+static Boolean
+owned(const char *name)
+{
+	struct stat	st;
+
+	return !lstat(name, &st) && S_ISREG(st.st_mode) &&
+		st.st_uid == getuid();
+}
+
+/* Return True, if a running xfig holds the lock on the journal name. */
+static Boolean
+in_use(const char *name)
+{
+	int		fd;
+	Boolean		ret;
+	struct flock	lock;
+
+	if ((fd = open(name, O_RDONLY | O_NOFOLLOW)) == -1)
+		return False;
+	memset(&lock, 0, sizeof lock);
+	lock.l_type = F_RDLCK;
+	lock.l_whence = SEEK_SET;
+	ret = fcntl(fd, F_GETLK, &lock) || lock.l_type != F_UNLCK;
+	close(fd);
+	return ret;
+}
+
+/*
+ * On start-up, recover the figures of crashed xfig processes of the user on
+ * this host from their journals.
+ */
+void
+journal_recover(void)
+{
+	char		prefix[PATH_MAX];
+	char		name[PATH_MAX];
+	char		*p;
+	size_t		prefix_len;
+	struct dirent	*d;
+	DIR		*dir;
+	struct {
+		pid_t	pid;
+		int	min_gen;
+		int	max_gen;
+	}		found[32];
+	int		i;
+	int		n = 0;
+
+	if (!appres.journal || update_figs || !journal_dir())
+		return;
+
+	/* the file name prefix is xfig-journal-<host>- */
+	journal_name(prefix, sizeof prefix, 0, 0, "");
+	if (!(p = strrchr(prefix, '-')))
+		return;
+	p[1] = '\0';
+	p = strrchr(prefix, '/') + 1;
+	prefix_len = strlen(p);
+
+	if (!(dir = opendir(journal_dir())))
+		return;
+	while ((d = readdir(dir))) {
+		long	pid;
+		int	gen;
+
+		if (strncmp(d->d_name, p, prefix_len) ||
+				sscanf(d->d_name + prefix_len, "%ld.%d", &pid,
+					&gen) != 2)
+			continue;
+		snprintf(name, sizeof name, "%s/%s", journal_dir(), d->d_name);
+		if (!owned(name))
+			continue;
+		for (i = 0; i < n && found[i].pid != (pid_t)pid; ++i)
+			;
+		if (i == n) {
+			if (n == sizeof found / sizeof found[0])
+				continue;
+			found[n].pid = (pid_t)pid;
+			found[n].min_gen = found[n].max_gen = gen;
+			++n;
+		}
+		if (gen < found[i].min_gen)
+			found[i].min_gen = gen;
+		if (gen > found[i].max_gen)
+			found[i].max_gen = gen;
+	}
+	closedir(dir);
+
+	for (i = 0; i < n; ++i) {
+		/* the newest journal is locked while its xfig is running; a pid
+		   alone may have been reused */
+		if (in_use(journal_name(name, sizeof name, found[i].pid,
+						found[i].max_gen, "jnl")))
+			continue;
+		recover_pid(found[i].pid, found[i].min_gen, found[i].max_gen);
+	}
+}
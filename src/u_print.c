@@ -21,26 +21,32 @@
 #endif
 #include "u_print.h"
 
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>		/* creat(), open() */
 #include <locale.h>
+#include <signal.h>		/* kill(), SIGTERM */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
 #endif
+#include <time.h>		/* clock_gettime() */
 #include <unistd.h>
+#include <sys/stat.h>
 #include <X11/Intrinsic.h>
 
 #include "resources.h"
 #include "mode.h"
+#include "object.h"
+#include "f_picobj.h"		/* ABSOLUTE_PATH */
 #include "f_save.h"
 #include "f_util.h"
+#include "u_cache.h"
 #include "u_colors.h"
 #include "u_spawn.h"
 #include "u_create.h"		/* new_string */
-#include "w_cursor.h"
 #include "w_layers.h"
 #include "w_msgpanel.h"
 #include "w_util.h"
@@ -51,12 +57,15 @@ Boolean	print_hpgl_pcl_switch;
 Boolean	hpgl_specified_font;
 Boolean	pdf_pagemode;
 int	preview_type;
+int	max_exports = 1;	/* the number of exports running concurrently */
+int	num_exports_done = 0;	/* exports finished successfully */
 
 
 static void	build_layer_list (char *layers);
 static void	append_group (char *list, char *num, int first, int last);
 
 #define	ARGBUF_SIZE	16
+#define	EXPORT_CACHE	"export"	/* the kind of entries in the disk cache */
 
 /*
  * Break the string given in cmdline at spaces. Spaces quoted by a backslash are
@@ -119,11 +128,12 @@ cmdlinetoargarray(char *args[restrict], int size, char *restrict cmdline)
 }
 
 /*
- * Write the export language to args[2].
+ * Write the export language to args[2]. If bound is True, only the layers
+ * given in layers make up the bounding box.
  */
 static void
 start_argumentlist(char *arg[restrict], char argbuf[restrict][ARGBUF_SIZE],
-		int *restrict a, int *restrict b, char *layers)
+		int *restrict a, int *restrict b, char *layers, Boolean bound)
 {
 	/* a refers to the index of arg[], b to the index of argbuf[] */
 	*b = -1;
@@ -141,10 +151,10 @@ start_argumentlist(char *arg[restrict], char argbuf[restrict][ARGBUF_SIZE],
 					"only %d characters available",
 					appres.magnification/100., ARGBUF_SIZE);
 	}
-	if (!print_all_layers) {
+	if (layers[0]) {
 		arg[++*a] = "-D";
 		arg[++*a] = layers;
-		if (bound_active_layers)
+		if (bound)
 			arg[++*a] = "-K";
 	}
 }
@@ -204,44 +214,629 @@ border_arg(char *args[restrict], char argbuf[const restrict][ARGBUF_SIZE],
 				border, argbuf[*b]);
 }
 
+/*
+ * Exports run in the background. The figure is written once into memory, and
+ * fed from there to the fig2dev processes through pipes. A few output
+ * languages need several fig2dev runs, each run is a job. The jobs of an
+ * export run concurrently, each reading the same figure. The exports are
+ * queued, at most max_exports of them run at the same time.
+ * If appres.export_cache is set, the key of each job, a hash of the figure,
+ * its picture files and the fig2dev arguments, is stored in the disk cache
+ * together with the size and time of the output file. A job whose key and
+ * output file did not change is not run again.
+ */
+struct export {
+	char		*file;		/* the name shown to the user */
+	char		*buf;		/* the figure */
+	size_t		len;
+	Boolean		cacheable;
+	uint64_t	key;		/* of the figure and its pictures */
+	int		skipped;	/* the jobs found to be up to date */
+	int		refcount;	/* the unfinished jobs, plus the caller
+					   of print_export() */
+	Boolean		failed;
+	Boolean		cancelled;
+	Boolean		started;
+	struct timespec	start;		/* when the first job started */
+	char		**written;	/* the output files of finished jobs */
+	int		num_written;
+};
+
+static struct export_job {
+	struct export		*exp;
+	char			**args;		/* for fig2dev */
+	char			*outfile;	/* absolute path */
+	char			*dir;		/* directory to run fig2dev in */
+	uint64_t		key;		/* see struct export */
+	size_t			pos;		/* bytes of exp->buf written */
+	int			fdin;		/* stdin of fig2dev */
+	int			fdout;
+	int			fderr;
+	pid_t			pid;		/* -1, if not started */
+	XtInputId		in_id;
+	XtInputId		err_id;
+	size_t			errlen;
+	char			errbuf[256];
+	struct export_job	*next;
+} *export_queue = NULL;
+
+/* the cache entry of an output file, its key is the hash of the path */
+struct export_entry {
+	uint64_t	key;		/* of the job that wrote the file */
+	off_t		size;
+	time_t		mtime;
+	ino_t		ino;
+};
+
+static void	finish_job(struct export_job *job);
+static void	start_exports(void);
+
+/*
+ * Hash the size and modification time of the picture files in obj into
+ * *key. Return -1 if a file can not be found.
+ */
 static int
-spawn_export_to_fd(char *const args[restrict], int fdout)
+hash_pictures(F_compound *obj, uint64_t *key)
 {
-	int	fd;
-	int	stat;
+	char		*file;
+	F_line		*l;
+	F_compound	*c;
+	struct stat	st;
 
-	/* all these commands do their own error reporting */
-	if ((fd = spawn_popen_fd(args, "w", fdout)) < 0)
-		return -1;
-	stat = write_fd(fd);
-	fd = spawn_pclose(fd);
-	if (stat || fd)
-		return -1;
+	for (c = obj->compounds; c != NULL; c = c->next)
+		if (hash_pictures(c, key))
+			return -1;
+	for (l = obj->lines; l != NULL; l = l->next) {
+		if (l->type != T_PICTURE || l->pic->pic_cache == NULL)
+			continue;
+		file = ABSOLUTE_PATH(l->pic->pic_cache->file);
+		if (stat(file, &st))
+			return -1;
+		*key = cache_hash(*key, file, strlen(file) + 1);
+		*key = cache_hash(*key, &st.st_size, sizeof st.st_size);
+		*key = cache_hash(*key, &st.st_mtime, sizeof st.st_mtime);
+	}
 	return 0;
 }
 
+/*
+ * Return True, if the cache entry of job->outfile shows that the file was
+ * written by a job with the same key, and was not changed since.
+ */
+static Boolean
+up_to_date(struct export_job *job)
+{
+	size_t			n;
+	struct export_entry	entry;
+	struct stat		st;
+	FILE			*fp;
+
+	if (!(fp = cache_open(EXPORT_CACHE, cache_hash(CACHE_HASH_INIT,
+					job->outfile, strlen(job->outfile)))))
+		return False;
+	n = fread(&entry, sizeof entry, 1, fp);
+	fclose(fp);
+	return n == 1 && entry.key == job->key && !stat(job->outfile, &st) &&
+		entry.size == st.st_size && entry.mtime == st.st_mtime &&
+		entry.ino == st.st_ino;
+}
+
+/*
+ * Record the key of job with the output file it wrote.
+ */
+static void
+store_entry(struct export_job *job)
+{
+	struct export_entry	entry;
+	struct stat		st;
+
+	if (stat(job->outfile, &st))
+		return;
+	memset(&entry, 0, sizeof entry);
+	entry.key = job->key;
+	entry.size = st.st_size;
+	entry.mtime = st.st_mtime;
+	entry.ino = st.st_ino;
+	(void)cache_write(EXPORT_CACHE, cache_hash(CACHE_HASH_INIT,
+				job->outfile, strlen(job->outfile)),
+			&entry, sizeof entry, NULL, 0);
+}
+
+/*
+ * Write the figure into memory, for the exports. Return NULL on error.
+ */
+static struct export *
+new_export(const char *restrict file)
+{
+	int		err;
+	FILE		*fp;
+	struct export	*exp;
+
+	if (!(exp = malloc(sizeof(struct export))))
+		return NULL;
+	exp->buf = NULL;
+	exp->len = 0;
+	exp->refcount = 1;
+	exp->failed = False;
+	exp->cancelled = False;
+	exp->started = False;
+	exp->skipped = 0;
+	exp->written = NULL;
+	exp->num_written = 0;
+	if (!(exp->file = strdup(file))) {
+		free(exp);
+		return NULL;
+	}
+	if (!(fp = open_memstream(&exp->buf, &exp->len))) {
+		file_msg("Cannot create stream: %s", strerror(errno));
+		free(exp->file);
+		free(exp);
+		return NULL;
+	}
+	err = write_stream(fp);
+	if (fclose(fp) || err) {
+		free(exp->buf);
+		free(exp->file);
+		free(exp);
+		return NULL;
+	}
+
+	exp->key = cache_hash(CACHE_HASH_INIT, exp->buf, exp->len);
+	exp->cacheable = appres.export_cache &&
+			!hash_pictures(&objects, &exp->key);
+	return exp;
+}
+
+/*
+ * Drop a reference to exp. When the last job finished, report the result.
+ * If exp was cancelled, remove the output files of the jobs that finished
+ * before.
+ */
+static void
+release_export(struct export *exp)
+{
+	int		i;
+	struct timespec	end;
+
+	if (--exp->refcount > 0)
+		return;
+	for (i = 0; i < exp->num_written; ++i) {
+		if (exp->cancelled)
+			(void)unlink(exp->written[i]);
+		free(exp->written[i]);
+	}
+	free(exp->written);
+	if (!exp->failed && !exp->cancelled)
+		++num_exports_done;
+	if (update_figs && exp->started) {
+		/* batch mode, report the time */
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		put_msg("Export to \"%s\" %s, %.2f s", exp->file,
+				exp->failed ? "failed" : "done",
+				(double)(end.tv_sec - exp->start.tv_sec) +
+				(end.tv_nsec - exp->start.tv_nsec) / 1e9);
+	} else if (exp->skipped && !exp->started && !exp->failed) {
+		put_msg("Export to \"%s\" up to date", exp->file);
+	} else {
+		put_msg("Export to \"%s\" %s", exp->file, exp->cancelled ?
+				"stopped" : (exp->failed ? "failed" : "done"));
+	}
+	free(exp->buf);
+	free(exp->file);
+	free(exp);
+}
+
+/*
+ * Pass the output file of the finished job to its export, to remove it if
+ * the export is cancelled later.
+ */
+static void
+remember_output(struct export_job *job)
+{
+	char		**written;
+	struct export	*exp = job->exp;
+
+	if (!(written = realloc(exp->written,
+				(exp->num_written + 1) * sizeof(char *))))
+		return;
+	exp->written = written;
+	exp->written[exp->num_written++] = job->outfile;
+	job->outfile = NULL;
+}
+
+static void
+free_job(struct export_job *job)
+{
+	char	**arg;
+
+	if (job->fdout != -1)
+		(void)close(job->fdout);
+	if (job->exp->cancelled && job->outfile)
+		(void)unlink(job->outfile);
+	else if (job->outfile && job->pid != -1 && !job->exp->cancelled)
+		remember_output(job);
+	if (job->args) {
+		for (arg = job->args; *arg; ++arg)
+			free(*arg);
+		free(job->args);
+	}
+	free(job->outfile);
+	free(job->dir);
+	release_export(job->exp);
+	free(job);
+}
+
+/*
+ * Queue fig2dev, called with the arguments args, to convert the figure in
+ * exp to outfile. fig2dev runs in the current directory. Call
+ * start_exports() after queueing all jobs of exp.
+ * Return 0 on success.
+ */
 static int
-spawn_exportcommand(char *const args[restrict], const char *restrict outfile)
+queue_export(char *const args[restrict], const char *restrict outfile,
+		struct export *exp)
 {
-	int	fdout;
+	int			n;
+	char			dir[PATH_MAX];
+	struct export_job	*job;
+	struct export_job	**j;
+
+	if (!getcwd(dir, sizeof dir)) {
+		file_msg("Cannot get current directory: %s", strerror(errno));
+		exp->failed = True;
+		return -1;
+	}
+	if (!(job = calloc(1, sizeof(struct export_job)))) {
+		exp->failed = True;
+		return -1;
+	}
+	job->exp = exp;
+	++exp->refcount;
+	job->fdin = job->fdout = job->fderr = -1;
+	job->pid = -1;
+
+	for (n = 0; args[n]; ++n)
+		;
+	if (!(job->args = calloc(n + 1, sizeof(char *))))
+		goto error;
+	for (n = 0; args[n]; ++n)
+		if (!(job->args[n] = strdup(args[n])))
+			goto error;
+	if (!(job->dir = strdup(dir)))
+		goto error;
+	if (*outfile == '/') {
+		job->outfile = strdup(outfile);
+	} else if ((job->outfile = new_string(strlen(dir) + strlen(outfile)
+					+ 1))) {
+		sprintf(job->outfile, "%s/%s", dir, outfile);
+	}
+	if (!job->outfile)
+		goto error;
+
+	/* the figure, the arguments and the directory make up the key */
+	if (exp->cacheable) {
+		job->key = exp->key;
+		for (n = 0; args[n]; ++n)
+			job->key = cache_hash(job->key, args[n],
+					strlen(args[n]) + 1);
+		job->key = cache_hash(job->key, dir, strlen(dir));
+		if (up_to_date(job)) {
+			++exp->skipped;
+			free_job(job);
+			return 0;
+		}
+	}
 
-	if ((fdout = open(outfile, O_CREAT | O_WRONLY | O_TRUNC,
+	if ((job->fdout = open(outfile, O_CREAT | O_WRONLY | O_TRUNC,
 					S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP |
 					S_IROTH | S_IWOTH)) == -1) {
 		file_msg("Cannot open file %s: %s", outfile, strerror(errno));
+		free(job->outfile);	/* do not unlink it */
+		job->outfile = NULL;
+		goto error;
+	}
+
+	for (j = &export_queue; *j; j = &(*j)->next)
+		;
+	*j = job;
+	return 0;
+
+error:
+	exp->failed = True;
+	free_job(job);
+	return -1;
+}
+
+/* called by XtAppAddInput, when the pipe to fig2dev accepts data */
+static void
+export_write(XtPointer client_data, int *fd, XtInputId *id)
+{
+	(void)fd;
+	(void)id;
+	struct export_job	*job = (struct export_job *)client_data;
+	ssize_t			n;
+
+	n = write(job->fdin, job->exp->buf + job->pos,
+			job->exp->len - job->pos);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (n > 0)
+		job->pos += n;
+	/* on error, e.g., EPIPE, fig2dev reports the reason */
+	if (n == -1 || job->pos == job->exp->len) {
+		XtRemoveInput(job->in_id);
+		(void)close(job->fdin);
+		job->fdin = -1;
+	}
+}
+
+/* called by XtAppAddInput, when fig2dev writes to stderr or finishes */
+static void
+export_read(XtPointer client_data, int *fd, XtInputId *id)
+{
+	(void)fd;
+	(void)id;
+	struct export_job	*job = (struct export_job *)client_data;
+	ssize_t			n;
+	char			buf[256];
+
+	n = read(job->fderr, buf, sizeof buf);
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (n > 0) {
+		/* keep the first 255 bytes, not more */
+		if ((size_t)n > sizeof job->errbuf - 1 - job->errlen)
+			n = sizeof job->errbuf - 1 - job->errlen;
+		memcpy(job->errbuf + job->errlen, buf, n);
+		job->errlen += n;
+		return;
+	}
+
+	/* fig2dev closed stderr, it finished */
+	finish_job(job);
+	start_exports();
+}
+
+/*
+ * Reap the process of job, report any error, and remove job from the queue.
+ */
+static void
+finish_job(struct export_job *job)
+{
+	struct export_job	**j;
+
+	if (job->fdin != -1) {
+		XtRemoveInput(job->in_id);
+		(void)close(job->fdin);
+	}
+	XtRemoveInput(job->err_id);
+	(void)close(job->fderr);
+	if (job->errlen > 0) {
+		job->errbuf[job->errlen] = '\0';
+		file_msg("Error message from spawned process: %s",
+				job->errbuf);
+	}
+	if (spawn_wait(job->pid, job->exp->cancelled ? SIGTERM : 0))
+		job->exp->failed = True;
+	else if (job->exp->cacheable && !job->exp->failed &&
+			!job->exp->cancelled)
+		store_entry(job);
+
+	for (j = &export_queue; *j != job; j = &(*j)->next)
+		;
+	*j = job->next;
+	free_job(job);
+}
+
+/*
+ * Spawn fig2dev for job. Return 0 on success.
+ */
+static int
+start_job(struct export_job *job)
+{
+	int	pd[2];
+	char	cwd[PATH_MAX];
+
+	if (!getcwd(cwd, sizeof cwd)) {
+		file_msg("Cannot get current directory: %s", strerror(errno));
+		return -1;
+	}
+	if (pipe(pd)) {
+		file_msg("Cannot create pipe: %s", strerror(errno));
+		return -1;
+	}
+	/* Do not block xfig while writing, and do not pass the write end to
+	   fig2dev, otherwise fig2dev would never see the end of the figure. */
+	if (fcntl(pd[1], F_SETFD, FD_CLOEXEC) == -1 ||
+			fcntl(pd[1], F_SETFL, O_NONBLOCK) == -1 ||
+			chdir(job->dir)) {
+		file_msg("Cannot spawn %s: %s", job->args[0], strerror(errno));
+		(void)close(pd[0]);
+		(void)close(pd[1]);
 		return -1;
 	}
 
-	if (spawn_export_to_fd(args, fdout)) {
-		(void)close(fdout);
+	/* spawn_start() reports its errors */
+	job->fderr = spawn_start(job->args, pd[0], job->fdout, &job->pid);
+	if (chdir(cwd))
+		file_msg("Cannot go to directory %s: %s", cwd, strerror(errno));
+	(void)close(pd[0]);
+	(void)close(job->fdout);
+	job->fdout = -1;
+	if (job->fderr == -1) {
+		(void)close(pd[1]);
+		job->pid = -1;
 		return -1;
 	}
 
-	if (close(fdout))
-		file_msg("Cannnot close file %s: %s", outfile, strerror(errno));
+	job->fdin = pd[1];
+	job->in_id = XtAppAddInput(tool_app, job->fdin,
+			(XtPointer)XtInputWriteMask, export_write, job);
+	job->err_id = XtAppAddInput(tool_app, job->fderr,
+			(XtPointer)XtInputReadMask, export_read, job);
 	return 0;
 }
 
+/*
+ * Start the jobs of the first max_exports exports in the queue, unless they
+ * already run.
+ */
+static void
+start_exports(void)
+{
+	int			queued;
+	int			running = 0;
+	Boolean			started;
+	Boolean			active;
+	struct export		*exp;
+	struct export_job	*job;
+	struct export_job	**j;
+
+	j = &export_queue;
+	while (*j && running < max_exports) {
+		exp = (*j)->exp;
+		started = active = False;
+		/* the jobs of an export follow each other in the queue */
+		while ((job = *j) && job->exp == exp) {
+			if (job->pid != -1) {
+				active = True;
+			} else if (!exp->cancelled && !start_job(job)) {
+				active = started = True;
+			} else {
+				exp->failed = True;
+				*j = job->next;
+				free_job(job);
+				continue;
+			}
+			j = &job->next;
+		}
+		if (active)
+			++running;
+		if (!started)
+			continue;
+		if (!exp->started) {
+			exp->started = True;
+			clock_gettime(CLOCK_MONOTONIC, &exp->start);
+		}
+		if (update_figs)
+			continue;
+		/* count the exports waiting in the queue */
+		queued = 0;
+		for (job = *j; job; job = job->next)
+			if (!job->next || job->next->exp != job->exp)
+				++queued;
+		if (queued)
+			put_msg("Exporting to \"%s\" . . . (%d more queued)",
+					exp->file, queued);
+		else
+			put_msg("Exporting to \"%s\" . . .", exp->file);
+	}
+}
+
+/*
+ * Return the number of exports queued or running.
+ */
+int
+exports_pending(void)
+{
+	int			n = 0;
+	struct export_job	*job;
+
+	for (job = export_queue; job; job = job->next)
+		if (!job->next || job->next->exp != job->exp)
+			++n;
+	return n;
+}
+
+/*
+ * Stop the oldest export in the queue, and remove the output files written
+ * so far.
+ */
+void
+cancel_export(void)
+{
+	struct export		*exp;
+	struct export_job	*job;
+	struct export_job	*next;
+
+	if (!export_queue) {
+		put_msg("No export running");
+		return;
+	}
+	exp = export_queue->exp;
+	exp->cancelled = True;
+	/* Do not wait until stderr is closed, fig2dev might have spawned
+	   processes that keep it open. */
+	for (job = export_queue; job; job = next) {
+		next = job->next;
+		if (job->exp == exp && job->pid != -1) {
+			(void)kill(job->pid, SIGTERM);
+			finish_job(job);
+		}
+	}
+	start_exports();
+}
+
+/* called by XtAppAddTimeOut, when waiting for the exports took too long */
+static void
+wait_timeout(XtPointer client_data, XtIntervalId *id)
+{
+	(void)id;
+
+	*(Boolean *)client_data = True;
+}
+
+/*
+ * Block until all queued exports finished, but handle the events meanwhile.
+ * If timeout is positive, stop the exports that did not finish within
+ * timeout seconds.
+ */
+void
+wait_exports(int timeout)
+{
+	Boolean			expired = False;
+	XtIntervalId		id = 0;
+	struct export_job	*job;
+
+	if (!export_queue)
+		return;
+	put_msg("Waiting for the exports to finish . . .");
+	if (timeout > 0)
+		id = XtAppAddTimeOut(tool_app, (unsigned long)timeout * 1000,
+				wait_timeout, (XtPointer)&expired);
+	while (export_queue && !expired)
+		XtAppProcessEvent(tool_app, XtIMAll);
+	if (expired) {
+		file_msg("Exports did not finish within %d s, stopped",
+				timeout);
+		/* do not start the exports still waiting in the queue */
+		for (job = export_queue; job; job = job->next)
+			job->exp->cancelled = True;
+		while (export_queue)
+			cancel_export();
+	} else if (id) {
+		XtRemoveTimeOut(id);
+	}
+}
+
+/*
+ * Close the pipes to fig2dev. A forked child that does not exec() must call
+ * this, otherwise fig2dev would not see the end of the figure until the
+ * child exits.
+ */
+void
+close_export_pipes(void)
+{
+	struct export_job	*job;
+
+	for (job = export_queue; job; job = job->next) {
+		if (job->fdin != -1)
+			(void)close(job->fdin);
+		if (job->fderr != -1)
+			(void)close(job->fderr);
+	}
+}
+
 void
 print_to_printer(int lpcommand, char *printer, char *backgrnd, float mag,
 		Boolean print_all_layers, Boolean bound_active_layers,
@@ -263,7 +858,8 @@ print_to_printer(int lpcommand, char *printer, char *backgrnd, float mag,
 	   to cur_file_dir */
 	change_directory(cur_file_dir);
 
-	start_argumentlist(args, argbuf, &a, &b, layers);
+	start_argumentlist(args, argbuf, &a, &b, layers,
+			bound_active_layers && !print_all_layers);
 
 	addargs_postscript(args, &a, grid, backgrnd);
 
@@ -318,7 +914,8 @@ print_to_batchfile(int fdout, const char *restrict backgrnd,
 	   to cur_file_dir */
 	change_directory(cur_file_dir);
 
-	start_argumentlist(args, argbuf, &a, &b, layers);
+	start_argumentlist(args, argbuf, &a, &b, layers,
+			bound_active_layers && !print_all_layers);
 
 	addargs_postscript(args, &a, grid, backgrnd);
 
@@ -352,18 +949,70 @@ strsub(char *prcmd, char *find, char *repl, char *result, int global)
 }
 
 /*
- * Export to the current output language cur_exp_lang.
+ * Copy the next layer group from *groups to layers, as argument to the -D
+ * option of fig2dev. Groups are separated by white space, each is a list of
+ * depths or ranges of depths, e.g., "50,60:70". A group starting with '-'
+ * lists the depths to leave out. Return 0, if there is no further group.
+ */
+static int
+next_group(char **groups, char *layers)
+{
+	char	*s = *groups;
+	size_t	len;
+
+	while (isspace((unsigned char)*s))
+		++s;
+	if (*s == '\0')
+		return 0;
+	len = strcspn(s, " \t\n");
+	*groups = s + len;
+
+	if (*s != '+' && *s != '-')
+		*layers++ = '+';
+	if (len > PATH_MAX - 2)
+		len = PATH_MAX - 2;
+	memcpy(layers, s, len);
+	layers[len] = '\0';
+	return 1;
+}
+
+/*
+ * Return the name of the output file of the n-th layer group, file with "_n"
+ * inserted before the suffix, e.g., slides_1.pdf. Free the returned string.
+ */
+static char *
+group_file(const char *file, int n)
+{
+	const char	*base;
+	const char	*suf;
+	char		*name;
+
+	if ((base = strrchr(file, '/')))
+		++base;
+	else
+		base = file;
+	if (!(suf = strrchr(base, '.')) || suf == base)
+		suf = file + strlen(file);
+
+	if (!(name = malloc(strlen(file) + 13)))
+		return NULL;
+	sprintf(name, "%.*s_%d%s", (int)(suf - file), file, n, suf);
+	return name;
+}
+
+/*
+ * Queue the fig2dev runs that export the figure in exp to file, in the
+ * output language cur_exp_lang, with the layer list layers. If bound is True,
+ * the bounding box only covers the layers in layers.
  * Return 0 on success.
- * xoff, yoff, and border are in postscript points (1/72 inch)
  */
-int
-print_export(char *file, int xoff, int yoff, char *backgrnd, char *transparent,
-	      Boolean use_transp_backg, int border, char *grid)
+static int
+queue_language(struct export *exp, char *file, char *name, char *layers,
+		Boolean bound, int xoff, int yoff, char *backgrnd, char *transparent,
+		Boolean use_transp_backg, int border, char *grid)
 {
-	char		layers[PATH_MAX];
 	const char	dummy[] = "x";
-	char		*outfile, *name;
-	char		*save_file_dir;
+	char		*outfile;
 	char		*tmp_name = NULL;
 	char		*suf;
 	char		*args[36];
@@ -373,36 +1022,13 @@ print_export(char *file, int xoff, int yoff, char *backgrnd, char *transparent,
 	int		b;	/* argbuf counter */
 	size_t		bufsize = sizeof argbuf[1];
 
-	/* if file exists, ask if ok */
-	if (!ok_to_write(file, "EXPORT"))
+	if (!(outfile = strdup(file)))
 		return 1;
 
-	outfile = strdup(file);
-	if (strlen(cur_filename) == 0)
-		name = file;
-	else
-		name = cur_filename;
-
-	put_msg("Exporting to file \"%s\" in %s mode ...     ",
-			file, appres.landscape ? "LANDSCAPE" : "PORTRAIT");
-	app_flush();		/* make sure message gets displayed */
-
-	/*
-	 * print_export is called from w_export.c where the current directory
-	 * is set to cur_export_dir, but write_file() writes picture paths
-	 * relative to cur_file_dir; Hence, for the spawned fig2dev command to
-	 * find the images, set cur_file_dir to cur_export_dir.
-	 */
-	save_file_dir = strdup(cur_file_dir);
-	strcpy(cur_file_dir, cur_export_dir);
-
-	/* if the user only wants the active layers, build that list */
-	build_layer_list(layers);
-
 	/* set the numeric locale to C so we get decimal points for numbers */
 	setlocale(LC_NUMERIC, "C");
 
-	start_argumentlist(args, argbuf, &a, &b, layers);
+	start_argumentlist(args, argbuf, &a, &b, layers, bound);
 
 	/* args[2] points to the language */
 	args[2] = lang_items[cur_exp_lang];
@@ -510,16 +1136,17 @@ print_export(char *file, int xoff, int yoff, char *backgrnd, char *transparent,
 			strcpy(tmp_name + len, ".eps");
 			args[2] = lang_items[LANG_PSTEX];
 			args[++a] = NULL;
-			spawn_exportcommand(args, tmp_name);
+			queue_export(args, tmp_name, exp);
 
 			/* make it suitable for pdftex. */
 			strcpy(tmp_name + len, ".pdf");
 			args[2] = lang_items[LANG_PDFTEX];
-			spawn_exportcommand(args, tmp_name);
+			queue_export(args, tmp_name, exp);
 
 			/* and then the tex code. */
 			setlocale(LC_NUMERIC, "C");
-			start_argumentlist(args, argbuf, &a, &b, layers);
+			start_argumentlist(args, argbuf, &a, &b, layers,
+					bound);
 			args[2] = "pstex_t";
 			tmp_name[len] = '\0';
 			args[++a] = "-p";
@@ -534,7 +1161,7 @@ print_export(char *file, int xoff, int yoff, char *backgrnd, char *transparent,
 			/* Options were already set above
 			    - output the first file */
 			args[++a] = NULL;
-			spawn_exportcommand(args, outfile);
+			queue_export(args, outfile, exp);
 
 			/* now the text part */
 			/* add "_t" to the output filename */
@@ -550,7 +1177,8 @@ print_export(char *file, int xoff, int yoff, char *backgrnd, char *transparent,
 			}
 			strcpy(outfile + len, "_t");
 			setlocale(LC_NUMERIC, "C");
-			start_argumentlist(args, argbuf, &a, &b, layers);
+			start_argumentlist(args, argbuf, &a, &b, layers,
+					bound);
 			args[2] = "pstex_t";
 			args[++a] = "-p";
 			args[++a] = tmp_name;
@@ -564,10 +1192,11 @@ print_export(char *file, int xoff, int yoff, char *backgrnd, char *transparent,
 			/* Output first file */
 			args[2] = lang_items[LANG_EPS];
 			args[++a] = NULL;
-			spawn_exportcommand(args, outfile);
+			queue_export(args, outfile, exp);
 
 			setlocale(LC_NUMERIC, "C");
-			start_argumentlist(args, argbuf, &a, &b, layers);
+			start_argumentlist(args, argbuf, &a, &b, layers,
+					bound);
 			args[2] = lang_items[LANG_PDF];
 
 			/* any grid spec */
@@ -704,30 +1333,115 @@ print_export(char *file, int xoff, int yoff, char *backgrnd, char *transparent,
 	}
 	/* Nothing to do for everything else */
 
-	/* make a busy cursor */
-	set_temp_cursor(wait_cursor);
-
 	/* reset to original locale */
 	setlocale(LC_NUMERIC, "");
 
-	/* now execute fig2dev */
+	/* now queue fig2dev */
 	args[++a] = NULL;
-	if (!spawn_exportcommand(args, outfile))
-		put_msg("Export to \"%s\" done", file);
-	else
-		put_msg("Export to \"%s\" failed", file);
-
-	/* and reset the cursor */
-	reset_cursor();
+	queue_export(args, outfile, exp);
 
 	/* free tempnames */
 free_tmp_name:
 	if (tmp_name)
 		free(tmp_name);
 free_outfile:
+	free(outfile);
+	return ret;
+}
+
+/*
+ * Export to the current output language cur_exp_lang.
+ * If groups lists layer groups, write one file per group, see group_file().
+ * Return 0 on success.
+ * xoff, yoff, and border are in postscript points (1/72 inch)
+ */
+int
+print_export(char *file, int xoff, int yoff, char *backgrnd, char *transparent,
+	      Boolean use_transp_backg, int border, char *grid, char *groups)
+{
+	char		layers[PATH_MAX];
+	char		*outfile, *name;
+	char		*group;
+	char		*save_file_dir;
+	struct export	*exp;
+	int		ngroups = 0;
+	int		n;
+	int		ret = 0;
+
+	/* if a file exists, ask if ok */
+	if (groups) {
+		for (group = groups; next_group(&group, layers); ) {
+			if (!(outfile = group_file(file, ++ngroups)))
+				return 1;
+			n = ok_to_write(outfile, "EXPORT");
+			free(outfile);
+			if (!n)
+				return 1;
+		}
+	}
+	if (ngroups == 0 && !ok_to_write(file, "EXPORT"))
+		return 1;
+
+	if (strlen(cur_filename) == 0)
+		name = file;
+	else
+		name = cur_filename;
+
+	if (ngroups)
+		put_msg("Exporting %d layer groups of \"%s\" in %s mode ...     ",
+				ngroups, file,
+				appres.landscape ? "LANDSCAPE" : "PORTRAIT");
+	else
+		put_msg("Exporting to file \"%s\" in %s mode ...     ",
+				file, appres.landscape ? "LANDSCAPE" : "PORTRAIT");
+	app_flush();		/* make sure message gets displayed */
+
+	/*
+	 * print_export is called from w_export.c where the current directory
+	 * is set to cur_export_dir, but write_file() writes picture paths
+	 * relative to cur_file_dir; Hence, for the spawned fig2dev command to
+	 * find the images, set cur_file_dir to cur_export_dir.
+	 */
+	save_file_dir = strdup(cur_file_dir);
+	strcpy(cur_file_dir, cur_export_dir);
+
+	/* write the figure once, for all fig2dev runs below */
+	if (!(exp = new_export(file))) {
+		put_msg("Export to \"%s\" failed", file);
+		strcpy(cur_file_dir, save_file_dir);
+		free(save_file_dir);
+		return 1;
+	}
+
+	if (ngroups == 0) {
+		/* if the user only wants the active layers, build that list */
+		build_layer_list(layers);
+		ret = queue_language(exp, file, name, layers,
+				bound_active_layers && !print_all_layers,
+				xoff, yoff, backgrnd, transparent,
+				use_transp_backg, border, grid);
+	}
+	/* the runs of all groups are started together, below */
+	for (n = 0, group = groups; n < ngroups && !ret; ) {
+		if (!next_group(&group, layers) ||
+				!(outfile = group_file(file, ++n))) {
+			ret = 1;
+			break;
+		}
+		/* all groups share the bounding box of the whole figure */
+		ret = queue_language(exp, outfile, name, layers, False,
+				xoff, yoff, backgrnd, transparent,
+				use_transp_backg, border, grid);
+		free(outfile);
+	}
+
+	/* the result is reported when the last job finished */
+	if (ret)
+		exp->failed = True;
+	start_exports();
+	release_export(exp);
 	strcpy(cur_file_dir, save_file_dir);
 	free(save_file_dir);
-	free(outfile);
 	return ret;
 }
 
@@ -27,6 +27,8 @@ extern Boolean	print_hpgl_pcl_switch;
 extern Boolean	hpgl_specified_font;
 extern Boolean	pdf_pagemode;
 extern int	preview_type;
+extern int	max_exports;
+extern int	num_exports_done;
 extern int	print_spawn_printcmd(int lpcommand, const char *restrict file,
 			const char *restrict printer, char *restrict params);
 extern int	print_to_batchfile(int fdout, const char *restrict backgrnd,
@@ -36,7 +38,11 @@ extern void	print_to_printer(int lpcommand, char *printer, char *backgrnd,
 			Boolean bound_active_layers, char *grid, char *params);
 extern int	print_export(char *file, int xoff, int yoff, char *backgrnd,
 			char *transparent, Boolean use_transp_backg, int border,
-			char *grid);
+			char *grid, char *groups);
+extern void	cancel_export(void);
+extern int	exports_pending(void);
+extern void	wait_exports(int timeout);
+extern void	close_export_pipes(void);
 extern void	make_rgb_string (int color, char *rgb_string);
 
 #endif
@@ -271,9 +271,11 @@ closefderr(int fderr)
 static int
 wait_pid(pid_t pid, int ignore_signal)
 {
-	int	ret;
+	int	ret = 0;
 
-	if (waitpid(pid, &ret, 0) == -1) {
+	while (waitpid(pid, &ret, 0) == -1) {
+		if (errno == EINTR)
+			continue;
 		file_msg("Error waiting for spawned process: %s",
 				strerror(errno));
 		return -1;
@@ -353,8 +355,8 @@ poll_fderr(int fderr, int timeout)
  * Silently consume any output to stdout or stderr from the command.
  * Return 1 if the command exists, 0 if not or if an error occurs.
  */
-int
-spawn_exists(const char *restrict command, const char *restrict arg)
+static int
+probe_command(const char *restrict command, const char *restrict arg)
 {
 	int		ret;
 	int		pderr[2];
@@ -452,6 +454,126 @@ spawn_exists(const char *restrict command, const char *restrict arg)
 		return 0;
 }
 
+/*
+ * A registry of the external programs tested so far by spawn_exists(), with
+ * the argument they were tested with. Each program is searched and probed
+ * only once per argument. If PATH changes, the registry is cleared.
+ */
+static struct tool {
+	char		*command;
+	char		*arg;
+	int		exists;
+	struct tool	*next;
+} *tools = NULL;
+
+static char	*tools_path = NULL;
+
+static void
+clear_tools(void)
+{
+	struct tool	*t;
+
+	while ((t = tools)) {
+		tools = t->next;
+		free(t->command);
+		free(t->arg);
+		free(t);
+	}
+}
+
+/*
+ * Return 1 if command is an executable file in one of the directories listed
+ * in path, or, if command contains a slash, if command is executable.
+ */
+static int
+in_path(const char *restrict command, const char *restrict path)
+{
+	int		ret = 0;
+	size_t		len;
+	size_t		clen = strlen(command);
+	const char	*p;
+	char		*file;
+	struct stat	st;
+
+	if (strchr(command, '/'))
+		return !stat(command, &st) && S_ISREG(st.st_mode) &&
+			!access(command, X_OK);
+
+	if (!(file = malloc(strlen(path) + clen + 3)))
+		return 1;	/* let the probe decide */
+	for (p = path; !ret; p += len + 1) {
+		len = strcspn(p, ":");
+		if (len == 0) {		/* an empty entry is the current dir */
+			memcpy(file, command, clen + 1);
+		} else {
+			memcpy(file, p, len);
+			file[len] = '/';
+			memcpy(file + len + 1, command, clen + 1);
+		}
+		ret = !stat(file, &st) && S_ISREG(st.st_mode) &&
+			!access(file, X_OK);
+		if (p[len] == '\0')
+			break;
+	}
+	free(file);
+	return ret;
+}
+
+static struct tool *
+find_tool(const char *restrict command, const char *restrict arg)
+{
+	const char	*path;
+	struct tool	*t;
+
+	if (!(path = getenv("PATH")))
+		path = "";
+	if (!tools_path || strcmp(path, tools_path)) {
+		clear_tools();
+		free(tools_path);
+		if (!(tools_path = strdup(path)))
+			return NULL;
+	}
+
+	if (!arg)
+		arg = "";
+	for (t = tools; t; t = t->next)
+		if (!strcmp(t->command, command) && !strcmp(t->arg, arg))
+			return t;
+
+	if (!(t = malloc(sizeof(struct tool))))
+		return NULL;
+	if (!(t->command = strdup(command))) {
+		free(t);
+		return NULL;
+	}
+	if (!(t->arg = strdup(arg))) {
+		free(t->command);
+		free(t);
+		return NULL;
+	}
+	/* only spawn the command, if it can be found at all */
+	t->exists = in_path(command, path) && probe_command(command, *arg ?
+			arg : NULL);
+	t->next = tools;
+	tools = t;
+	return t;
+}
+
+/*
+ * Return 1 if the command exists and succeeds with the argument arg, 0 if
+ * not. The command is only spawned on the first call; the result is kept
+ * until PATH changes.
+ */
+int
+spawn_exists(const char *restrict command, const char *restrict arg)
+{
+	struct tool	*t;
+
+	if (!(t = find_tool(command, arg)))
+		return probe_command(command, arg);
+	return t->exists;
+}
+
 /*
  * Spawn the process argv[0] with the NULL-terminated arguments argv.
  * Search PATH for the command given in argv[0].
@@ -475,6 +597,37 @@ spawn_usefd(char *const argv[restrict], int fdin, int fdout)
 	return wait_pid(pid, 0);
 }
 
+/*
+ * Spawn the process argv[0] with the NULL-terminated arguments argv, but do
+ * not wait for it to finish. If either of the file descriptors fdin or fdout
+ * is non-negative, the spawned process reads from fdin and writes to fdout.
+ * Return the process id in pid and a file descriptor to read the standard
+ * error of the process from. When the process finishes, read() on that file
+ * descriptor returns 0. Close it, and call spawn_wait().
+ * Return -1 on error.
+ */
+int
+spawn_start(char *const argv[restrict], int fdin, int fdout, pid_t *pid)
+{
+	int	fderr;
+	int	fd[2] = {fdin, fdout};
+
+	if (open_process(argv, fd, -1, pid, &fderr))
+		return -1;
+	return fderr;
+}
+
+/*
+ * Wait for the process pid, started by spawn_start(). Termination by the
+ * signal ignore_signal, if non-zero, is not reported as an error.
+ * Return the exit status of the process, or -1 if it can not be waited for.
+ */
+int
+spawn_wait(pid_t pid, int ignore_signal)
+{
+	return wait_pid(pid, ignore_signal);
+}
+
 /*
  * Spawn a process and open a pipe, either for reading ("r") or for writing.
  * Return a file desrciptor for reading the output of the process, or for
@@ -23,6 +23,8 @@
 #include "config.h"		/* restrict */
 #endif
 
+#include <sys/types.h>		/* pid_t */
+
 extern int	spawn_exists(const char *restrict cmd,const char *restrict arg);
 extern int	spawn_usefd(char *const argv[restrict], int fdin, int fdout);
 extern int	spawn_popen_fd(char *const argv[restrict],
@@ -30,4 +32,7 @@ extern int	spawn_popen_fd(char *const argv[restrict],
 extern int	spawn_popen(char *const argv[restrict],
 				const char *restrict type);
 extern int	spawn_pclose(int pd);
+extern int	spawn_start(char *const argv[restrict], int fdin, int fdout,
+				pid_t *pid);
+extern int	spawn_wait(pid_t pid, int ignore_signal);
 #endif
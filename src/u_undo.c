@@ -82,7 +82,7 @@ int		last_action = F_NULL;
 
 /*************** LOCAL *****************/
 
-static int	last_object;
+int		last_object;
 static F_pos	last_position, new_position;
 static int	last_arcpointnum;
 static F_point *last_prev_point, *last_selected_point, *last_next_point;
@@ -25,6 +25,8 @@
 /*******************  DECLARE EXPORTS  ********************/
 
 extern F_compound	 saved_objects;
+extern int		 last_action;
+extern int		 last_object;
 extern F_compound	 object_tails;
 extern F_arrow		*saved_for_arrow;
 extern F_arrow		*saved_back_arrow;
@@ -28,14 +28,25 @@
 #endif
 #include "w_capture.h"
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include <X11/X.h>
 #include <X11/Xutil.h>
+#ifdef USE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
 
 #include "resources.h"
 #include "u_colors.h"
+#include "u_print.h"
 #include "w_capture.h"
 #include "w_msgpanel.h"
 #include "f_util.h"
@@ -57,6 +68,17 @@ static int	getCurrentColors(Window w, XColor *colors);	/* returns number of colo
 
 static unsigned char *data;		/* pointer to captured & converted data */
 
+#ifdef HAVE_PNG
+/* a png file written in the background, see write_capture() */
+static struct capture {
+	pid_t		pid;
+	int		fd;
+	XtInputId	id;
+	char		*file;
+	void		(*done)(char *file, Boolean written);
+} capture = { -1, -1, 0, NULL, NULL };
+#endif
+
 /*
   statics which need to be set up before we can call
   drawRect - drawRect relies on GC being an xor so
@@ -67,11 +89,128 @@ static GC       rectGC;
 
 
 
+#ifdef HAVE_PNG
+/*
+ * Write the image in data to the png file filename.
+ * Return True on success.
+ */
+static Boolean
+write_png_file(char *filename, int type, unsigned char *Red,
+		unsigned char *Green, unsigned char *Blue, int numcols,
+		unsigned int width, unsigned int height)
+{
+    FILE	*pngfile;
+    Boolean	written;
+
+    if ((pngfile = fopen(filename, "wb")) == NULL) {
+	file_msg("Cannot open PNG file %s for writing: %s", filename,
+			strerror(errno));
+	return False;
+    }
+    written = write_png(pngfile, data, type, Red, Green, Blue, numcols,
+			width, height);
+    if (fclose(pngfile))
+	written = False;
+    if (!written) {
+	file_msg("Problem writing PNG file from screen capture");
+	(void)unlink(filename);
+    }
+    return written;
+}
+
+/* called by XtAppAddInput, when the child process closes the pipe */
+static void
+capture_written(XtPointer client_data, int *fd, XtInputId *id)
+{
+    (void)client_data;
+    int		status = 0;
+    pid_t	pid;
+    Boolean	written;
+
+    XtRemoveInput(*id);
+    close(*fd);
+    while ((pid = waitpid(capture.pid, &status, 0)) == -1 && errno == EINTR)
+	;
+    capture.pid = -1;
+    capture.fd = -1;
+
+    /* if the child can not be waited for, its exit status is unknown */
+    written = pid != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (written) {
+	put_msg("Screenshot written to \"%s\"", capture.file);
+    } else {
+	if (pid == -1)
+	    file_msg("Cannot wait for the screen capture: %s",
+			strerror(errno));
+	(void)unlink(capture.file);
+	file_msg("Problem writing PNG file from screen capture");
+    }
+    capture.done(capture.file, written);
+    free(capture.file);
+    capture.file = NULL;
+}
+
+/*
+ * Write the captured image to filename. The png file is encoded by a forked
+ * child process, which inherits a copy of the image, while xfig continues.
+ * When the file is written, done() is called. If no process can be forked,
+ * write the file in the foreground.
+ */
+static void
+write_capture(char *filename, int type, unsigned char *Red,
+		unsigned char *Green, unsigned char *Blue, int numcols,
+		unsigned int width, unsigned int height,
+		void (*done)(char *file, Boolean written))
+{
+    int		pd[2];
+
+    put_msg("Writing screenshot to PNG file . . .");
+    app_flush();
+
+    if (pipe(pd) == 0) {
+	if ((capture.pid = fork()) == 0) {
+	    /* the child, must not talk to the X server */
+	    close(pd[0]);
+	    close_export_pipes();
+	    update_figs = True;		/* any message goes to stderr */
+	    _exit(write_png_file(filename, type, Red, Green, Blue, numcols,
+				    width, height) ? 0 : 1);
+	}
+	close(pd[1]);
+	if (capture.pid != -1) {
+	    capture.fd = pd[0];
+	    capture.file = strdup(filename);
+	    capture.done = done;
+	    capture.id = XtAppAddInput(tool_app, pd[0],
+			(XtPointer)XtInputReadMask, capture_written, NULL);
+	    return;
+	}
+	close(pd[0]);
+    }
+
+    if (write_png_file(filename, type, Red, Green, Blue, numcols,
+				width, height)) {
+	put_msg("Screenshot written to \"%s\"", filename);
+	done(filename, True);
+    } else {
+	done(filename, False);
+    }
+}
+#endif	/* HAVE_PNG */
+
+/*
+ * Let the user select an area of the screen, and write it to the png file
+ * filename in the background. When the file is written, done() is called.
+ * Return True if an area was captured.
+ */
 Boolean
-captureImage(Widget window, char *filename)	/* returns True on success */
+captureImage(Widget window, char *filename,
+		void (*done)(char *file, Boolean written))
 {
 #ifndef HAVE_PNG
-	(void) window, filename;
+	(void)window;
+	(void)filename;
+	(void)done;
 	file_msg("Screen capture not possible without png support.");
 	return False;
 #else
@@ -79,13 +218,15 @@ captureImage(Widget window, char *filename)	/* returns True on success */
 			Green[MAX_COLORMAP_SIZE],
 			Blue[MAX_COLORMAP_SIZE];
     int			numcols;
-    int			captured;
     unsigned int	width, height;
     Boolean		status;
-
-    FILE		*pngfile;
     int			 type;
 
+    if (capture.pid != -1) {
+	put_msg("Still writing the previous screenshot");
+	return False;
+    }
+
     if (!ok_to_write(filename, "EXPORT") )
 	return(False);
 
@@ -107,29 +248,14 @@ captureImage(Widget window, char *filename)	/* returns True on success */
     if ( status == False ) {
 	put_msg("Nothing Captured.");
 	app_flush();
-	captured = False;
-    } else {
-	/* encode the image and write to the file */
-	put_msg("Writing screenshot to PNG file...");
-
-	app_flush();
-
-	if ((pngfile = fopen(filename,"wb"))==0) {
-	    file_msg("Cannot open PNG file %s for writing",filename);
-	    put_msg("Cannot open PNG file %s for writing",filename);
-	    captured = False;
-	} else {
-	    /* write the png file */
-	    if (!write_png(pngfile, data, type, Red, Green, Blue, numcols, width, height))
-		file_msg("Problem writing PNG file from screen capture");
-	    fclose(pngfile);
-	    captured = True;
-	}
-
-	free(data);
-   }
+	return False;
+    }
 
-   return ( captured );
+    /* encode the image and write to the file */
+    write_capture(filename, type, Red, Green, Blue, numcols, width, height,
+		    done);
+    free(data);
+    return True;
 #endif	/* HAVE_PNG */
 }
 
@@ -158,6 +284,200 @@ rshift(int mask)
     return i;
 }
 
+#ifdef USE_XSHM
+/* the shared memory of the image grabbed by shm_get_image(), or NULL */
+static XShmSegmentInfo	shminfo = { 0, -1, NULL, False };
+static Boolean		shm_error;
+
+static int
+shm_error_handler(Display *d, XErrorEvent *err)
+{
+    (void)d;
+    (void)err;
+    shm_error = True;
+    return 0;
+}
+
+/*
+ * Grab the area of the root window through the MIT shared memory extension,
+ * which spares sending the image through the connection to the X server.
+ * Return NULL if the extension can not be used, e.g., on a remote display.
+ */
+static XImage *
+shm_get_image(Window root, int x, int y, unsigned int width,
+		unsigned int height)
+{
+    XImage		*image;
+    XWindowAttributes	xwa;
+    int			(*handler)(Display *, XErrorEvent *);
+
+    if (!XShmQueryExtension(tool_d) || !XGetWindowAttributes(tool_d, root, &xwa))
+	return NULL;
+    image = XShmCreateImage(tool_d, xwa.visual, xwa.depth, ZPixmap, NULL,
+			&shminfo, width, height);
+    if (!image)
+	return NULL;
+    shminfo.shmid = shmget(IPC_PRIVATE,
+			(size_t)image->bytes_per_line * image->height,
+			IPC_CREAT | 0600);
+    if (shminfo.shmid == -1) {
+	XDestroyImage(image);
+	return NULL;
+    }
+    shminfo.shmaddr = image->data = shmat(shminfo.shmid, NULL, 0);
+    /* the segment is removed when xfig and the server detached from it */
+    (void)shmctl(shminfo.shmid, IPC_RMID, NULL);
+    if (shminfo.shmaddr == (char *)-1) {
+	shminfo.shmaddr = NULL;
+	image->data = NULL;
+	XDestroyImage(image);
+	return NULL;
+    }
+    shminfo.readOnly = False;
+
+    /* errors come in asynchronously, catch them while waiting */
+    XSync(tool_d, False);
+    shm_error = False;
+    handler = XSetErrorHandler(shm_error_handler);
+    if (XShmAttach(tool_d, &shminfo)) {
+	XSync(tool_d, False);
+	if (!shm_error) {
+	    XShmGetImage(tool_d, root, image, x, y, AllPlanes);
+	    XSync(tool_d, False);
+	}
+	if (shm_error) {
+	    XShmDetach(tool_d, &shminfo);
+	    XSync(tool_d, False);
+	}
+    } else {
+	shm_error = True;
+    }
+    XSetErrorHandler(handler);
+
+    if (shm_error) {
+	(void)shmdt(shminfo.shmaddr);
+	shminfo.shmaddr = NULL;
+	image->data = NULL;
+	XDestroyImage(image);
+	return NULL;
+    }
+    return image;
+}
+#endif	/* USE_XSHM */
+
+/*
+ * Grab the area of the root window. Release the image with free_image().
+ */
+static XImage *
+grab_area(int x, int y, unsigned int width, unsigned int height)
+{
+    Window	root = XDefaultRootWindow(tool_d);
+#ifdef USE_XSHM
+    XImage	*image;
+
+    if ((image = shm_get_image(root, x, y, width, height)))
+	return image;
+#endif
+    return XGetImage(tool_d, root, x, y, width, height, AllPlanes, ZPixmap);
+}
+
+static void
+free_image(XImage *image)
+{
+#ifdef USE_XSHM
+    if (shminfo.shmaddr) {
+	XShmDetach(tool_d, &shminfo);
+	(void)shmdt(shminfo.shmaddr);
+	shminfo.shmaddr = NULL;
+	image->data = NULL;
+    }
+#endif
+    XDestroyImage(image);
+}
+
+/*
+ * Convert the pixels of a TrueColor image to rgb triples in dptr. Each
+ * sample is taken from the pixel with its mask, and scaled to 0--255
+ * through a table. Rows of 32-bit pixels with 8-bit samples, in the byte
+ * order of the machine, are converted directly. Otherwise, a row is first
+ * unpacked into whole pixels.
+ * Return False if out of memory.
+ */
+static Boolean
+convert_truecolor(XImage *image, unsigned char *dptr)
+{
+    static const unsigned short	one = 1;
+    int			i, j, c, k;
+    int			bits[3], shift[3];
+    int			bytes = (image->bits_per_pixel + 7) / 8;
+    unsigned int	max[3];
+    unsigned long	mask[3];
+    unsigned char	table[3][256];
+    unsigned char	*src;
+    uint32_t		pix;
+    uint32_t		*row;
+    Boolean		host_order;
+
+    mask[0] = image->red_mask;
+    mask[1] = image->green_mask;
+    mask[2] = image->blue_mask;
+    for (c = 0; c < 3; ++c) {
+	shift[c] = rshift(mask[c]);
+	for (bits[c] = 0; bits[c] < 32 && (mask[c] >> (shift[c] + bits[c])) & 1;
+			++bits[c])
+	    ;
+	/* keep the eight most significant bits */
+	if (bits[c] > 8) {
+	    shift[c] += bits[c] - 8;
+	    bits[c] = 8;
+	}
+	max[c] = (1u << bits[c]) - 1u;
+	for (k = 0; k <= (int)max[c]; ++k)
+	    table[c][k] = max[c] ? (k * 255u + max[c] / 2) / max[c] : 0;
+    }
+    host_order = (image->byte_order == LSBFirst) ==
+			(*(const unsigned char *)&one == 1);
+
+    if (bytes == 4 && host_order && bits[0] == 8 && bits[1] == 8 &&
+		    bits[2] == 8) {
+	for (i = 0; i < image->height; ++i) {
+	    row = (uint32_t *)(image->data + (size_t)i * image->bytes_per_line);
+	    for (j = 0; j < image->width; ++j, dptr += 3) {
+		dptr[0] = (unsigned char)(row[j] >> shift[0]);
+		dptr[1] = (unsigned char)(row[j] >> shift[1]);
+		dptr[2] = (unsigned char)(row[j] >> shift[2]);
+	    }
+	}
+	return True;
+    }
+
+    if ((row = malloc(image->width * sizeof(uint32_t))) == NULL)
+	return False;
+    for (i = 0; i < image->height; ++i) {
+	src = (unsigned char *)image->data + (size_t)i * image->bytes_per_line;
+	if (image->byte_order == MSBFirst) {
+	    for (j = 0; j < image->width; ++j) {
+		for (pix = 0, k = 0; k < bytes; ++k)
+		    pix = pix << 8 | *src++;
+		row[j] = pix;
+	    }
+	} else {
+	    for (j = 0; j < image->width; ++j, src += bytes) {
+		for (pix = 0, k = bytes - 1; k >= 0; --k)
+		    pix = pix << 8 | src[k];
+		row[j] = pix;
+	    }
+	}
+	for (j = 0; j < image->width; ++j, dptr += 3) {
+	    dptr[0] = table[0][(row[j] >> shift[0]) & max[0]];
+	    dptr[1] = table[1][(row[j] >> shift[1]) & max[1]];
+	    dptr[2] = table[2][(row[j] >> shift[2]) & max[2]];
+	}
+    }
+    free(row);
+    return True;
+}
+
 static Boolean
 getImageData(unsigned int *w, unsigned int *h, int *type, int *nc,
 		unsigned char *Red, unsigned char *Green, unsigned char *Blue)
@@ -165,29 +485,22 @@ getImageData(unsigned int *w, unsigned int *h, int *type, int *nc,
     XColor	colors[MAX_COLORMAP_SIZE];
     int		colused[MAX_COLORMAP_SIZE];
     int		mapcols[MAX_COLORMAP_SIZE];
-    int		red, green, blue;
-    int		red_mask, green_mask, blue_mask;
-    int		red_shift, green_shift, blue_shift;
-
     int		x, y;
     unsigned int width, height;
     Window	cw;
     static	XImage *image;
 
-    int		i, j;
+    int		i;
     int		numcols;
-    int		bytes_per_pixel, byte_order;
-    int		byte_inc;
-    int		pix;
-    unsigned char *iptr, *rowptr, *dptr;
+    int		bytes_per_pixel;
+    unsigned char *iptr, *dptr;
 
     sleep(1);   /* in case he'd like to click on something */
     beep();	/* signal user */
     if ( selectedRootArea(&x, &y, &width, &height, &cw ) == False )
 	return False;
 
-    image = XGetImage(tool_d, XDefaultRootWindow(tool_d),
-				 x, y, width, height, AllPlanes, ZPixmap);
+    image = grab_area(x, y, width, height);
     if (!image || !image->data) {
 	file_msg("Cannot capture %dx%d area - memory problems?",
 							width,height);
@@ -210,108 +523,27 @@ getImageData(unsigned int *w, unsigned int *h, int *type, int *nc,
 	if ( numcols <= 0 ) {  /* ought not to get here as capture button
 			    should not appear for these displays */
 	    file_msg("Cannot handle a display without a colormap.");
-	    XDestroyImage( image );
+	    free_image(image);
 	    return False;
 	}
     }
 
-    iptr = rowptr = (unsigned char *) image->data;
+    iptr = (unsigned char *) image->data;
     dptr = data = (unsigned char *) malloc(height*width*bytes_per_pixel);
     if ( !dptr ) {
 	file_msg("Insufficient memory to convert image.");
-	XDestroyImage(image);
+	free_image(image);
 	return False;
     }
 
     if (tool_vclass == TrueColor) {
-	byte_order = image->byte_order;		/* MSBFirst or LSBFirst */
-	/* bit_order = image->bitmap_bit_order; */
-	red_mask = image->red_mask;
-	green_mask = image->green_mask;
-	blue_mask = image->blue_mask;
-	/* find how many bits we need to shift values */
-	red_shift = rshift(red_mask);
-	green_shift = rshift(green_mask);
-	blue_shift = rshift(blue_mask);
-	switch (image->bits_per_pixel) {
-	    case 8: byte_inc = 1;
-		    break;
-	    case 16: byte_inc = 2;
-		    break;
-	    case 24: byte_inc = 3;
-		    break;
-	    case 32: byte_inc = 4;
-		    break;
-	    default: byte_inc = 4;
-		    break;
+	if (!convert_truecolor(image, dptr)) {
+	    file_msg("Insufficient memory to convert image.");
+	    free(data);
+	    free_image(image);
+	    return False;
 	}
 
-	for (i=0; i<image->height; i++) {
-	    for (j=0; j<image->width; j++) {
-		if (byte_order == MSBFirst) {
-		    switch (byte_inc) {
-			case 1:
-				pix =  (unsigned char) *iptr;
-				break;
-			case 2:
-				pix =  (unsigned short) (*iptr << 8);
-				pix += (unsigned char) *(iptr+1);
-				break;
-			case 3:
-				pix =  (unsigned int) (*(iptr) << 16);
-				pix += (unsigned short) (*(iptr+1) << 8);
-				pix += (unsigned char) (*(iptr+2));
-				break;
-			case 4:
-				pix =  (unsigned int) (*(iptr) << 24);
-				pix += (unsigned int) (*(iptr+1) << 16);
-				pix += (unsigned short) (*(iptr+2) << 8);
-				pix += (unsigned char) (*(iptr+3));
-				break;
-		    }
-		} else {
-		    /* LSBFirst */
-		    switch (byte_inc) {
-			case 1:
-				pix =  (unsigned char) *iptr;
-				break;
-			case 2:
-				pix =  (unsigned char) *iptr;
-				pix += (unsigned short) (*(iptr+1) << 8);
-				break;
-			case 3:
-				pix =  (unsigned char) *iptr;
-				pix += (unsigned short) (*(iptr+1) << 8);
-				pix += (unsigned int) (*(iptr+2) << 16);
-				break;
-			case 4:
-				pix =  (unsigned char) *iptr;
-				pix += (unsigned short) (*(iptr+1) << 8);
-				pix += (unsigned int) (*(iptr+2) << 16);
-				pix += (unsigned int) (*(iptr+3) << 24);
-				break;
-		    }
-		} /* if (byte_order ...) */
-
-		/* increment pixel pointer */
-		iptr += byte_inc;
-
-		/* now extract the red, green and blue values using the masks and shifting */
-
-		red   = (pix & red_mask) >> red_shift;
-		green = (pix & green_mask) >> green_shift;
-		blue  = (pix & blue_mask) >> blue_shift;
-		/* store in output data */
-		*(dptr++) = (unsigned char) red;
-		*(dptr++) = (unsigned char) green;
-		*(dptr++) = (unsigned char) blue;
-	    } /* for (j=0; j<image->width ... */
-
-	    /* advance to next scanline row */
-	    rowptr += image->bytes_per_line;
-	    iptr = rowptr;
-	} /* for (i=0; i<image->height ... */
-
     } else if (tool_cells > 2) {
 	/* color image with color table (PseudoColor) */
 	for (i=0; i<numcols; i++) {
@@ -389,7 +621,7 @@ getImageData(unsigned int *w, unsigned int *h, int *type, int *nc,
 	*nc = numcols;
     }
     /* free the image structure */
-    XDestroyImage(image);
+    free_image(image);
     return True;
 }
 
@@ -22,8 +22,10 @@
 
 #include <X11/Intrinsic.h>	/* includes X11/Xlib.h */
 
-/* returns True on success */
-extern Boolean	captureImage(Widget window, char *filename);
+/* returns True if an area was captured; done() is called when the file is
+   written */
+extern Boolean	captureImage(Widget window, char *filename,
+			void (*done)(char *file, Boolean written));
 /* returns True if image capture will work */
 extern Boolean	canHandleCapture(Display *d);
 
@@ -50,9 +50,11 @@
 #include "u_create.h"
 #include "u_draw.h"
 #include "u_fonts.h"
+#include "u_journal.h"
 #include "u_free.h"
 #include "u_list.h"
 #include "u_pan.h"
+#include "u_print.h"
 #include "u_redraw.h"
 #include "u_translate.h"
 #include "u_undo.h"
@@ -662,6 +664,14 @@ quit(Widget w, XtPointer closure, XtPointer call_data)
 
 void goodbye(Boolean abortflag)
 {
+	static Boolean	leaving = False;
+
+	/* events are handled while waiting for the exports, do not come here
+	   twice, unless aborting */
+	if (leaving && !abortflag)
+		return;
+	leaving = True;
+
 	kill_preedit();
 	/* delete the cut buffer only if it is in a temporary directory */
 	if (strncmp(cut_buf_name, TMPDIR, strlen(TMPDIR)) == 0)
@@ -671,6 +681,14 @@ void goodbye(Boolean abortflag)
 	if (batch_exists)
 		unlink(batch_file);
 
+	/* finish the exports running in the background, but do not let a
+	   hanging fig2dev keep xfig from exiting */
+	if (!abortflag)
+		wait_exports(60);
+
+	/* delete the journal, unless the figure must be recovered from it */
+	journal_close();
+
 	XSync(tool_d, False);	/* https://sourceforge.net/p/mcj/tickets/54 */
 
 	/* free all the GC's */
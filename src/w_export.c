@@ -114,11 +114,13 @@ String  export_translations =
 	<Key>F18: PastePanelKey()";
 
 static void     export_panel_cancel(Widget w, XButtonEvent *ev);
+static void	export_panel_stop(Widget w, XButtonEvent *ev);
 static void	update_mag(Widget widget, Widget *item, int *event);
 static XtActionsRec     export_actions[] = {
 	{"DismissExport", (XtActionProc) export_panel_cancel},
 	{"CancelExport", (XtActionProc) export_panel_cancel},
 	{"Export", (XtActionProc) do_export},
+	{"StopExport", (XtActionProc) export_panel_stop},
 	{"UpdateMag", (XtActionProc) update_mag},
 };
 static char	*smooth_choices[] = {
@@ -139,6 +141,7 @@ static intptr_t	xoff_unit_setting, yoff_unit_setting;
 static Widget	export_grid_label;
 static Widget	lang_panel, lang_lab;
 static Widget	layer_choice;
+static Widget	layer_groups_lab, layer_groups_text;
 static Widget	border_lab, border_text, border_spinner;
 static Widget	transp_lab, transp_menu;
 static Widget	background_lab, background_menu;
@@ -150,7 +153,7 @@ static Widget	quality_lab, quality_text, quality_spinner;
 static Widget	smooth_menu_button;
 static Widget	smooth_lab;
 static Widget	orient_lab;
-static Widget	cancel_but, export_but;
+static Widget	cancel_but, export_but, stop_but;
 static Widget	dfile_lab, dfile_text, nfile_lab;
 static Widget	mag_lab;
 static Widget	size_lab;
@@ -215,6 +218,15 @@ export_panel_cancel(Widget w, XButtonEvent *ev)
     export_panel_dismiss();
 }
 
+/* stop the export running in the background */
+static void
+export_panel_stop(Widget w, XButtonEvent *ev)
+{
+	(void)w;
+	(void)ev;
+	cancel_export();
+}
+
 /* get x/y offsets from panel and convert to 1/72 inch for fig2dev */
 
 void exp_getxyoff(int *ixoff, int *iyoff)
@@ -364,7 +376,8 @@ do_export(Widget w)
 	/* call fig2dev to export the file */
 	if (print_export(fval, xoff, yoff, backgrnd,
 				transp == TRANSP_NONE? NULL: transparent,
-				use_transp_backg, border, grid) == 0) {
+				use_transp_backg, border, grid,
+				panel_get_value(layer_groups_text)) == 0) {
 		FirstArg(XtNlabel, fval);
 		SetValues(dfile_text);		/* set the default filename */
 		if (strcmp(fval,default_export_file) != 0)
@@ -1268,6 +1281,41 @@ void create_export_panel(Widget w)
 	layer_choice = make_layer_choice("Export all layers ", "Export only active",
 				export_panel, mag_spinner, NULL, 2, 0);
 
+	/* layer groups, to export one file per group */
+
+	FirstArg(XtNlabel, "Layer groups");
+	NextArg(XtNinternational, False);
+	NextArg(XtNfromVert, mag_spinner);
+	NextArg(XtNfromHoriz, layer_choice);
+	NextArg(XtNhorizDistance, 8);
+	NextArg(XtNborderWidth, 0);
+	NextArg(XtNtop, XtChainTop);
+	NextArg(XtNbottom, XtChainTop);
+	NextArg(XtNleft, XtChainLeft);
+	NextArg(XtNright, XtChainLeft);
+	layer_groups_lab = XtCreateManagedWidget("layer_groups_label",
+				labelWidgetClass, export_panel, Args, ArgCount);
+
+	FirstArg(XtNwidth, 160);
+	NextArg(XtNinternational, False);
+	NextArg(XtNleftMargin, 4);
+	NextArg(XtNeditType, XawtextEdit);
+	NextArg(XtNstring, "");
+	NextArg(XtNinsertPosition, 0);
+	NextArg(XtNfromVert, mag_spinner);
+	NextArg(XtNfromHoriz, layer_groups_lab);
+	NextArg(XtNborderWidth, INTERNAL_BW);
+	NextArg(XtNscrollHorizontal, XawtextScrollWhenNeeded);
+	NextArg(XtNtop, XtChainTop);
+	NextArg(XtNbottom, XtChainTop);
+	NextArg(XtNleft, XtChainLeft);
+	NextArg(XtNright, XtChainLeft);
+	layer_groups_text = XtCreateManagedWidget("layer_groups",
+				asciiTextWidgetClass, export_panel, Args, ArgCount);
+	/* make <return> export the file */
+	XtOverrideTranslations(layer_groups_text,
+			   XtParseTranslationTable(file_name_translations));
+
 	/* the border margin and background color will appear depending on the export language */
 
 	FirstArg(XtNlabel, "Border Margin");
@@ -2006,9 +2054,27 @@ void create_export_panel(Widget w)
 	XtAddEventHandler(export_but, ButtonReleaseMask, False,
 			  (XtEventHandler)do_export, (XtPointer) NULL);
 
-	/* install accelerators for cancel, and export in the main panel */
+	FirstArg(XtNlabel, "Stop");
+	NextArg(XtNinternational, False);
+	NextArg(XtNfromHoriz, export_but);
+	NextArg(XtNhorizDistance, 25);
+	NextArg(XtNfromVert, below);
+	NextArg(XtNvertDistance, 15);
+	NextArg(XtNheight, 25);
+	NextArg(XtNborderWidth, INTERNAL_BW);
+	NextArg(XtNtop, XtChainBottom);
+	NextArg(XtNbottom, XtChainBottom);
+	NextArg(XtNleft, XtChainLeft);
+	NextArg(XtNright, XtChainLeft);
+	stop_but = XtCreateManagedWidget("stop", commandWidgetClass,
+					   bottom_section, Args, ArgCount);
+	XtAddEventHandler(stop_but, ButtonReleaseMask, False,
+			  (XtEventHandler)export_panel_stop, (XtPointer) NULL);
+
+	/* install accelerators for cancel, export and stop in the main panel */
 	XtInstallAccelerators(export_panel, cancel_but);
 	XtInstallAccelerators(export_panel, export_but);
+	XtInstallAccelerators(export_panel, stop_but);
 
 	update_def_filename();
 	/* set the initial wildcard mask based on the current export language */
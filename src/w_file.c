@@ -100,6 +100,7 @@ static Boolean	file_cancel_request = False;
 static Boolean	file_load_request = False;
 static Boolean	file_save_request = False;
 static Boolean	file_merge_request = False;
+static Boolean	sync_save = False;	/* do not save in the background */
 static char	save_file_dir[PATH_MAX];
 
 static Boolean	user_colors_saved = False;
@@ -137,6 +138,7 @@ static void	file_panel_cancel(Widget w, XButtonEvent *ev);
 static void	do_load(Widget w, XButtonEvent *ev), do_merge(Widget w, XButtonEvent *ev);
 static void	merge_request(Widget w, XButtonEvent *ev), cancel_request(Widget w, XButtonEvent *ev), save_request(Widget w, XButtonEvent *ev);
 static void	clear_preview(void);
+static int	save_file(char *file_name, Boolean backup);
 
 DeclareStaticArgs(15);
 static Widget	file_stat_label, file_status, num_obj_label, num_objects;
@@ -521,6 +523,20 @@ warning:
 			"might be written to the saved file.");
 }
 
+/*
+ * Save in the background, unless the figure must be on disk on return,
+ * e.g., before quitting. If backup is True, keep the file that is replaced
+ * as file_name.bak.
+ */
+static int
+save_file(char *file_name, Boolean backup)
+{
+	if (appres.async_save && !sync_save)
+		return write_file_async(file_name, True, backup);
+	else
+		return write_file_bak(file_name, True, backup);
+}
+
 void
 do_save(Widget w, XButtonEvent *ev)
 {
@@ -603,9 +619,9 @@ do_save(Widget w, XButtonEvent *ev)
 
 	    if (!ok_to_write(fname, "SAVE"))
 		return;
+	    /* the file is not renamed away, do not ask again when writing it */
+	    warnexist = False;
 	    XtSetSensitive(save_button, False);
-	    if (appres.write_bak == True)
-		(void) renamefile(fname);
 	    strcpy(tmp_save_dir, cur_file_dir);
 	    set_curfiledir_from_savepath(fname);
 	    if (fname[0] == '~' && fname[1] == '/') {
@@ -618,7 +634,8 @@ do_save(Widget w, XButtonEvent *ev)
 		    memcpy(abs_path, home, home_len);
 		    memcpy(abs_path + home_len, fname + 1, fname_len + 1);
 	    }
-	    if (write_file(*abs_path ? abs_path : fname, True) == 0) {
+	    if (save_file(*abs_path ? abs_path : fname,
+				appres.write_bak) == 0) {
 		FirstArg(XtNlabel, fname);
 		SetValues(cfile_text);
 		if (strcmp(fname, cur_filename) != 0) {
@@ -649,10 +666,9 @@ do_save(Widget w, XButtonEvent *ev)
 	    return;
 	/* not using popup => filename not changed so ok to write existing file */
 	warnexist = False;
-	(void) renamefile(cur_filename);
 	strcpy(tmp_save_dir, cur_file_dir);
 	set_curfiledir_from_savepath(fname);
-	if (write_file(cur_filename, True) == 0)
+	if (save_file(cur_filename, True) == 0)
 	    reset_modifiedflag();
 	strcpy(cur_file_dir, tmp_save_dir);
     }
@@ -675,11 +691,16 @@ Boolean
 query_save(char *msg)
 {
     int		    qresult;
+
+    /* a save running in the background might fail */
+    wait_async_save();
     if (!emptyfigure() && figure_modified && !aborting) {
 	if ((qresult = popup_query(QUERY_YESNOCAN, msg)) == RESULT_CANCEL)
 	    return False;
 	else if (qresult == RESULT_YES) {
+	    sync_save = True;
 	    save_request((Widget) 0, (XButtonEvent *) 0);
+	    sync_save = False;
 	    /*
 	     * if saving was not successful, figure_modified is still true:
 	     * do not quit!
@@ -192,7 +192,8 @@ void app_flush(void)
 {
 	/* this method prevents "ghost" rubberbanding when the user
 	   moves the mouse after creating/resizing object */
-	XSync(tool_d, False);
+	if (tool_d)
+		XSync(tool_d, False);
 }
 
 static void
@@ -0,0 +1,105 @@
+/*
+ * FIG : Facility for Interactive Generation of figures
+ * Copyright (c) 1985-1988 by Supoj Sutanthavibul
+ * Parts Copyright (c) 1989-2015 by Brian V. Smith
+ * Parts Copyright (c) 1991 by Paul King
+ * Parts Copyright (c) 2016-2024 by Thomas Loimer
+ *
+ * Any party obtaining a copy of these files is granted, free of charge, a
+ * full and unrestricted irrevocable, world-wide, paid up, royalty-free,
+ * nonexclusive right and license to deal in this software and documentation
+ * files (the "Software"), including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense and/or sell copies of
+ * the Software, and to permit persons who receive copies from any such
+ * party to do so, with the only requirement being that the above copyright
+ * and this permission notice remain intact.
+ *
+ */
+
+/*
+ *	test5.c: Compare the colors mapped by neu_map_pixel(), which caches
+ *		its results, to the closest colors of the color table.
+ *
+ * Quantize a synthetic photograph-like image to 256 colors, and map each
+ * pixel to the color table. The mean distance of the mapped colors must not
+ * be much larger than the mean distance of the closest colors. With an
+ * argument, also print the time needed to map the image.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "f_neuclrtab.h"
+
+#define	W	512
+#define	H	512
+
+static int
+distance(BYTE *col, BYTE *tab)
+{
+	return abs(col[N_RED] - tab[N_RED]) + abs(col[N_GRN] - tab[N_GRN]) +
+		abs(col[N_BLU] - tab[N_BLU]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	(void)	argv;
+	int	x, y, i, d, best, ncolors;
+	int	mult = 1;
+	int	stat;
+	long	sum_mapped = 0;
+	long	sum_best = 0;
+	clock_t	start;
+	BYTE	*image, *col;
+
+	if ((image = malloc(W * H * 3)) == NULL)
+		return 1;
+	srand48(1);
+	for (y = 0, col = image; y < H; ++y) {
+		for (x = 0; x < W; ++x, col += 3) {
+			col[N_RED] = (BYTE)(x / 2);
+			col[N_GRN] = (BYTE)(y / 2);
+			col[N_BLU] = (BYTE)((x + y) / 4 + (int)(drand48() * 32));
+		}
+	}
+
+	if ((stat = neu_init(W * H)) <= -2) {
+		mult = -stat;
+		stat = neu_init2(W * H * mult);
+	}
+	if (stat == -1)
+		return 1;
+	for (i = 0, col = image; i < W * H; ++i, col += 3)
+		for (x = 0; x < mult; ++x)
+			neu_pixel(col);
+	ncolors = neu_clrtab(256);
+
+	start = clock();
+	for (i = 0, col = image; i < W * H; ++i, col += 3)
+		sum_mapped += distance(col, clrtab[neu_map_pixel(col)]);
+	if (argc > 1)
+		printf("mapped %d pixels in %.3f s\n", W * H,
+				(double)(clock() - start) / CLOCKS_PER_SEC);
+
+	for (i = 0, col = image; i < W * H; ++i, col += 3) {
+		best = 3 * 256;
+		for (x = 0; x < ncolors; ++x)
+			if ((d = distance(col, clrtab[x])) < best)
+				best = d;
+		sum_best += best;
+	}
+	if (argc > 1)
+		printf("mean distance %.3f, closest %.3f\n",
+				(double)sum_mapped / (W * H),
+				(double)sum_best / (W * H));
+
+	free(image);
+	/* allow at most three levels per pixel more than the closest color */
+	return sum_mapped > sum_best + 3L * W * H;
+}
@@ -0,0 +1,162 @@
+/*
+ * FIG : Facility for Interactive Generation of figures
+ * Copyright (c) 1985-1988 by Supoj Sutanthavibul
+ * Parts Copyright (c) 1989-2015 by Brian V. Smith
+ * Parts Copyright (c) 1991 by Paul King
+ * Parts Copyright (c) 2016-2024 by Thomas Loimer
+ *
+ * Any party obtaining a copy of these files is granted, free of charge, a
+ * full and unrestricted irrevocable, world-wide, paid up, royalty-free,
+ * nonexclusive right and license to deal in this software and documentation
+ * files (the "Software"), including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense and/or sell copies of
+ * the Software, and to permit persons who receive copies from any such
+ * party to do so, with the only requirement being that the above copyright
+ * and this permission notice remain intact.
+ *
+ */
+
+/*
+ *	test6.c: Read raw and ascii ppm files with read_ppm(), defined in
+ *		src/f_readppm.c.
+ *
+ * Write a ppm file for each variant, with one or two bytes per sample, or
+ * with decimal numbers, read it and compare the pixels to the samples scaled
+ * to the range 0--255. With an argument, also print the time needed to read
+ * each file.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/X.h>	/* TrueColor */
+#include <X11/Xmd.h>	/* CARD32 */
+
+#include "resources.h"
+#include "object.h"
+#include "f_picobj.h"
+
+/* f_readppm.c */
+extern int	read_ppm(F_pic *pic, struct xfig_stream *restrict pic_stream);
+
+#define	W	1200
+#define	H	900
+#define	FILENAME	"test6.ppm"
+
+static unsigned int
+sample(int x, int y, int c, unsigned int maxval)
+{
+	return (unsigned int)(x * 7 + y * 3 + c * 11) % (maxval + 1u);
+}
+
+static int
+write_ppm(int magic, unsigned int maxval)
+{
+	int		x, y, c;
+	unsigned int	v;
+	FILE		*fp;
+
+	if ((fp = fopen(FILENAME, "wb")) == NULL)
+		return -1;
+	fprintf(fp, "P%c\n# test6.c\n%d %d\n%u\n", magic, W, H, maxval);
+	for (y = 0; y < H; ++y) {
+		for (x = 0; x < W; ++x) {
+			for (c = 0; c < 3; ++c) {
+				v = sample(x, y, c, maxval);
+				if (magic == '3')
+					fprintf(fp, "%u%c", v,
+						x % 5 == 4 && c == 2 ? '\n':' ');
+				else if (maxval > 255u)
+					fprintf(fp, "%c%c", v >> 8, v & 255u);
+				else
+					putc(v, fp);
+			}
+		}
+	}
+	return fclose(fp);
+}
+
+static int
+check_ppm(int magic, unsigned int maxval, int verbose)
+{
+	int			x, y, c;
+	int			stat;
+	int			err = 0;
+	unsigned int		v;
+	CARD32			expect;
+	CARD32			*pixel;
+	clock_t			start;
+	F_pic			pic;
+	struct _pics		pics;
+	struct xfig_stream	pic_stream;
+
+	if (write_ppm(magic, maxval))
+		return 1;
+
+	memset(&pic, 0, sizeof pic);
+	memset(&pics, 0, sizeof pics);
+	pic.pic_cache = &pics;
+	init_stream(&pic_stream);
+	if (open_stream(FILENAME, &pic_stream) == NULL)
+		return 1;
+
+	start = clock();
+	stat = read_ppm(&pic, &pic_stream);
+	if (verbose)
+		printf("P%c, max. value %5u: read %d x %d pixels in %.3f s\n",
+				magic, maxval, W, H,
+				(double)(clock() - start) / CLOCKS_PER_SEC);
+	close_stream(&pic_stream);
+	free_stream(&pic_stream);
+	remove(FILENAME);
+
+	if (stat != PicSuccess || pics.bit_size.x != W || pics.bit_size.y != H)
+		return 1;
+
+	pixel = (CARD32 *)pics.bitmap;
+	for (y = 0; y < H; ++y) {
+		for (x = 0; x < W; ++x, ++pixel) {
+			expect = 0;
+			for (c = 0; c < 3; ++c) {
+				v = sample(x, y, c, maxval);
+				expect = (expect << 8) +
+					(v * 255u + maxval / 2) / maxval;
+			}
+			if (*pixel != expect)
+				++err;
+		}
+	}
+	free(pics.bitmap);
+	if (err && verbose)
+		printf("%d pixels differ\n", err);
+	return err != 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	(void)	argv;
+	int	err = 0;
+
+	/* read 32-bit pixels, map_to_palette() would need a display */
+	tool_vclass = TrueColor;
+	image_bpp = 4;
+	appres.monochrome = False;
+	/* On error, file_msg() tries to open a Widget if update_figs is
+	   False. Set update_figs to True. */
+	update_figs = 1;
+
+	err += check_ppm('6', 255u, argc > 1);
+	err += check_ppm('6', 100u, argc > 1);
+	err += check_ppm('6', 65535u, argc > 1);
+	err += check_ppm('6', 1000u, argc > 1);
+	err += check_ppm('3', 255u, argc > 1);
+	err += check_ppm('3', 4000u, argc > 1);
+
+	return err != 0;
+}